@@ -0,0 +1,96 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TMI_BENCH_BENCH_H_
+#define TMI_BENCH_BENCH_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bench {
+
+/* Global allocation counters, maintained by the operator new/delete
+   replacements in bench_main.cpp. */
+struct alloc_counters
+{
+    uint64_t allocs{0};
+    uint64_t bytes{0};
+    uint64_t live_bytes{0};
+};
+
+alloc_counters get_alloc_counters();
+
+/* Sink for benchmark results so that the work producing them can't be
+   optimized away. */
+void consume(uint64_t value);
+
+struct options
+{
+    std::vector<size_t> sizes{1000, 10000, 100000, 1000000, 10000000};
+    std::string filter;
+    std::chrono::milliseconds min_time{100};
+};
+
+class state
+{
+    const options& m_opts;
+    mutable bool m_printed_header{false};
+
+    void print_row(std::string_view name, std::string_view container, size_t n, double ns_per_op, double allocs_per_op, double bytes_per_elem) const;
+
+public:
+    explicit state(const options& opts) : m_opts(opts) {}
+
+    const std::vector<size_t>& sizes() const { return m_opts.sizes; }
+
+    /* Returns false if the benchmark/container pair has been filtered out. */
+    bool enabled(std::string_view name, std::string_view container) const;
+
+    /* Run setup() followed by a timed body() until min_time has been spent
+       in body(). Each call to body() is expected to perform ops operations.
+       Reports mean time and allocations per operation. */
+    template <typename Setup, typename Body>
+    void run(std::string_view name, std::string_view container, size_t n, size_t ops, double bytes_per_elem, Setup&& setup, Body&& body) const
+    {
+        if (!enabled(name, container)) return;
+        std::chrono::nanoseconds elapsed{0};
+        uint64_t allocs = 0;
+        uint64_t iters = 0;
+        do {
+            setup();
+            const alloc_counters before = get_alloc_counters();
+            const auto start = std::chrono::steady_clock::now();
+            body();
+            const auto end = std::chrono::steady_clock::now();
+            allocs += get_alloc_counters().allocs - before.allocs;
+            elapsed += end - start;
+            iters++;
+        } while (elapsed < m_opts.min_time);
+        const double total_ops = static_cast<double>(iters) * static_cast<double>(ops);
+        print_row(name, container, n, static_cast<double>(elapsed.count()) / total_ops, static_cast<double>(allocs) / total_ops, bytes_per_elem);
+    }
+};
+
+using bench_function = void (*)(const state&);
+
+struct registration
+{
+    registration(std::string_view name, bench_function func);
+};
+
+struct registered_bench
+{
+    std::string_view name;
+    bench_function func;
+};
+
+std::vector<registered_bench>& registered_benchmarks();
+
+} // namespace bench
+
+#endif // TMI_BENCH_BENCH_H_
@@ -0,0 +1,425 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "../tmi.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <set>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef TMI_BENCH_HAVE_BOOST
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
+#endif
+
+namespace {
+
+struct entry
+{
+    uint64_t key;
+    uint64_t payload;
+    entry(uint64_t key_in, uint64_t payload_in) : key(key_in), payload(payload_in) {}
+};
+
+struct entry_key
+{
+    using result_type = uint64_t;
+    TMI_CPP23_STATIC const uint64_t& operator()(const entry& e) TMI_CONST_IF_NOT_CPP23_STATIC noexcept
+    {
+        return e.key;
+    }
+};
+
+struct entry_less
+{
+    using is_transparent = void;
+    bool operator()(const entry& a, const entry& b) const { return a.key < b.key; }
+    bool operator()(const entry& a, uint64_t b) const { return a.key < b; }
+    bool operator()(uint64_t a, const entry& b) const { return a < b.key; }
+};
+
+using tmi_hashed_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::hashed_unique<entry_key>>>;
+using tmi_hashed_non_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::hashed_non_unique<entry_key>>>;
+using tmi_hashed_linked_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::hashed_linked_unique<entry_key>>>;
+using tmi_hashed_linked_non_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::hashed_linked_non_unique<entry_key>>>;
+using tmi_hashed_flat_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::hashed_flat_unique<entry_key>>>;
+using tmi_hashed_flat_non_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::hashed_flat_non_unique<entry_key>>>;
+using tmi_ordered_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::ordered_unique<entry_key>>>;
+using tmi_ordered_non_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::ordered_non_unique<entry_key>>>;
+using tmi_ranked_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::ranked_unique<entry_key>>>;
+using tmi_ranked_non_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::ranked_non_unique<entry_key>>>;
+using tmi_ordered_btree_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::ordered_btree_unique<entry_key>>>;
+using tmi_ordered_btree_non_unique = tmi::multi_index_container<entry, tmi::indexed_by<tmi::ordered_btree_non_unique<entry_key>>>;
+using tmi_hashed_unique_pooled = tmi::multi_index_container<entry, tmi::indexed_by<tmi::hashed_unique<entry_key>>, tmi::node_pool_allocator<entry>>;
+using tmi_ordered_unique_pooled = tmi::multi_index_container<entry, tmi::indexed_by<tmi::ordered_unique<entry_key>>, tmi::node_pool_allocator<entry>>;
+using tmi_hashed_unique_nohash = tmi::multi_index_container<entry, tmi::indexed_by<tmi::hashed_unique<entry_key, void, void, tmi::no_hash_cache>>>;
+using tmi_hashed_unique_unlisted = tmi::multi_index_container<entry, tmi::indexed_by_unlisted<tmi::hashed_unique<entry_key>>>;
+using tmi_ordered_unique_unlisted = tmi::multi_index_container<entry, tmi::indexed_by_unlisted<tmi::ordered_unique<entry_key>>>;
+using tmi_hashed_unique_compact = tmi::multi_index_container<entry, tmi::indexed_by_compact<tmi::hashed_unique<entry_key, void, void, tmi::hash32_cache>>>;
+using tmi_ordered_unique_compact = tmi::multi_index_container<entry, tmi::indexed_by_compact<tmi::ordered_unique<entry_key>>>;
+
+using std_set = std::set<entry, entry_less>;
+using std_multiset = std::multiset<entry, entry_less>;
+using std_unordered_map = std::unordered_map<uint64_t, uint64_t>;
+using std_unordered_multimap = std::unordered_multimap<uint64_t, uint64_t>;
+
+#ifdef TMI_BENCH_HAVE_BOOST
+namespace bmi = boost::multi_index;
+using boost_key = bmi::member<entry, uint64_t, &entry::key>;
+using boost_hashed_unique = bmi::multi_index_container<entry, bmi::indexed_by<bmi::hashed_unique<boost_key>>>;
+using boost_hashed_non_unique = bmi::multi_index_container<entry, bmi::indexed_by<bmi::hashed_non_unique<boost_key>>>;
+using boost_ordered_unique = bmi::multi_index_container<entry, bmi::indexed_by<bmi::ordered_unique<boost_key>>>;
+using boost_ordered_non_unique = bmi::multi_index_container<entry, bmi::indexed_by<bmi::ordered_non_unique<boost_key>>>;
+#endif
+
+/* Uniform interface over the benchmarked containers. The primary template
+   covers tmi and boost::multi_index, which share an api. */
+template <typename Container>
+struct adapter
+{
+    static void emplace(Container& c, uint64_t key, uint64_t payload) { c.emplace(key, payload); }
+    static bool find(const Container& c, uint64_t key) { return c.find(key) != c.end(); }
+    static void insert_range(Container& c, const std::vector<entry>& entries) { c.insert(entries.begin(), entries.end()); }
+    static size_t count(const Container& c, uint64_t key) { return c.count(key); }
+    static void modify(Container& c, uint64_t key, uint64_t new_key)
+    {
+        c.modify(c.find(key), [new_key](entry& e) { e.key = new_key; });
+    }
+    static void erase(Container& c, uint64_t key) { c.erase(c.find(key)); }
+    static void extract_insert(Container& c, uint64_t key)
+    {
+        auto nh = c.extract(c.find(key));
+        c.insert(std::move(nh));
+    }
+    static uint64_t iterate(const Container& c)
+    {
+        uint64_t sum = 0;
+        for (const auto& e : c) sum += e.key;
+        return sum;
+    }
+};
+
+template <typename Container>
+struct set_adapter
+{
+    static void emplace(Container& c, uint64_t key, uint64_t payload) { c.emplace(key, payload); }
+    static bool find(const Container& c, uint64_t key) { return c.find(key) != c.end(); }
+    static void insert_range(Container& c, const std::vector<entry>& entries) { c.insert(entries.begin(), entries.end()); }
+    static size_t count(const Container& c, uint64_t key) { return c.count(key); }
+    static void modify(Container& c, uint64_t key, uint64_t new_key)
+    {
+        auto nh = c.extract(c.find(key));
+        nh.value().key = new_key;
+        c.insert(std::move(nh));
+    }
+    static void erase(Container& c, uint64_t key) { c.erase(c.find(key)); }
+    static void extract_insert(Container& c, uint64_t key)
+    {
+        auto nh = c.extract(c.find(key));
+        c.insert(std::move(nh));
+    }
+    static uint64_t iterate(const Container& c)
+    {
+        uint64_t sum = 0;
+        for (const auto& e : c) sum += e.key;
+        return sum;
+    }
+};
+
+template <typename Container>
+struct map_adapter
+{
+    static void emplace(Container& c, uint64_t key, uint64_t payload) { c.emplace(key, payload); }
+    static bool find(const Container& c, uint64_t key) { return c.find(key) != c.end(); }
+    static void insert_range(Container& c, const std::vector<entry>& entries)
+    {
+        for (const entry& e : entries) c.emplace(e.key, e.payload);
+    }
+    static size_t count(const Container& c, uint64_t key) { return c.count(key); }
+    static void modify(Container& c, uint64_t key, uint64_t new_key)
+    {
+        auto nh = c.extract(c.find(key));
+        nh.key() = new_key;
+        c.insert(std::move(nh));
+    }
+    static void erase(Container& c, uint64_t key) { c.erase(c.find(key)); }
+    static void extract_insert(Container& c, uint64_t key)
+    {
+        auto nh = c.extract(c.find(key));
+        c.insert(std::move(nh));
+    }
+    static uint64_t iterate(const Container& c)
+    {
+        uint64_t sum = 0;
+        for (const auto& e : c) sum += e.first;
+        return sum;
+    }
+};
+
+template <>
+struct adapter<std_set> : set_adapter<std_set> {};
+template <>
+struct adapter<std_multiset> : set_adapter<std_multiset> {};
+template <>
+struct adapter<std_unordered_map> : map_adapter<std_unordered_map> {};
+template <>
+struct adapter<std_unordered_multimap> : map_adapter<std_unordered_multimap> {};
+
+uint64_t mix64(uint64_t x)
+{
+    // splitmix64 finalizer, a bijection on 64-bit values.
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* Keys for one run. keys[i] and alt_keys[i] are distinct across the whole
+   set; modify benchmarks swap an element between the two. Non-unique
+   workloads repeat each key group_size times. */
+struct workload
+{
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> alt_keys;
+    std::vector<uint64_t> lookup_order;
+
+    workload(size_t n, size_t group_size)
+    {
+        keys.reserve(n);
+        alt_keys.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            keys.push_back(mix64(2 * (i / group_size)));
+            alt_keys.push_back(mix64(2 * (i / group_size) + 1));
+        }
+        std::mt19937_64 rng{n};
+        std::vector<size_t> perm(n);
+        for (size_t i = 0; i < n; i++) perm[i] = i;
+        std::shuffle(perm.begin(), perm.end(), rng);
+        std::vector<uint64_t> shuffled_keys(n), shuffled_alt(n);
+        for (size_t i = 0; i < n; i++) {
+            shuffled_keys[i] = keys[perm[i]];
+            shuffled_alt[i] = alt_keys[perm[i]];
+        }
+        keys = std::move(shuffled_keys);
+        alt_keys = std::move(shuffled_alt);
+        std::shuffle(perm.begin(), perm.end(), rng);
+        lookup_order = std::move(perm);
+    }
+};
+
+template <typename Container>
+void fill(Container& c, const std::vector<uint64_t>& keys)
+{
+    for (size_t i = 0; i < keys.size(); i++) {
+        adapter<Container>::emplace(c, keys[i], i);
+    }
+}
+
+template <typename Container>
+void run_container(const bench::state& state, std::string_view container, size_t n, const workload& work)
+{
+    using ops = adapter<Container>;
+    std::optional<Container> c;
+    const auto& keys = work.keys;
+    const auto& alt_keys = work.alt_keys;
+    const auto& order = work.lookup_order;
+
+    const uint64_t live_before = bench::get_alloc_counters().live_bytes;
+    c.emplace();
+    fill(*c, keys);
+    const double bytes_per_elem = static_cast<double>(bench::get_alloc_counters().live_bytes - live_before) / static_cast<double>(n);
+
+    state.run("emplace", container, n, n, bytes_per_elem,
+        [&] { c.reset(); c.emplace(); },
+        [&] { fill(*c, keys); });
+
+    std::vector<entry> entries;
+    entries.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        entries.emplace_back(keys[i], i);
+    }
+    state.run("insert_range", container, n, n, bytes_per_elem,
+        [&] { c.reset(); c.emplace(); },
+        [&] { ops::insert_range(*c, entries); });
+
+    state.run("find", container, n, n, bytes_per_elem, [] {},
+        [&] {
+            uint64_t found = 0;
+            for (size_t i : order) found += ops::find(*c, keys[i]);
+            bench::consume(found);
+        });
+
+    state.run("find_miss", container, n, n, bytes_per_elem, [] {},
+        [&] {
+            uint64_t found = 0;
+            for (size_t i : order) found += ops::find(*c, alt_keys[i]);
+            bench::consume(found);
+        });
+
+    // Look up the same keys as find, a block-sized batch at a time.
+    if constexpr (requires(const Container& cc, std::span<const uint64_t> k, std::span<bool> out) { cc.contains_batch(k, out); }) {
+        constexpr size_t batch_size = 2048;
+        std::vector<uint64_t> ordered_keys;
+        ordered_keys.reserve(n);
+        for (size_t i : order) ordered_keys.push_back(keys[i]);
+        std::unique_ptr<bool[]> present{new bool[batch_size]};
+        state.run("find_batch", container, n, n, bytes_per_elem, [] {},
+            [&] {
+                uint64_t found = 0;
+                for (size_t pos = 0; pos < n; pos += batch_size) {
+                    const size_t count = std::min(batch_size, n - pos);
+                    c->contains_batch(std::span<const uint64_t>(ordered_keys).subspan(pos, count), std::span<bool>(present.get(), count));
+                    for (size_t i = 0; i < count; i++) found += present[i];
+                }
+                bench::consume(found);
+            });
+    }
+
+    state.run("count", container, n, n, bytes_per_elem, [] {},
+        [&] {
+            uint64_t found = 0;
+            for (size_t i : order) found += ops::count(*c, keys[i]);
+            bench::consume(found);
+        });
+
+    // Rejecting keys which are already present: emplace builds a node first,
+    // while try_emplace and insert check before allocating.
+    if constexpr (requires(Container& cc, entry e) { cc.try_emplace(e.key, e.key, e.payload); cc.insert(e); }) {
+        state.run("emplace_dup", container, n, n, bytes_per_elem, [] {},
+            [&] {
+                for (size_t i : order) ops::emplace(*c, keys[i], i);
+            });
+        state.run("try_emplace_dup", container, n, n, bytes_per_elem, [] {},
+            [&] {
+                for (size_t i : order) c->try_emplace(keys[i], keys[i], i);
+            });
+        state.run("insert_dup", container, n, n, bytes_per_elem, [] {},
+            [&] {
+                for (size_t i : order) c->insert(entry(keys[i], i));
+            });
+    }
+
+    // Each pass swaps every element between its key and alternate key, so
+    // the container alternates between the two key sets.
+    bool swapped = false;
+    state.run("modify", container, n, n, bytes_per_elem, [] {},
+        [&] {
+            const auto& from = swapped ? alt_keys : keys;
+            const auto& to = swapped ? keys : alt_keys;
+            for (size_t i : order) ops::modify(*c, from[i], to[i]);
+            swapped = !swapped;
+        });
+
+    // The same swaps, looked up and then relinked a block-sized batch at a
+    // time.
+    if constexpr (requires(Container& cc) { cc.modify_batch(); }) {
+        constexpr size_t batch_size = 2048;
+        std::vector<typename Container::iterator> found;
+        found.reserve(batch_size);
+        state.run("modify_batch", container, n, n, bytes_per_elem, [] {},
+            [&] {
+                const auto& from = swapped ? alt_keys : keys;
+                const auto& to = swapped ? keys : alt_keys;
+                for (size_t pos = 0; pos < n; pos += batch_size) {
+                    const size_t count = std::min(batch_size, n - pos);
+                    found.clear();
+                    for (size_t i = pos; i < pos + count; i++) found.push_back(c->find(from[order[i]]));
+                    auto batch = c->modify_batch();
+                    for (size_t i = 0; i < count; i++) {
+                        const uint64_t new_key = to[order[pos + i]];
+                        batch.modify(found[i], [new_key](entry& e) { e.key = new_key; });
+                    }
+                    batch.commit();
+                }
+                swapped = !swapped;
+            });
+    }
+    if (swapped) {
+        c.reset();
+        c.emplace();
+        fill(*c, keys);
+    }
+
+    state.run("extract_insert", container, n, n, bytes_per_elem, [] {},
+        [&] {
+            for (size_t i : order) ops::extract_insert(*c, keys[i]);
+        });
+
+    state.run("iterate", container, n, n, bytes_per_elem, [] {},
+        [&] {
+            bench::consume(ops::iterate(*c));
+        });
+
+    state.run("erase", container, n, n, bytes_per_elem,
+        [&] {
+            if (c->size() != n) {
+                c.reset();
+                c.emplace();
+                fill(*c, keys);
+            }
+        },
+        [&] {
+            for (size_t i : order) ops::erase(*c, keys[i]);
+        });
+}
+
+constexpr size_t non_unique_group_size = 4;
+
+void containers(const bench::state& state)
+{
+    for (size_t n : state.sizes()) {
+        const workload unique{n, 1};
+        run_container<tmi_hashed_unique>(state, "tmi::hashed_unique", n, unique);
+        run_container<tmi_hashed_linked_unique>(state, "tmi::hashed_linked_unique", n, unique);
+        run_container<tmi_hashed_flat_unique>(state, "tmi::hashed_flat_unique", n, unique);
+        run_container<tmi_hashed_unique_pooled>(state, "tmi::hashed_unique+pool", n, unique);
+        run_container<tmi_hashed_unique_unlisted>(state, "tmi::hashed_unique+unlisted", n, unique);
+        run_container<tmi_hashed_unique_compact>(state, "tmi::hashed_unique+compact", n, unique);
+        run_container<tmi_hashed_unique_nohash>(state, "tmi::hashed_unique+nohash", n, unique);
+        run_container<std_unordered_map>(state, "std::unordered_map", n, unique);
+#ifdef TMI_BENCH_HAVE_BOOST
+        run_container<boost_hashed_unique>(state, "boost::hashed_unique", n, unique);
+#endif
+        run_container<tmi_ordered_unique>(state, "tmi::ordered_unique", n, unique);
+        run_container<tmi_ranked_unique>(state, "tmi::ranked_unique", n, unique);
+        run_container<tmi_ordered_btree_unique>(state, "tmi::ordered_btree_unique", n, unique);
+        run_container<tmi_ordered_unique_pooled>(state, "tmi::ordered_unique+pool", n, unique);
+        run_container<tmi_ordered_unique_unlisted>(state, "tmi::ordered_unique+unlisted", n, unique);
+        run_container<tmi_ordered_unique_compact>(state, "tmi::ordered_unique+compact", n, unique);
+        run_container<std_set>(state, "std::set", n, unique);
+#ifdef TMI_BENCH_HAVE_BOOST
+        run_container<boost_ordered_unique>(state, "boost::ordered_unique", n, unique);
+#endif
+
+        const workload non_unique{n, non_unique_group_size};
+        run_container<tmi_hashed_non_unique>(state, "tmi::hashed_non_unique", n, non_unique);
+        run_container<tmi_hashed_linked_non_unique>(state, "tmi::hashed_linked_non_unique", n, non_unique);
+        run_container<tmi_hashed_flat_non_unique>(state, "tmi::hashed_flat_non_unique", n, non_unique);
+        run_container<std_unordered_multimap>(state, "std::unordered_multimap", n, non_unique);
+#ifdef TMI_BENCH_HAVE_BOOST
+        run_container<boost_hashed_non_unique>(state, "boost::hashed_non_unique", n, non_unique);
+#endif
+        run_container<tmi_ordered_non_unique>(state, "tmi::ordered_non_unique", n, non_unique);
+        run_container<tmi_ranked_non_unique>(state, "tmi::ranked_non_unique", n, non_unique);
+        run_container<tmi_ordered_btree_non_unique>(state, "tmi::ordered_btree_non_unique", n, non_unique);
+        run_container<std_multiset>(state, "std::multiset", n, non_unique);
+#ifdef TMI_BENCH_HAVE_BOOST
+        run_container<boost_ordered_non_unique>(state, "boost::ordered_non_unique", n, non_unique);
+#endif
+    }
+}
+
+const bench::registration reg{"containers", containers};
+
+} // namespace
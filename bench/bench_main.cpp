@@ -0,0 +1,198 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+
+namespace {
+
+bench::alloc_counters g_counters;
+volatile uint64_t g_sink;
+
+/* Every allocation is prefixed with its size so that live bytes can be
+   tracked through unsized deletes as well. The header keeps the returned
+   pointer aligned for any fundamental type. */
+constexpr size_t header_size = alignof(std::max_align_t);
+
+void* counted_alloc(size_t size)
+{
+    auto* ptr = static_cast<unsigned char*>(std::malloc(size + header_size));
+    if (!ptr) throw std::bad_alloc();
+    std::memcpy(ptr, &size, sizeof(size));
+    g_counters.allocs++;
+    g_counters.bytes += size;
+    g_counters.live_bytes += size;
+    return ptr + header_size;
+}
+
+void counted_free(void* ptr) noexcept
+{
+    if (!ptr) return;
+    auto* base = static_cast<unsigned char*>(ptr) - header_size;
+    size_t size;
+    std::memcpy(&size, base, sizeof(size));
+    g_counters.live_bytes -= size;
+    std::free(base);
+}
+
+/* Over-aligned allocations put the size just before the returned pointer,
+   which is preceded by a whole alignment's worth of header. */
+void* counted_aligned_alloc(size_t size, std::align_val_t align)
+{
+    const size_t offset = std::max(static_cast<size_t>(align), header_size);
+    const size_t total = (offset + size + static_cast<size_t>(align) - 1) / static_cast<size_t>(align) * static_cast<size_t>(align);
+    auto* ptr = static_cast<unsigned char*>(std::aligned_alloc(static_cast<size_t>(align), total));
+    if (!ptr) throw std::bad_alloc();
+    std::memcpy(ptr + offset - header_size, &size, sizeof(size));
+    g_counters.allocs++;
+    g_counters.bytes += size;
+    g_counters.live_bytes += size;
+    return ptr + offset;
+}
+
+void counted_aligned_free(void* ptr, std::align_val_t align) noexcept
+{
+    if (!ptr) return;
+    const size_t offset = std::max(static_cast<size_t>(align), header_size);
+    auto* base = static_cast<unsigned char*>(ptr) - offset;
+    size_t size;
+    std::memcpy(&size, base + offset - header_size, sizeof(size));
+    g_counters.live_bytes -= size;
+    std::free(base);
+}
+
+bool parse_sizes(std::string_view arg, std::vector<size_t>& sizes)
+{
+    sizes.clear();
+    while (!arg.empty()) {
+        size_t value{};
+        auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+        if (ec != std::errc{} || value == 0) return false;
+        sizes.push_back(value);
+        arg.remove_prefix(static_cast<size_t>(ptr - arg.data()));
+        if (!arg.empty()) {
+            if (arg.front() != ',') return false;
+            arg.remove_prefix(1);
+        }
+    }
+    return !sizes.empty();
+}
+
+void print_usage(const char* argv0)
+{
+    std::printf("Usage: %s [options]\n"
+                "  -filter=<str>     Only run benchmarks whose \"name/container\" contains <str>\n"
+                "  -sizes=<n,n,...>  Element counts to run (default: 1000,10000,100000,1000000,10000000)\n"
+                "  -min-time=<ms>    Minimum time spent per measurement (default: 100)\n"
+                "  -list             List registered benchmark groups and exit\n", argv0);
+}
+
+} // namespace
+
+void* operator new(size_t size) { return counted_alloc(size); }
+void* operator new[](size_t size) { return counted_alloc(size); }
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { counted_free(ptr); }
+void* operator new(size_t size, std::align_val_t align) { return counted_aligned_alloc(size, align); }
+void* operator new[](size_t size, std::align_val_t align) { return counted_aligned_alloc(size, align); }
+void operator delete(void* ptr, std::align_val_t align) noexcept { counted_aligned_free(ptr, align); }
+void operator delete[](void* ptr, std::align_val_t align) noexcept { counted_aligned_free(ptr, align); }
+void operator delete(void* ptr, size_t, std::align_val_t align) noexcept { counted_aligned_free(ptr, align); }
+void operator delete[](void* ptr, size_t, std::align_val_t align) noexcept { counted_aligned_free(ptr, align); }
+
+namespace bench {
+
+alloc_counters get_alloc_counters()
+{
+    return g_counters;
+}
+
+void consume(uint64_t value)
+{
+    g_sink = g_sink + value;
+}
+
+std::vector<registered_bench>& registered_benchmarks()
+{
+    static std::vector<registered_bench> benchmarks;
+    return benchmarks;
+}
+
+registration::registration(std::string_view name, bench_function func)
+{
+    registered_benchmarks().push_back({name, func});
+}
+
+bool state::enabled(std::string_view name, std::string_view container) const
+{
+    if (m_opts.filter.empty()) return true;
+    std::string full{name};
+    full += '/';
+    full += container;
+    return full.find(m_opts.filter) != std::string::npos;
+}
+
+void state::print_row(std::string_view name, std::string_view container, size_t n, double ns_per_op, double allocs_per_op, double bytes_per_elem) const
+{
+    if (!m_printed_header) {
+        std::printf("%-24s %-36s %10s %12s %10s %11s\n", "benchmark", "container", "N", "ns/op", "allocs/op", "bytes/elem");
+        m_printed_header = true;
+    }
+    std::printf("%-24.*s %-36.*s %10zu %12.2f %10.2f %11.1f\n", static_cast<int>(name.size()), name.data(),
+                static_cast<int>(container.size()), container.data(), n, ns_per_op, allocs_per_op, bytes_per_elem);
+    std::fflush(stdout);
+}
+
+} // namespace bench
+
+int main(int argc, char** argv)
+{
+    bench::options opts;
+    bool list = false;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg{argv[i]};
+        if (arg.starts_with("-filter=")) {
+            opts.filter = arg.substr(8);
+        } else if (arg.starts_with("-sizes=")) {
+            if (!parse_sizes(arg.substr(7), opts.sizes)) {
+                std::fprintf(stderr, "Invalid -sizes argument\n");
+                return 1;
+            }
+        } else if (arg.starts_with("-min-time=")) {
+            std::vector<size_t> ms;
+            if (!parse_sizes(arg.substr(10), ms) || ms.size() != 1) {
+                std::fprintf(stderr, "Invalid -min-time argument\n");
+                return 1;
+            }
+            opts.min_time = std::chrono::milliseconds{ms.front()};
+        } else if (arg == "-list") {
+            list = true;
+        } else {
+            print_usage(argv[0]);
+            return arg == "-h" || arg == "-help" ? 0 : 1;
+        }
+    }
+
+    if (list) {
+        for (const auto& bench : bench::registered_benchmarks()) {
+            std::printf("%.*s\n", static_cast<int>(bench.name.size()), bench.name.data());
+        }
+        return 0;
+    }
+
+    bench::state state{opts};
+    for (const auto& bench : bench::registered_benchmarks()) {
+        bench.func(state);
+    }
+    return 0;
+}
@@ -0,0 +1,495 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/* Replays a deterministic, synthetic transaction stream shaped like Bitcoin
+   Core's mempool traffic against a container with the same index layout:
+
+   - add: a new transaction with 0-2 in-mempool parents
+   - update: ancestor/descendant state changes via modify(), issued for
+     every in-mempool ancestor on add and every relative on removal
+   - evict: erase the lowest entry of the descendant score index whenever
+     the pool is above its target size
+   - block: bulk erase of the best entries by ancestor score
+
+   The stream is generated against a model of the mempool up front, so the
+   replay itself only performs container operations. Each operation is
+   timed individually to produce latency percentiles. */
+
+#include "bench.h"
+
+#include "../tmi.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace {
+
+using txid_type = std::array<uint64_t, 4>;
+
+struct mempool_entry
+{
+    txid_type txid;
+    txid_type wtxid;
+    uint64_t fee;
+    uint64_t size;
+    uint64_t time;
+    uint64_t anc_fee;
+    uint64_t anc_size;
+    uint64_t desc_fee;
+    uint64_t desc_size;
+    // Stand-in for the rest of a real entry (tx ref, sigops, lock points...)
+    std::array<uint64_t, 12> payload{};
+
+    mempool_entry(const txid_type& txid_in, const txid_type& wtxid_in, uint64_t fee_in, uint64_t size_in, uint64_t time_in, uint64_t anc_fee_in, uint64_t anc_size_in)
+        : txid(txid_in), wtxid(wtxid_in), fee(fee_in), size(size_in), time(time_in), anc_fee(anc_fee_in), anc_size(anc_size_in), desc_fee(fee_in), desc_size(size_in) {}
+};
+
+struct entry_txid
+{
+    using result_type = txid_type;
+    TMI_CPP23_STATIC const txid_type& operator()(const mempool_entry& e) TMI_CONST_IF_NOT_CPP23_STATIC noexcept { return e.txid; }
+};
+
+struct entry_wtxid
+{
+    using result_type = txid_type;
+    TMI_CPP23_STATIC const txid_type& operator()(const mempool_entry& e) TMI_CONST_IF_NOT_CPP23_STATIC noexcept { return e.wtxid; }
+};
+
+struct salted_txid_hasher
+{
+    static constexpr uint64_t k0 = 0x736f6d6570736575ULL;
+    static constexpr uint64_t k1 = 0x646f72616e646f6dULL;
+    TMI_CPP23_STATIC size_t operator()(const txid_type& txid) TMI_CONST_IF_NOT_CPP23_STATIC noexcept
+    {
+        uint64_t h = (txid[0] ^ k0) * 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (h >> 29) ^ txid[1] ^ k1) * 0xbf58476d1ce4e5b9ULL;
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+};
+
+/* Feerate comparisons cross-multiply to avoid division, and fall back to
+   the txid so that every ordering is total and reproducible by the model. */
+bool feerate_less(uint64_t fee_a, uint64_t size_a, uint64_t fee_b, uint64_t size_b, const txid_type& a, const txid_type& b)
+{
+    const uint64_t f1 = fee_a * size_b;
+    const uint64_t f2 = fee_b * size_a;
+    if (f1 != f2) return f1 < f2;
+    return a < b;
+}
+
+struct compare_descendant_score
+{
+    TMI_CPP23_STATIC bool operator()(const mempool_entry& a, const mempool_entry& b) TMI_CONST_IF_NOT_CPP23_STATIC
+    {
+        return feerate_less(a.desc_fee, a.desc_size, b.desc_fee, b.desc_size, a.txid, b.txid);
+    }
+};
+
+struct compare_ancestor_score
+{
+    TMI_CPP23_STATIC bool operator()(const mempool_entry& a, const mempool_entry& b) TMI_CONST_IF_NOT_CPP23_STATIC
+    {
+        return feerate_less(a.anc_fee, a.anc_size, b.anc_fee, b.anc_size, a.txid, b.txid);
+    }
+};
+
+struct compare_entry_time
+{
+    TMI_CPP23_STATIC bool operator()(const mempool_entry& a, const mempool_entry& b) TMI_CONST_IF_NOT_CPP23_STATIC
+    {
+        if (a.time != b.time) return a.time < b.time;
+        return a.txid < b.txid;
+    }
+};
+
+struct descendant_score {};
+struct entry_time {};
+struct ancestor_score {};
+struct index_by_wtxid {};
+
+template <template <typename...> class IndexedBy>
+using mempool_container_t = tmi::multi_index_container<
+    mempool_entry,
+    IndexedBy<
+        tmi::hashed_unique<entry_txid, salted_txid_hasher>,
+        tmi::hashed_unique<tmi::tag<index_by_wtxid>, entry_wtxid, salted_txid_hasher>,
+        tmi::ordered_non_unique<tmi::tag<descendant_score>, tmi::identity<mempool_entry>, compare_descendant_score>,
+        tmi::ordered_non_unique<tmi::tag<entry_time>, tmi::identity<mempool_entry>, compare_entry_time>,
+        tmi::ordered_non_unique<tmi::tag<ancestor_score>, tmi::identity<mempool_entry>, compare_ancestor_score>>>;
+
+using mempool_container = mempool_container_t<tmi::indexed_by>;
+using mempool_split_container = mempool_container_t<tmi::indexed_by_split>;
+
+enum class op_type : uint8_t {
+    add,
+    update_ancestors,
+    update_descendants,
+    evict,
+    block,
+};
+constexpr size_t num_op_types = 5;
+constexpr const char* op_names[num_op_types] = {"add", "update_ancestor_state", "update_descendant_state", "evict", "block"};
+
+struct stream_op
+{
+    op_type type;
+    uint32_t tx;
+    // update: signed state deltas. block: offset/count into block_txs.
+    int64_t fee;
+    int64_t size;
+};
+
+struct tx_info
+{
+    txid_type txid;
+    txid_type wtxid;
+    uint64_t fee;
+    uint64_t size;
+    uint64_t time;
+    uint64_t anc_fee;
+    uint64_t anc_size;
+};
+
+struct tx_stream
+{
+    std::vector<tx_info> txs;
+    std::vector<uint32_t> block_txs;
+    std::vector<stream_op> fill_ops;
+    std::vector<stream_op> ops;
+};
+
+class stream_generator
+{
+    static constexpr size_t max_relatives = 25;
+
+    struct model_tx
+    {
+        uint64_t anc_fee;
+        uint64_t anc_size;
+        uint64_t desc_fee;
+        uint64_t desc_size;
+        std::vector<uint32_t> parents;
+        std::vector<uint32_t> children;
+        size_t live_pos;
+        bool live;
+    };
+
+    struct by_descendant_score
+    {
+        const stream_generator* gen;
+        bool operator()(uint32_t a, uint32_t b) const
+        {
+            const auto& ma = gen->m_model[a];
+            const auto& mb = gen->m_model[b];
+            return feerate_less(ma.desc_fee, ma.desc_size, mb.desc_fee, mb.desc_size, gen->m_stream.txs[a].txid, gen->m_stream.txs[b].txid);
+        }
+    };
+
+    struct by_ancestor_score
+    {
+        const stream_generator* gen;
+        bool operator()(uint32_t a, uint32_t b) const
+        {
+            const auto& ma = gen->m_model[a];
+            const auto& mb = gen->m_model[b];
+            return feerate_less(ma.anc_fee, ma.anc_size, mb.anc_fee, mb.anc_size, gen->m_stream.txs[a].txid, gen->m_stream.txs[b].txid);
+        }
+    };
+
+    tx_stream m_stream;
+    std::vector<model_tx> m_model;
+    std::vector<uint32_t> m_live;
+    std::set<uint32_t, by_descendant_score> m_by_desc{by_descendant_score{this}};
+    std::set<uint32_t, by_ancestor_score> m_by_anc{by_ancestor_score{this}};
+    std::mt19937_64 m_rng;
+    uint64_t m_time{0};
+
+    std::vector<uint32_t> relatives(uint32_t tx, bool ancestors) const
+    {
+        std::vector<uint32_t> ret;
+        std::vector<uint32_t> todo{tx};
+        while (!todo.empty() && ret.size() < max_relatives) {
+            const uint32_t cur = todo.back();
+            todo.pop_back();
+            for (uint32_t rel : ancestors ? m_model[cur].parents : m_model[cur].children) {
+                if (std::find(ret.begin(), ret.end(), rel) == ret.end()) {
+                    ret.push_back(rel);
+                    todo.push_back(rel);
+                }
+            }
+        }
+        if (ret.size() > max_relatives) ret.resize(max_relatives);
+        return ret;
+    }
+
+    void update(std::vector<stream_op>& out, uint32_t tx, bool ancestor_state, int64_t fee, int64_t size)
+    {
+        auto& m = m_model[tx];
+        m_by_desc.erase(tx);
+        m_by_anc.erase(tx);
+        if (ancestor_state) {
+            m.anc_fee = static_cast<uint64_t>(static_cast<int64_t>(m.anc_fee) + fee);
+            m.anc_size = static_cast<uint64_t>(static_cast<int64_t>(m.anc_size) + size);
+        } else {
+            m.desc_fee = static_cast<uint64_t>(static_cast<int64_t>(m.desc_fee) + fee);
+            m.desc_size = static_cast<uint64_t>(static_cast<int64_t>(m.desc_size) + size);
+        }
+        m_by_desc.insert(tx);
+        m_by_anc.insert(tx);
+        out.push_back({ancestor_state ? op_type::update_ancestors : op_type::update_descendants, tx, fee, size});
+    }
+
+    txid_type random_txid()
+    {
+        return {m_rng(), m_rng(), m_rng(), m_rng()};
+    }
+
+    void add(std::vector<stream_op>& out)
+    {
+        const auto tx = static_cast<uint32_t>(m_stream.txs.size());
+        const uint64_t size = 150 + m_rng() % 2000;
+        const uint64_t fee = size * (1 + m_rng() % 200);
+
+        model_tx m{};
+        const uint64_t roll = m_rng() % 10;
+        const size_t num_parents = m_live.empty() ? 0 : roll < 6 ? 0 : roll < 9 ? 1 : 2;
+        for (size_t i = 0; i < num_parents; i++) {
+            const uint32_t parent = m_live[m_rng() % m_live.size()];
+            if (std::find(m.parents.begin(), m.parents.end(), parent) == m.parents.end()) {
+                m.parents.push_back(parent);
+            }
+        }
+        m_model.push_back(std::move(m));
+        const auto ancestors = relatives(tx, true);
+
+        uint64_t anc_fee = fee, anc_size = size;
+        for (uint32_t anc : ancestors) {
+            anc_fee += m_stream.txs[anc].fee;
+            anc_size += m_stream.txs[anc].size;
+        }
+        m_stream.txs.push_back({random_txid(), random_txid(), fee, size, m_time++, anc_fee, anc_size});
+
+        auto& model = m_model[tx];
+        model.anc_fee = anc_fee;
+        model.anc_size = anc_size;
+        model.desc_fee = fee;
+        model.desc_size = size;
+        model.live = true;
+        model.live_pos = m_live.size();
+        m_live.push_back(tx);
+        for (uint32_t parent : model.parents) {
+            m_model[parent].children.push_back(tx);
+        }
+        m_by_desc.insert(tx);
+        m_by_anc.insert(tx);
+        out.push_back({op_type::add, tx, 0, 0});
+
+        for (uint32_t anc : ancestors) {
+            update(out, anc, false, static_cast<int64_t>(fee), static_cast<int64_t>(size));
+        }
+    }
+
+    /* Drop tx from the model. State updates for its surviving relatives are
+       appended to out. */
+    void remove(std::vector<stream_op>& out, uint32_t tx)
+    {
+        auto& m = m_model[tx];
+        const auto fee = static_cast<int64_t>(m_stream.txs[tx].fee);
+        const auto size = static_cast<int64_t>(m_stream.txs[tx].size);
+        const auto ancestors = relatives(tx, true);
+        const auto descendants = relatives(tx, false);
+
+        m_by_desc.erase(tx);
+        m_by_anc.erase(tx);
+        m.live = false;
+        m_live[m.live_pos] = m_live.back();
+        m_model[m_live.back()].live_pos = m.live_pos;
+        m_live.pop_back();
+        for (uint32_t parent : m.parents) {
+            auto& siblings = m_model[parent].children;
+            siblings.erase(std::find(siblings.begin(), siblings.end(), tx));
+        }
+        for (uint32_t child : m.children) {
+            auto& parents = m_model[child].parents;
+            parents.erase(std::find(parents.begin(), parents.end(), tx));
+        }
+        m.parents.clear();
+        m.children.clear();
+
+        for (uint32_t anc : ancestors) {
+            if (m_model[anc].live) update(out, anc, false, -fee, -size);
+        }
+        for (uint32_t desc : descendants) {
+            if (m_model[desc].live) update(out, desc, true, -fee, -size);
+        }
+    }
+
+    void evict(std::vector<stream_op>& out)
+    {
+        const uint32_t victim = *m_by_desc.begin();
+        out.push_back({op_type::evict, victim, 0, 0});
+        remove(out, victim);
+    }
+
+    void block(std::vector<stream_op>& out, size_t count)
+    {
+        const auto offset = static_cast<int64_t>(m_stream.block_txs.size());
+        std::vector<uint32_t> mined;
+        for (auto it = m_by_anc.rbegin(); it != m_by_anc.rend() && mined.size() < count; ++it) {
+            mined.push_back(*it);
+        }
+        m_stream.block_txs.insert(m_stream.block_txs.end(), mined.begin(), mined.end());
+        out.push_back({op_type::block, 0, offset, static_cast<int64_t>(mined.size())});
+
+        // The whole block is erased before any relatives are updated.
+        for (uint32_t tx : mined) {
+            m_model[tx].live = false;
+        }
+        for (uint32_t tx : mined) {
+            m_model[tx].live = true;
+            remove(out, tx);
+        }
+    }
+
+public:
+    explicit stream_generator(uint64_t seed) : m_rng(seed) {}
+
+    tx_stream generate(size_t target_size, size_t steps)
+    {
+        m_stream.txs.reserve(target_size + steps);
+        m_model.reserve(target_size + steps);
+        for (size_t i = 0; i < target_size; i++) {
+            add(m_stream.fill_ops);
+        }
+
+        const size_t block_size = std::clamp<size_t>(target_size / 10, 1, 3000);
+        const size_t block_interval = 2 * block_size;
+        for (size_t i = 0; i < steps; i++) {
+            add(m_stream.ops);
+            while (m_live.size() > target_size) {
+                evict(m_stream.ops);
+            }
+            if ((i + 1) % block_interval == 0) {
+                block(m_stream.ops, block_size);
+            }
+        }
+        return std::move(m_stream);
+    }
+};
+
+template <typename Container>
+void apply_update(Container& pool, const tx_info& tx, const stream_op& op)
+{
+    auto it = pool.find(tx.txid);
+    assert(it != pool.end());
+    // Each update only moves the entry in the score index it affects.
+    if (op.type == op_type::update_ancestors) {
+        pool.template modify<ancestor_score>(it, [&op](mempool_entry& e) {
+            e.anc_fee = static_cast<uint64_t>(static_cast<int64_t>(e.anc_fee) + op.fee);
+            e.anc_size = static_cast<uint64_t>(static_cast<int64_t>(e.anc_size) + op.size);
+        });
+    } else {
+        pool.template modify<descendant_score>(it, [&op](mempool_entry& e) {
+            e.desc_fee = static_cast<uint64_t>(static_cast<int64_t>(e.desc_fee) + op.fee);
+            e.desc_size = static_cast<uint64_t>(static_cast<int64_t>(e.desc_size) + op.size);
+        });
+    }
+}
+
+template <typename Container>
+void apply(Container& pool, const tx_stream& stream, const stream_op& op)
+{
+    switch (op.type) {
+    case op_type::add: {
+        const tx_info& tx = stream.txs[op.tx];
+        pool.emplace(tx.txid, tx.wtxid, tx.fee, tx.size, tx.time, tx.anc_fee, tx.anc_size);
+        break;
+    }
+    case op_type::update_ancestors:
+    case op_type::update_descendants:
+        apply_update(pool, stream.txs[op.tx], op);
+        break;
+    case op_type::evict: {
+        auto& index = pool.template get<descendant_score>();
+        auto it = index.begin();
+        assert(it->txid == stream.txs[op.tx].txid);
+        index.erase(it);
+        break;
+    }
+    case op_type::block: {
+        const auto begin = stream.block_txs.begin() + op.fee;
+        for (auto it = begin; it != begin + op.size; ++it) {
+            pool.erase(pool.find(stream.txs[*it].txid));
+        }
+        break;
+    }
+    }
+}
+
+uint64_t percentile(const std::vector<uint32_t>& sorted, double pct)
+{
+    if (sorted.empty()) return 0;
+    const auto idx = static_cast<size_t>(pct * static_cast<double>(sorted.size() - 1));
+    return sorted[idx];
+}
+
+template <typename Container>
+void run_mempool(const bench::state& state, const char* name)
+{
+    if (!state.enabled("mempool", name)) return;
+    for (size_t n : state.sizes()) {
+        const size_t steps = std::max<size_t>(n, 100000);
+        const tx_stream stream = stream_generator{n}.generate(n, steps);
+
+        Container pool;
+        for (const auto& op : stream.fill_ops) {
+            apply(pool, stream, op);
+        }
+
+        std::array<std::vector<uint32_t>, num_op_types> latencies;
+        std::array<uint64_t, num_op_types> totals{};
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto& op : stream.ops) {
+            const auto op_start = std::chrono::steady_clock::now();
+            apply(pool, stream, op);
+            const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - op_start).count();
+            const auto type = static_cast<size_t>(op.type);
+            latencies[type].push_back(static_cast<uint32_t>(std::min<int64_t>(elapsed, UINT32_MAX)));
+            totals[type] += static_cast<uint64_t>(elapsed);
+        }
+        const auto total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        bench::consume(pool.size());
+
+        std::printf("mempool %s N=%zu: %zu ops in %.3fs, %.0f ops/s, final size %zu\n", name, n, stream.ops.size(), total,
+                    static_cast<double>(stream.ops.size()) / total, pool.size());
+        std::printf("  %-24s %10s %10s %10s %10s %10s %10s\n", "op", "count", "mean ns", "p50 ns", "p99 ns", "p999 ns", "max ns");
+        for (size_t type = 0; type < num_op_types; type++) {
+            auto& lat = latencies[type];
+            if (lat.empty()) continue;
+            std::sort(lat.begin(), lat.end());
+            std::printf("  %-24s %10zu %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu32 "\n", op_names[type], lat.size(),
+                        totals[type] / lat.size(), percentile(lat, 0.5), percentile(lat, 0.99), percentile(lat, 0.999), lat.back());
+        }
+        std::fflush(stdout);
+    }
+}
+
+void mempool(const bench::state& state)
+{
+    run_mempool<mempool_container>(state, "tmi::multi_index_container");
+    run_mempool<mempool_split_container>(state, "tmi::multi_index_container+split");
+}
+
+const bench::registration reg{"mempool", mempool};
+
+} // namespace
@@ -0,0 +1,180 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "rb_tree.h"
+
+#include "../tmi.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+/* Compares the raw tree algorithms used by ordered indices on identical
+   intrusive nodes, without any of the container machinery on top. Key
+   comparisons and descents are shared, so differences come from the
+   rebalancing work and from the shape of the resulting tree. */
+
+namespace {
+
+struct tree_entry
+{
+    uint64_t key;
+    explicit tree_entry(uint64_t key_in) : key(key_in) {}
+};
+
+struct tree_entry_key
+{
+    using result_type = uint64_t;
+    TMI_CPP23_STATIC const uint64_t& operator()(const tree_entry& e) TMI_CONST_IF_NOT_CPP23_STATIC noexcept
+    {
+        return e.key;
+    }
+};
+
+using tree_indices = tmi::indexed_by<tmi::ordered_unique<tree_entry_key>>;
+using tree_node = tmi::tminode<tree_entry, tree_indices>;
+using tree_base = tree_node::base_type;
+
+uint64_t key_of(const tree_base* base)
+{
+    return base->node()->value().key;
+}
+
+class wavl_engine
+{
+    using tree = tmi::detail::wavl_tree<tree_base, 0>;
+    tree_base* m_root{nullptr};
+
+public:
+    tree_base* root() const { return m_root; }
+    void reset() { m_root = nullptr; }
+    void link(tree_base* parent, bool left, tree_base* x) { tree::insert(m_root, parent, left, x); }
+    void unlink(tree_base* x) { tree::remove(m_root, x); }
+};
+
+class rb_engine
+{
+    using tree = bench::rb_tree<tree_base, 0>;
+    tree_base m_header;
+
+public:
+    tree_base* root() const { return m_header.left<0>(); }
+    void reset() { m_header.set_left<0>(nullptr); }
+    void link(tree_base* parent, bool left, tree_base* x)
+    {
+        if (parent == nullptr) {
+            tree::insert(&m_header, &m_header, true, x);
+        } else {
+            tree::insert(&m_header, parent, left, x);
+        }
+    }
+    void unlink(tree_base* x) { tree::remove(&m_header, x); }
+};
+
+template <typename Engine>
+void insert(Engine& engine, tree_base* x)
+{
+    const uint64_t key = key_of(x);
+    tree_base* parent = nullptr;
+    tree_base* curr = engine.root();
+    bool left = false;
+    while (curr != nullptr) {
+        parent = curr;
+        left = key < key_of(curr);
+        curr = left ? curr->template left<0>() : curr->template right<0>();
+    }
+    engine.link(parent, left, x);
+}
+
+template <typename Engine>
+bool find(const Engine& engine, uint64_t key)
+{
+    const tree_base* curr = engine.root();
+    while (curr != nullptr) {
+        const uint64_t curr_key = key_of(curr);
+        if (key < curr_key) {
+            curr = curr->template left<0>();
+        } else if (curr_key < key) {
+            curr = curr->template right<0>();
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Engine>
+void run_engine(const bench::state& state, std::string_view name, size_t n)
+{
+    if (!state.enabled("tree_insert", name) && !state.enabled("tree_find", name) &&
+        !state.enabled("tree_reinsert", name) && !state.enabled("tree_erase", name)) return;
+
+    std::vector<tree_node> nodes;
+    nodes.reserve(n);
+    std::mt19937_64 rng{n};
+    for (size_t i = 0; i < n; i++) {
+        nodes.emplace_back(std::in_place, rng());
+    }
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+
+    Engine engine;
+    size_t size = 0;
+    auto fill = [&] {
+        engine.reset();
+        for (tree_node& node : nodes) insert(engine, node.get_base());
+        size = n;
+    };
+    const double bytes_per_elem = sizeof(tree_node);
+
+    state.run("tree_insert", name, n, n, bytes_per_elem,
+        [&] { engine.reset(); size = 0; },
+        [&] {
+            for (tree_node& node : nodes) insert(engine, node.get_base());
+            size = n;
+        });
+
+    if (size != n) fill();
+
+    state.run("tree_find", name, n, n, bytes_per_elem, [] {},
+        [&] {
+            uint64_t found = 0;
+            for (size_t i : order) found += find(engine, nodes[i].value().key);
+            bench::consume(found);
+        });
+
+    state.run("tree_reinsert", name, n, n, bytes_per_elem, [] {},
+        [&] {
+            for (size_t i : order) {
+                tree_base* base = nodes[i].get_base();
+                engine.unlink(base);
+                insert(engine, base);
+            }
+        });
+
+    state.run("tree_erase", name, n, n, bytes_per_elem,
+        [&] {
+            if (size != n) fill();
+        },
+        [&] {
+            for (size_t i : order) engine.unlink(nodes[i].get_base());
+            size = 0;
+        });
+}
+
+void tree(const bench::state& state)
+{
+    for (size_t n : state.sizes()) {
+        run_engine<wavl_engine>(state, "tmi::detail::wavl_tree", n);
+        run_engine<rb_engine>(state, "libc++ red-black tree", n);
+    }
+}
+
+const bench::registration reg{"tree", tree};
+
+} // namespace
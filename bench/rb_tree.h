@@ -0,0 +1,412 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// The algorithms in this file have been copied from LLVM's libc++ and
+// modified to work here. Their license applies to them, see
+// redblack.LICENSE.TXT.
+
+#ifndef TMI_BENCH_RB_TREE_H_
+#define TMI_BENCH_RB_TREE_H_
+
+#include <cassert>
+
+namespace bench {
+
+/*
+    The red-black tree which tmi_comparator used before it was replaced by
+    tmi::detail::wavl_tree. It is kept only so that tmi_bench can compare the
+    two on identical nodes.
+
+    The color is stored in the same bit as the WAVL rank parity (black ==
+    true). The tree hangs off a header node whose left child is the root, and
+    the root's parent is the header.
+
+//===----------------------------------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+*/
+template <typename Base, int I>
+struct rb_tree
+{
+    // Link x into the empty child slot of parent, which is the header if the
+    // tree is empty, and rebalance.
+    static void insert(Base* header, Base* parent, bool left, Base* x)
+    {
+        x->template set_left<I>(nullptr);
+        x->template set_right<I>(nullptr);
+        x->template set_parent<I>(parent);
+        if (left)
+            parent->template set_left<I>(x);
+        else
+            parent->template set_right<I>(x);
+        tree_balance_after_insert(header->template left<I>(), x);
+    }
+
+    static void remove(Base* header, Base* z)
+    {
+        tree_remove(header, z);
+    }
+
+    static Base* tree_max(Base* x) {
+      while (x->template right<I>() != nullptr)
+        x = x->template right<I>();
+      return x;
+    }
+
+    static const Base* tree_max(const Base* x) {
+      while (x->template right<I>() != nullptr)
+        x = x->template right<I>();
+      return x;
+    }
+
+    static bool tree_is_left_child(Base* x)
+    {
+        return x == x->template parent<I>()->template left<I>();
+    }
+
+    static bool tree_is_left_child(const Base* x)
+    {
+        return x == x->template parent<I>()->template left<I>();
+    }
+
+    static Base* tree_min(Base* x)
+    {
+        while (x->template left<I>() != nullptr)
+            x = x->template left<I>();
+        return x;
+    }
+
+    static Base* tree_next(Base* x)
+    {
+        if (x->template right<I>() != nullptr)
+            return tree_min(x->template right<I>());
+        while (!tree_is_left_child(x))
+            x = x->template parent<I>();
+        return x->template parent<I>();
+    }
+
+    static const Base* tree_next(const Base* x)
+    {
+        if (x->template right<I>() != nullptr)
+            return tree_min(x->template right<I>());
+        while (!tree_is_left_child(x))
+            x = x->template parent<I>();
+        return x->template parent<I>();
+    }
+
+    static Base* tree_prev(Base* x) {
+      if (x->template left<I>() != nullptr)
+        return tree_max(x->template left<I>());
+      while (tree_is_left_child(x))
+        x = x->template parent<I>();
+      return x->template parent<I>();
+    }
+
+    static const Base* tree_prev(const Base* x) {
+      if (x->template left<I>() != nullptr)
+        return tree_max(x->template left<I>());
+      while (tree_is_left_child(x))
+        x = x->template parent<I>();
+      return x->template parent<I>();
+    }
+
+    static void tree_left_rotate(Base* x)
+    {
+        Base* y = x->template right<I>();
+        x->template set_right<I>(y->template left<I>());
+        if (x->template right<I>() != nullptr)
+            x->template right<I>()->template set_parent<I>(x);
+        y->template set_parent<I>(x->template parent<I>());
+        if (tree_is_left_child(x))
+            x->template parent<I>()->template set_left<I>(y);
+        else
+            x->template parent<I>()->template set_right<I>(y);
+        y->template set_left<I>(x);
+        x->template set_parent<I>(y);
+    }
+
+    static void tree_right_rotate(Base* x)
+    {
+        Base* y = x->template left<I>();
+        x->template set_left<I>(y->template right<I>());
+        if (x->template left<I>() != nullptr)
+            x->template left<I>()->template set_parent<I>(x);
+        y->template set_parent<I>(x->template parent<I>());
+        if (tree_is_left_child(x))
+            x->template parent<I>()->template set_left<I>(y);
+        else
+            x->template parent<I>()->template set_right<I>(y);
+        y->template set_right<I>(x);
+        x->template set_parent<I>(y);
+    }
+
+
+    // Precondition:  root != nullptr && z != nullptr.
+    //                tree_invariant(root) == true.
+    //                z == root or == a direct or indirect child of root.
+    // Effects:  unlinks z from the tree rooted at root, rebalancing as needed.
+    // Postcondition: tree_invariant(end_node->template left<I>()) == true && end_node->template left<I>()
+    //                nor any of its children refer to z.  end_node->template left<I>()
+    //                may be different than the value passed in as root.
+    static void tree_remove(Base* header, Base* z)
+    {
+        Base* root = header->template left<I>();
+        assert(root);
+        assert(z);
+        // z will be removed from the tree.  Client still needs to destruct/deallocate it
+        // y is either z, or if z has two children, tree_next(z).
+        // y will have at most one child.
+        // y will be the initial hole in the tree (make the hole at a leaf)
+        Base* y = (z->template left<I>() == nullptr || z->template right<I>() == nullptr) ?
+                        z : tree_next(z);
+        // x is y's possibly null single child
+        Base* x = y->template left<I>() != nullptr ? y->template left<I>() : y->template right<I>();
+        // w is x's possibly null uncle (will become x's sibling)
+        Base* w = nullptr;
+        // link x to y's parent, and find w
+        if (x != nullptr)
+            x->template set_parent<I>(y->template parent<I>());
+        if (tree_is_left_child(y))
+        {
+            y->template parent<I>()->template set_left<I>(x);
+            if (y != root)
+                w = y->template parent<I>()->template right<I>();
+            else
+                root = x;  // w == nullptr
+        }
+        else
+        {
+            y->template parent<I>()->template set_right<I>(x);
+            // y can't be root if it is a right child
+            w = y->template parent<I>()->template left<I>();
+        }
+        bool removed_black = y->template rank_parity<I>();
+        // If we didn't remove z, do so now by splicing in y for z,
+        //    but copy z's color.  This does not impact x or w.
+        if (y != z)
+        {
+            // z->template left<I>() != nulptr but z->template right<I>() might == x == nullptr
+            y->template set_parent<I>(z->template parent<I>());
+            if (tree_is_left_child(z))
+                y->template parent<I>()->template set_left<I>(y);
+            else
+                y->template parent<I>()->template set_right<I>(y);
+            y->template set_left<I>(z->template left<I>());
+            y->template left<I>()->template set_parent<I>(y);
+            y->template set_right<I>(z->template right<I>());
+            if (y->template right<I>() != nullptr)
+                y->template right<I>()->template set_parent<I>(y);
+            y->template set_rank_parity<I>(z->template rank_parity<I>());
+            if (root == z)
+                root = y;
+        }
+        if (removed_black && root != nullptr)
+        {
+            // Rebalance:
+            // x has an implicit black color (transferred from the removed y)
+            //    associated with it, no matter what its color is.
+            // If x is root (in which case it can't be null), it is supposed
+            //    to be black anyway, and if it is doubly black, then the double
+            //    can just be ignored.
+            // If x is red (in which case it can't be null), then it can absorb
+            //    the implicit black just by setting its color to black.
+            // Since y was black and only had one child (which x points to), x
+            //   is either red with no children, else null, otherwise y would have
+            //   different black heights under left and right pointers.
+            // if (x == root || x != nullptr && !x->is_black_)
+            if (x != nullptr)
+                x->template set_rank_parity<I>(true);
+            else {
+                //  Else x isn't root, and is "doubly black", even though it may
+                //     be null.  w can not be null here, else the parent would
+                //     see a black height >= 2 on the x side and a black height
+                //     of 1 on the w side (w must be a non-null black or a red
+                //     with a non-null black child).
+                fixup_after_remove(root, w);
+            }
+        }
+    }
+
+    static void tree_balance_after_insert(Base* root, Base* x)
+    {
+        x->template set_rank_parity<I>(x == root ? true : false);
+        while (x != root && x->template parent<I>()->template rank_parity<I>() == false)
+        {
+            // x->template parent<I>() != root because x->template parent<I>()->is_black == false
+            if (tree_is_left_child(x->template parent<I>()))
+            {
+                Base* y = x->template parent<I>()->template parent<I>()->template right<I>();
+                if (y != nullptr && y->template rank_parity<I>() == false)
+                {
+                    x = x->template parent<I>();
+                    x->template set_rank_parity<I>(true);
+                    x = x->template parent<I>();
+                    x->template set_rank_parity<I>(x == root ? true : false);
+                    y->template set_rank_parity<I>(true);
+                }
+                else
+                {
+                    if (!tree_is_left_child(x))
+                    {
+                        x = x->template parent<I>();
+                        tree_left_rotate(x);
+                    }
+                    x = x->template parent<I>();
+                    x->template set_rank_parity<I>(true);
+                    x = x->template parent<I>();
+                    x->template set_rank_parity<I>(false);
+                    tree_right_rotate(x);
+                    break;
+                }
+            }
+            else
+            {
+                Base* y = x->template parent<I>()->template parent<I>()->template left<I>();
+                if (y != nullptr && y->template rank_parity<I>() == false)
+                {
+                    x = x->template parent<I>();
+                    x->template set_rank_parity<I>(true);
+                    x = x->template parent<I>();
+                    x->template set_rank_parity<I>(x == root ? true : false);
+                    y->template set_rank_parity<I>(true);
+                }
+                else
+                {
+                    if (tree_is_left_child(x))
+                    {
+                        x = x->template parent<I>();
+                        tree_right_rotate(x);
+                    }
+                    x = x->template parent<I>();
+                    x->template set_rank_parity<I>(true);
+                    x = x->template parent<I>();
+                    x->template set_rank_parity<I>(false);
+                    tree_left_rotate(x);
+                    break;
+                }
+            }
+        }
+    }
+
+    static void fixup_after_remove(Base* root, Base* w)
+    {
+        Base* x = nullptr;
+        while (true)
+        {
+            if (!tree_is_left_child(w))  // if x is left child
+            {
+                if (w->template rank_parity<I>() == false)
+                {
+                    w->template set_rank_parity<I>(true);
+                    w->template parent<I>()->template set_rank_parity<I>(false);
+                    tree_left_rotate(w->template parent<I>());
+                    // x is still valid
+                    // reset root only if necessary
+                    if (root == w->template left<I>())
+                        root = w;
+                    // reset sibling, and it still can't be null
+                    w = w->template left<I>()->template right<I>();
+                }
+                // w->is_black_ is now true, w may have null children
+                if ((w->template left<I>()  == nullptr || w->template left<I>()->template rank_parity<I>() == true) &&
+                    (w->template right<I>() == nullptr || w->template right<I>()->template rank_parity<I>() == true))
+                {
+                    w->template set_rank_parity<I>(false);
+                    x = w->template parent<I>();
+                    // x can no longer be null
+                    if (x == root || x->template rank_parity<I>() == false)
+                    {
+                        x->template set_rank_parity<I>(true);
+                        break;
+                    }
+                    // reset sibling, and it still can't be null
+                    w = tree_is_left_child(x) ?
+                                x->template parent<I>()->template right<I>() :
+                                x->template parent<I>()->template left<I>();
+                    // continue;
+                }
+                else  // w has a red child
+                {
+                    if (w->template right<I>() == nullptr || w->template right<I>()->template rank_parity<I>() == true)
+                    {
+                        // w left child is non-null and red
+                        w->template left<I>()->template set_rank_parity<I>(true);
+                        w->template set_rank_parity<I>(false);
+                        tree_right_rotate(w);
+                        // w is known not to be root, so root hasn't changed
+                        // reset sibling, and it still can't be null
+                        w = w->template parent<I>();
+                    }
+                    // w has a right red child, left child may be null
+                    w->template set_rank_parity<I>(w->template parent<I>()->template rank_parity<I>());
+                    w->template parent<I>()->template set_rank_parity<I>(true);
+                    w->template right<I>()->template set_rank_parity<I>(true);
+                    tree_left_rotate(w->template parent<I>());
+                    break;
+                }
+            }
+            else
+            {
+                if (w->template rank_parity<I>() == false)
+                {
+                    w->template set_rank_parity<I>(true);
+                    w->template parent<I>()->template set_rank_parity<I>(false);
+                    tree_right_rotate(w->template parent<I>());
+                    // x is still valid
+                    // reset root only if necessary
+                    if (root == w->template right<I>())
+                        root = w;
+                    // reset sibling, and it still can't be null
+                    w = w->template right<I>()->template left<I>();
+                }
+                // w->is_black_ is now true, w may have null children
+                if ((w->template left<I>()  == nullptr || w->template left<I>()->template rank_parity<I>() == true) &&
+                    (w->template right<I>() == nullptr || w->template right<I>()->template rank_parity<I>() == true))
+                {
+                    w->template set_rank_parity<I>(false);
+                    x = w->template parent<I>();
+                    // x can no longer be null
+                    if (x->template rank_parity<I>() == false || x == root)
+                    {
+                        x->template set_rank_parity<I>(true);
+                        break;
+                    }
+                    // reset sibling, and it still can't be null
+                    w = tree_is_left_child(x) ?
+                                x->template parent<I>()->template right<I>() :
+                                x->template parent<I>()->template left<I>();
+                    // continue;
+                }
+                else  // w has a red child
+                {
+                    if (w->template left<I>() == nullptr || w->template left<I>()->template rank_parity<I>() == true)
+                    {
+                        // w right child is non-null and red
+                        w->template right<I>()->template set_rank_parity<I>(true);
+                        w->template set_rank_parity<I>(false);
+                        tree_left_rotate(w);
+                        // w is known not to be root, so root hasn't changed
+                        // reset sibling, and it still can't be null
+                        w = w->template parent<I>();
+                    }
+                    // w has a left red child, right child may be null
+                    w->template set_rank_parity<I>(w->template parent<I>()->template rank_parity<I>());
+                    w->template parent<I>()->template set_rank_parity<I>(true);
+                    w->template left<I>()->template set_rank_parity<I>(true);
+                    tree_right_rotate(w->template parent<I>());
+                    break;
+                }
+            }
+        }
+    }
+};
+
+} // namespace bench
+
+#endif // TMI_BENCH_RB_TREE_H_
@@ -15,11 +15,11 @@ struct hash_nonunique;
 class compare_myclass_less
 {
 public:
-    TMI_CPP23_STATIC constexpr bool operator()(const myclass& a, const myclass& b) TMI_CONST_IF_NOT_CPP23_STATIC
+    TMI_CPP23_STATIC bool operator()(const myclass& a, const myclass& b) TMI_CONST_IF_NOT_CPP23_STATIC
     {
         return std::stol(a.val) < std::stol(b.val);
     }
-    TMI_CPP23_STATIC constexpr bool operator()(const myclass* a, const myclass* b) TMI_CONST_IF_NOT_CPP23_STATIC
+    TMI_CPP23_STATIC bool operator()(const myclass* a, const myclass* b) TMI_CONST_IF_NOT_CPP23_STATIC
     {
         return std::stol(a->val) < std::stol(b->val);
     }
@@ -0,0 +1,162 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/* Regression checks. Each one is a sequence which once misbehaved, and
+   exits non-zero on failure. Checks stay active in release builds; the
+   debug assertions inside tmi are only exercised without NDEBUG. */
+
+#include "../tmi.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,      \
+                         __LINE__, #cond);                                   \
+            std::exit(1);                                                    \
+        }                                                                    \
+    } while (0)
+
+namespace {
+
+struct entry
+{
+    uint64_t a;
+    uint64_t b;
+    uint64_t c;
+};
+
+struct key_a
+{
+    using result_type = uint64_t;
+    uint64_t operator()(const entry& e) const { return e.a; }
+};
+
+struct key_b
+{
+    using result_type = uint64_t;
+    uint64_t operator()(const entry& e) const { return e.b; }
+};
+
+struct key_c
+{
+    using result_type = uint64_t;
+    uint64_t operator()(const entry& e) const { return e.c; }
+};
+
+struct sum_c
+{
+    using result_type = uint64_t;
+    uint64_t operator()(const entry& e) const { return e.c; }
+    uint64_t combine(uint64_t lhs, uint64_t rhs) const { return lhs + rhs; }
+};
+
+/* A node re-inserted into an empty tree must not keep the aggregate of its
+   old position, or a later modify() which leaves that index alone looks
+   like it changed the aggregate. */
+void augmented_reinsert_as_root()
+{
+    tmi::multi_index_container<entry, tmi::indexed_by<tmi::hashed_unique<key_a>,
+                                                      tmi::ordered_non_unique<key_b>,
+                                                      tmi::augmented_unique<key_c, sum_c>>> c;
+    c.emplace(entry{1, 1, 10});
+    c.emplace(entry{2, 2, 20});
+    auto first = c.extract(c.find(1));
+    auto second = c.extract(c.find(2));
+    CHECK(c.empty());
+    CHECK(c.insert(std::move(first)).inserted);
+    auto it = c.find(1);
+    CHECK(c.get<2>().range_aggregate(0, 100) == 10);
+    CHECK(c.modify<1>(it, [](entry& e) { e.b = 5; }));
+    CHECK(c.get<2>().range_aggregate(0, 100) == 10);
+    CHECK(c.insert(std::move(second)).inserted);
+    CHECK(c.get<2>().range_aggregate(0, 100) == 30);
+}
+
+/* Ranges are cut out of the tree by splitting and joining it, which must
+   leave subtree sizes and aggregates right, and every other index
+   consistent. */
+void ordered_erase_range()
+{
+    tmi::multi_index_container<entry, tmi::indexed_by<tmi::hashed_unique<key_a>,
+                                                      tmi::ranked_non_unique<key_b>,
+                                                      tmi::augmented_non_unique<key_c, sum_c>>> c;
+    for (uint64_t i = 0; i < 1000; i++) {
+        c.emplace(entry{i, (i * 7919) % 1000, i % 10});
+    }
+    auto& ranked = c.get<1>();
+    for (uint64_t lo : {0, 100, 500, 900}) {
+        const size_t size = c.size();
+        ranked.erase(ranked.lower_bound(lo), ranked.lower_bound(lo + 80));
+        CHECK(c.size() == size - 80);
+    }
+    uint64_t sum = 0;
+    size_t rank = 0;
+    for (auto it = ranked.begin(); it != ranked.end(); ++it, ++rank) {
+        CHECK(ranked.rank(it) == rank);
+        CHECK(ranked.nth(rank) == it);
+        CHECK(c.find(it->a) != c.end());
+        sum += it->c;
+    }
+    CHECK(rank == 680);
+    CHECK(c.get<2>().range_aggregate(0, 10) == sum);
+}
+
+/* A minimum load factor shrinks tables after mass erasure, but must not
+   undo reserve(). */
+template <typename Index>
+void reserve_survives_min_load_factor()
+{
+    tmi::multi_index_container<entry, tmi::indexed_by<Index>> c;
+    auto& index = c.template get<0>();
+    index.min_load_factor(0.1f);
+    index.reserve(100000);
+    const size_t reserved = index.bucket_count();
+    for (uint64_t i = 0; i < 90000; i++) {
+        c.emplace(entry{i, 0, 0});
+        CHECK(index.bucket_count() == reserved);
+    }
+    index.reserve(0);
+    for (uint64_t i = 0; i < 89000; i++) {
+        c.erase(c.find(i));
+    }
+    c.emplace(entry{0, 0, 0});
+    CHECK(index.bucket_count() < reserved);
+}
+
+/* With 32-bit cached hashes, a key change which keeps the low 32 bits of
+   the hash must still be noticed by modify(). std::hash<uint64_t> is the
+   identity in libstdc++ and libc++, so k and k + 2^32 suffice. */
+template <typename Index>
+void hash32_modify_detects_key_change()
+{
+    tmi::multi_index_container<entry, tmi::indexed_by<Index>> c;
+    const uint64_t high = (uint64_t{1} << 32) + 1;
+    c.emplace(entry{1, 0, 0});
+    c.emplace(entry{high, 0, 0});
+    CHECK(!c.modify(c.find(1), [&](entry& e) { e.a = high; }));
+    CHECK(c.size() == 1);
+    CHECK(c.count(high) == 1);
+    c.emplace(entry{1, 0, 0});
+    CHECK(c.modify(c.find(1), [](entry& e) { e.a = (uint64_t{2} << 32) + 1; }));
+    CHECK(c.count(1) == 0);
+    CHECK(c.count((uint64_t{2} << 32) + 1) == 1);
+}
+
+} // namespace
+
+int main()
+{
+    augmented_reinsert_as_root();
+    ordered_erase_range();
+    reserve_survives_min_load_factor<tmi::hashed_unique<key_a>>();
+    reserve_survives_min_load_factor<tmi::hashed_flat_unique<key_a>>();
+    hash32_modify_detects_key_change<tmi::hashed_unique<key_a, std::hash<uint64_t>, void, tmi::hash32_cache>>();
+    hash32_modify_detects_key_change<tmi::hashed_linked_unique<key_a, std::hash<uint64_t>, void, tmi::hash32_cache>>();
+    return 0;
+}
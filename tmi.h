@@ -6,22 +6,108 @@
 #define TMI_H_
 
 #include "tminode.h"
+#include "tmi_arena.h"
+#include "tmi_btree.h"
 #include "tmi_comparator.h"
+#include "tmi_flat_hasher.h"
 #include "tmi_hasher.h"
 #include "tmi_index.h"
 #include "tmi_nodehandle.h"
+#include "tmi_pool.h"
 
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <memory>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace tmi {
 namespace detail {
 
+/* Maps the nodes of a container being copied to their copies, so that
+   indices can clone their structure without searching. Also maps the nodes
+   of a batch modify to their entries. Open addressing over a power-of-two
+   table kept at most half full. */
+template <typename Node, typename Value = Node*>
+class node_map
+{
+    std::vector<std::pair<const Node*, Value>> m_slots;
+    size_t m_count{0};
+    int m_shift;
+
+    size_t slot(const Node* from) const
+    {
+        return static_cast<size_t>((reinterpret_cast<uintptr_t>(from) * uint64_t{0x9e3779b97f4a7c15}) >> m_shift);
+    }
+
+    void resize(size_t size)
+    {
+        std::vector<std::pair<const Node*, Value>> old_slots(size);
+        old_slots.swap(m_slots);
+        m_shift = 64 - std::countr_zero(size);
+        for (const auto& entry : old_slots) {
+            if (entry.first != nullptr) {
+                size_t i = slot(entry.first);
+                while (m_slots[i].first != nullptr) {
+                    i = (i + 1) & (m_slots.size() - 1);
+                }
+                m_slots[i] = entry;
+            }
+        }
+    }
+
+public:
+    explicit node_map(size_t count)
+    {
+        resize(std::bit_ceil(std::max(count * 2, size_t{2})));
+    }
+
+    void insert(const Node* from, Value to)
+    {
+        if (2 * ++m_count > m_slots.size()) {
+            resize(2 * m_slots.size());
+        }
+        size_t i = slot(from);
+        while (m_slots[i].first != nullptr) {
+            i = (i + 1) & (m_slots.size() - 1);
+        }
+        m_slots[i] = std::make_pair(from, to);
+    }
+
+    /* The value mapped from from, or nullptr if it isn't mapped. */
+    const Value* find(const Node* from) const
+    {
+        size_t i = slot(from);
+        while (m_slots[i].first != nullptr) {
+            if (m_slots[i].first == from) {
+                return &m_slots[i].second;
+            }
+            i = (i + 1) & (m_slots.size() - 1);
+        }
+        return nullptr;
+    }
+
+    Value operator()(const Node* from) const
+    {
+        if (from == nullptr) {
+            return Value{};
+        }
+        size_t i = slot(from);
+        while (m_slots[i].first != from) {
+            assert(m_slots[i].first != nullptr);
+            i = (i + 1) & (m_slots.size() - 1);
+        }
+        return m_slots[i].second;
+    }
+};
+
 template <typename T, typename Indices, typename Allocator, typename Parent, int I>
 struct index_type_helper
 {
@@ -30,7 +116,11 @@ struct index_type_helper
     using index_type = std::tuple_element_t<I, index_types>;
     using comparator = tmi_comparator<T, node_type, index_type, Parent, Allocator, I>;
     using hasher = tmi_hasher<T, node_type, index_type, Parent, Allocator, I>;
-    using type = std::conditional_t<std::is_base_of_v<hashed_type, index_type>, hasher, comparator>;
+    using btree = tmi_btree<T, node_type, index_type, Parent, Allocator, I>;
+    using flat_hasher = tmi_flat_hasher<T, node_type, index_type, Parent, Allocator, I>;
+    using type = std::conditional_t<std::is_base_of_v<hashed_type, index_type>, hasher,
+                 std::conditional_t<std::is_base_of_v<flat_hashed_type, index_type>, flat_hasher,
+                 std::conditional_t<std::is_base_of_v<btree_type, index_type>, btree, comparator>>>;
 };
 
 } // namespace detail
@@ -43,11 +133,13 @@ public:
     using allocator_type = Allocator;
     using index_types = typename Indices::index_types;
     using node_type = tminode<T, Indices>;
-    using node_allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<node_type>;
+    using node_allocator_type = detail::node_allocator_t<Allocator, node_type>;
+    using value_allocator_type = detail::value_allocator_t<Allocator, node_type>;
     using inherited_index = typename detail::index_type_helper<T, Indices, Allocator, multi_index_container<T, Indices, Allocator>, 0>::type;
     using node_handle = detail::node_handle<allocator_type, node_type>;
 
     static constexpr size_t num_indices = std::tuple_size<index_types>();
+    static_assert(!Indices::split_values || inheritable<T>, "indexed_by_split stores values in blocks derived from T");
 
     template <int I>
     struct nth_index
@@ -113,6 +205,7 @@ public:
         using hints_types =  std::tuple<typename nth_index_t<First>::insert_hints, typename nth_index_t<ints>::insert_hints ...>;
         using ctor_args_types =  std::tuple<typename nth_index_t<First>::ctor_args, typename nth_index_t<ints>::ctor_args ...>;
         using premodify_cache_types = std::tuple<typename nth_index_t<First>::premodify_cache, typename nth_index_t<ints>::premodify_cache ...>;
+        using bulk_state_types = std::tuple<typename nth_index_t<First>::bulk_state, typename nth_index_t<ints>::bulk_state ...>;
 
         static index_types make_index_types(parent_type& parent, const allocator_type& alloc, const ctor_args_types& args) {
             return std::make_tuple(std::ref(parent), nth_index_t<ints>(parent, alloc, std::get<ints>(args)) ...);
@@ -131,6 +224,7 @@ public:
     using indices_tuple = typename index_tuple_helper<std::make_index_sequence<num_indices>>::index_types;
     using indices_hints_tuple = typename index_tuple_helper<std::make_index_sequence<num_indices>>::hints_types;
     using indices_premodify_cache_tuple = typename index_tuple_helper<std::make_index_sequence<num_indices>>::premodify_cache_types;
+    using indices_bulk_state_tuple = typename index_tuple_helper<std::make_index_sequence<num_indices>>::bulk_state_types;
     using ctor_args_list = typename index_tuple_helper<std::make_index_sequence<num_indices>>::ctor_args_types;
 
     template <typename, typename, typename, typename, typename, int>
@@ -139,6 +233,12 @@ public:
     template <typename, typename, typename, typename, typename, int>
     friend class tmi_comparator;
 
+    template <typename, typename, typename, typename, typename, int>
+    friend class tmi_btree;
+
+    template <typename, typename, typename, typename, typename, int>
+    friend class tmi_flat_hasher;
+
 private:
     node_type* m_begin{nullptr};
     node_type* m_end{nullptr};
@@ -148,7 +248,27 @@ private:
     indices_tuple m_index_instances;
 
     node_allocator_type m_alloc;
+    [[no_unique_address]] value_allocator_type m_value_alloc;
+
+
+    /* Lists of indices, as passed to modify<Indices...>(). */
+    using all_indices = std::make_integer_sequence<int, num_indices>;
+
+    template <int I, int... Listed>
+    static constexpr bool lists_index(std::integer_sequence<int, Listed...>)
+    {
+        return ((I == Listed) || ...);
+    }
+
+    template <int... Listed>
+    static constexpr bool valid_index_list(std::integer_sequence<int, Listed...>)
+    {
+        return ((Listed >= 0 && static_cast<size_t>(Listed) < num_indices) && ...);
+    }
 
+    /* Below this many elements, a batch modify always relinks them one at a
+       time rather than through the bulk insertion path. */
+    static constexpr size_t bulk_relink_min = 32;
 
     template <int I = 0, class Callable, typename Node, typename... Args>
     static void foreach_index(Callable&& func, Node node, Args&&... args)
@@ -172,16 +292,24 @@ private:
         }
     }
 
-    node_type* do_insert(node_type* node)
+    /* Find where value belongs in every index, filling in hints, without
+       needing a node for it. Returns the first node which conflicts with
+       it, if any. If HintIndex names an index, that index places it as
+       close as possible to just before hint. The other indices ignore it. */
+    template <int HintIndex = -1>
+    node_type* do_preinsert(const T& value, indices_hints_tuple& hints, const node_type* hint = nullptr)
     {
-        indices_hints_tuple hints;
-
-        bool can_insert;
         std::array<node_type*, num_indices> conflicts{};
-        can_insert = get_foreach_index([]<int I>(const node_type* node, nth_index_t<I>& instance, auto& hints, auto& conflict) TMI_CPP23_STATIC {
-            conflict = instance.preinsert_node(node, hints);
+        std::array<const node_type*, num_indices> hint_nodes;
+        hint_nodes.fill(hint);
+        const bool can_insert = get_foreach_index([]<int I>(const T* value, nth_index_t<I>& instance, auto& hints, auto& conflict, const node_type* hint) TMI_CPP23_STATIC {
+            if constexpr (I == HintIndex) {
+                conflict = instance.preinsert_node(*value, hints, hint);
+            } else {
+                conflict = instance.preinsert_node(*value, hints);
+            }
             return conflict == nullptr;
-        }, node, m_index_instances, hints, conflicts);
+        }, &value, m_index_instances, hints, conflicts, hint_nodes);
 
         if (!can_insert) {
             for (const auto& conflict : conflicts) {
@@ -191,65 +319,181 @@ private:
             }
         }
         assert(can_insert);
+        return nullptr;
+    }
+
+    /* Link a node whose value do_preinsert accepted, with its hints. */
+    void do_insert_preinserted(node_type* node, const indices_hints_tuple& hints)
+    {
         foreach_index([]<int I>(node_type* node, nth_index_t<I>& instance, const auto& hints) TMI_CPP23_STATIC {
             instance.insert_node(node, hints);
         }, node, m_index_instances,  hints);
 
-        node->link(m_end);
+        do_link(node);
+    }
 
-        if (m_begin == nullptr) {
-            assert(m_end == nullptr);
-            m_begin = m_end = node;
-        } else {
-            m_end = node;
+    template <int HintIndex = -1>
+    node_type* do_insert(node_type* node, const node_type* hint = nullptr)
+    {
+        indices_hints_tuple hints;
+        if (node_type* conflict = do_preinsert<HintIndex>(node->value(), hints, hint)) {
+            return conflict;
+        }
+        do_insert_preinserted(node, hints);
+        return nullptr;
+    }
+
+    /* Append node to the insertion-order list, if there is one. */
+    void do_link(node_type* node)
+    {
+        if constexpr (Indices::insertion_list) {
+            node->link(m_end);
+
+            if (m_begin == nullptr) {
+                assert(m_end == nullptr);
+                m_begin = m_end = node;
+            } else {
+                m_end = node;
+            }
         }
 
         m_size++;
-        return nullptr;
     }
 
-    void do_erase_cleanup(node_type* node)
+    /*
+        Link a batch of nodes into the Listed indices, with the same result as
+        linking them one at a time, in order. on_result(node, accepted) is
+        called for each node in batch order, as soon as it is accepted or
+        rejected, and before any sorted index links the accepted ones.
+
+        Every index first sees the whole batch: hashed indices size their
+        buckets for it once, and sorted indices sort it. Then each element is
+        checked for conflicts and accepted or rejected in batch order. Hashed
+        indices link accepted elements right away. Sorted indices only record
+        them, and finally link them all in key order, building a new balanced
+        tree when the batch is at least as large as what is already there.
+    */
+    template <typename Listed, typename OnResult>
+    void do_insert_batch(const std::vector<node_type*>& nodes, OnResult&& on_result)
     {
-        if (node == m_end) {
-            m_end = node->prev();
+        using batch_entry = std::pair<node_type*, size_t>;
+        indices_bulk_state_tuple states;
+        foreach_index([]<int I>(const std::vector<node_type*>* nodes, nth_index_t<I>& instance, auto& state) TMI_CPP23_STATIC {
+            if constexpr (lists_index<I>(Listed{})) {
+                instance.bulk_prepare(*nodes, state);
+            }
+        }, &nodes, m_index_instances, states);
+
+        std::vector<bool> accepted(nodes.size());
+        for (size_t pos = 0; pos < nodes.size(); pos++) {
+            indices_hints_tuple hints;
+            const bool can_insert = get_foreach_index([]<int I>(batch_entry entry, nth_index_t<I>& instance, auto& state, auto& hints) TMI_CPP23_STATIC {
+                if constexpr (lists_index<I>(Listed{})) {
+                    return instance.bulk_preinsert(entry.first, entry.second, state, hints) == nullptr;
+                }
+                return true;
+            }, batch_entry{nodes[pos], pos}, m_index_instances, states, hints);
+            if (can_insert) {
+                foreach_index([]<int I>(batch_entry entry, nth_index_t<I>& instance, auto& state, const auto& hints) TMI_CPP23_STATIC {
+                    if constexpr (lists_index<I>(Listed{})) {
+                        instance.bulk_insert(entry.first, entry.second, state, hints);
+                    }
+                }, batch_entry{nodes[pos], pos}, m_index_instances, states, hints);
+                accepted[pos] = true;
+            }
+            on_result(nodes[pos], can_insert);
         }
-        if (node == m_begin) {
-            m_begin = node->next();
+
+        foreach_index([]<int I>(std::pair<const std::vector<node_type*>*, const std::vector<bool>*> batch, nth_index_t<I>& instance, auto& state) TMI_CPP23_STATIC {
+            if constexpr (lists_index<I>(Listed{})) {
+                instance.bulk_finish(*batch.first, *batch.second, state);
+            }
+        }, std::make_pair(&nodes, &accepted), m_index_instances, states);
+    }
+
+    /* Insert a batch of elements with the same result as inserting them one
+       at a time, in order. See do_insert_batch. */
+    template <typename InputIt>
+    void do_insert_range(InputIt first, InputIt last)
+    {
+        std::vector<node_type*> nodes;
+        if constexpr (std::forward_iterator<InputIt>) {
+            nodes.reserve(static_cast<size_t>(std::distance(first, last)));
+        }
+        for (; first != last; ++first) {
+            nodes.push_back(detail::create_node<node_type>(m_alloc, m_value_alloc, std::in_place_t{}, *first));
+        }
+        if (nodes.empty()) {
+            return;
+        }
+
+        std::vector<node_type*> rejected;
+        do_insert_batch<all_indices>(nodes, [this, &rejected](node_type* node, bool accepted) {
+            if (accepted) {
+                do_link(node);
+            } else {
+                rejected.push_back(node);
+            }
+        });
+        for (node_type* node : rejected) {
+            do_destroy_node(node);
+        }
+    }
+
+    void do_erase_cleanup(node_type* node)
+    {
+        if constexpr (Indices::insertion_list) {
+            if (node == m_end) {
+                m_end = node->prev();
+            }
+            if (node == m_begin) {
+                m_begin = node->next();
+            }
+            node->unlink();
         }
-        node->unlink();
         m_size--;
     }
 
     void do_destroy_node(node_type* node)
     {
-        std::allocator_traits<node_allocator_type>::destroy(m_alloc, node);
-        std::allocator_traits<node_allocator_type>::deallocate(m_alloc, node, 1);
+        detail::destroy_node(m_alloc, m_value_alloc, node);
     }
 
     template <typename... Args>
     std::pair<node_type*, bool> do_emplace(Args&&... args)
     {
-        node_type* node = m_alloc.allocate(1);
-        node = std::uninitialized_construct_using_allocator<node_type>(node, m_alloc, std::in_place_t{}, std::forward<Args>(args)...);
-        node_type* conflict = do_insert(node);
+        return do_emplace_hint<-1>(nullptr, std::forward<Args>(args)...);
+    }
+
+    template <int HintIndex, typename... Args>
+    std::pair<node_type*, bool> do_emplace_hint(const node_type* hint, Args&&... args)
+    {
+        node_type* node = detail::create_node<node_type>(m_alloc, m_value_alloc, std::in_place_t{}, std::forward<Args>(args)...);
+        node_type* conflict = do_insert<HintIndex>(node, hint);
         if (conflict != nullptr) {
-            std::allocator_traits<node_allocator_type>::destroy(m_alloc, node);
-            std::allocator_traits<node_allocator_type>::deallocate(m_alloc, node, 1);
+            do_destroy_node(node);
             return std::make_pair(conflict, false);
         }
         return std::make_pair(node, true);
     }
 
-    std::pair<node_type*, bool> do_insert(const T& entry)
+    template <typename Value>
+    std::pair<node_type*, bool> do_insert_value(Value&& entry)
     {
-        node_type* node = m_alloc.allocate(1);
-        node = std::uninitialized_construct_using_allocator<node_type>(node, m_alloc, entry);
-        node_type* conflict = do_insert(node);
-        if (conflict != nullptr) {
-            std::allocator_traits<node_allocator_type>::destroy(m_alloc, node);
-            std::allocator_traits<node_allocator_type>::deallocate(m_alloc, node, 1);
+        return do_insert_hint<-1>(nullptr, std::forward<Value>(entry));
+    }
+
+    /* Unlike emplacing, the value already exists to be checked against
+       every index, so a node is only allocated once it is known to fit. */
+    template <int HintIndex, typename Value>
+    std::pair<node_type*, bool> do_insert_hint(const node_type* hint, Value&& entry)
+    {
+        indices_hints_tuple hints;
+        if (node_type* conflict = do_preinsert<HintIndex>(entry, hints, hint)) {
             return std::make_pair(conflict, false);
         }
+        node_type* node = detail::create_node<node_type>(m_alloc, m_value_alloc, std::in_place_t{}, std::forward<Value>(entry));
+        do_insert_preinserted(node, hints);
         return std::make_pair(node, true);
     }
 
@@ -262,13 +506,31 @@ private:
         do_destroy_node(node);
     }
 
-    template <typename Callable>
+    /* Unlink node from every index except Skip, which is detaching its own
+       nodes in bulk, and unlink it from the container. The caller destroys
+       it once Skip no longer needs its links. */
+    template <int Skip>
+    void do_erase_except(node_type* node)
+    {
+        foreach_index([]<int I>(node_type* node, nth_index_t<I>& instance) TMI_CPP23_STATIC {
+            if constexpr (I != Skip) {
+                instance.remove_node(node);
+            }
+        }, node, m_index_instances);
+        do_erase_cleanup(node);
+    }
+
+    /* Modified lists the indices whose keys func may change. The others
+       skip their premodify caches and re-checks entirely. Debug builds
+       assert that they really were unaffected. */
+    template <typename Modified = all_indices, typename Callable>
     bool do_modify(node_type* node, Callable&& func)
     {
+        static_assert(valid_index_list(Modified{}), "modify() declares an index which doesn't exist");
         indices_premodify_cache_tuple index_cache;
 
         foreach_index([]<int I>(const node_type* node, nth_index_t<I>& instance, auto& cache) TMI_CPP23_STATIC {
-            if constexpr (nth_index_t<I>::requires_premodify_cache()) {
+            if constexpr (nth_index_t<I>::requires_premodify_cache() && lists_index<I>(Modified{})) {
                 instance.create_premodify_cache(node, cache);
             }
         }, node, m_index_instances,  index_cache);
@@ -278,17 +540,21 @@ private:
 
         std::array<bool, num_indices> indicies_to_modify{};
 
-        foreach_index([]<int I>(node_type* node, nth_index_t<I>& instance, auto& modify, const auto& cache) TMI_CPP23_STATIC {
-            modify = instance.erase_if_modified(node, cache);
+        foreach_index([]<int I>(node_type* node, nth_index_t<I>& instance, auto& modify, auto& cache) TMI_CPP23_STATIC {
+            if constexpr (lists_index<I>(Modified{})) {
+                modify = instance.erase_if_modified(node, cache);
+            } else {
+                assert(instance.unmodified(node) && "modify() changed the key of an index it didn't declare");
+            }
          }, node, m_index_instances,  indicies_to_modify, index_cache);
 
 
         indices_hints_tuple index_hints;
 
-        bool insertable = get_foreach_index([]<int I>(const node_type* node, nth_index_t<I>& instance, const auto& modify, auto& hints) TMI_CPP23_STATIC {
-            if (modify) return instance.preinsert_node(node, hints) == nullptr;
+        bool insertable = get_foreach_index([]<int I>(const node_type* node, nth_index_t<I>& instance, const auto& modify, const auto& cache, auto& hints) TMI_CPP23_STATIC {
+            if (modify) return instance.preinsert_modified(node, cache, hints) == nullptr;
             return true;
-        }, node, m_index_instances,  indicies_to_modify, index_hints);
+        }, node, m_index_instances,  indicies_to_modify, index_cache, index_hints);
 
         if (insertable) {
             foreach_index([]<int I>(node_type* node, nth_index_t<I>& instance, const auto& modify, const auto& hints) TMI_CPP23_STATIC {
@@ -305,20 +571,124 @@ private:
         }
     }
 
-    void do_clear()
+    /* Apply func to an element of a batch modify. Each Modified index which
+       it now belongs elsewhere in unlinks it, as modify() would, and notes
+       that in unlinked. Indices it has already left skip it. */
+    template <typename Modified, typename Callable>
+    void do_modify_deferred(node_type* node, Callable&& func, std::array<bool, num_indices>& unlinked)
     {
-        foreach_index([]<int I>(std::nullptr_t, nth_index_t<I>& instance) TMI_CPP23_STATIC {
-            instance.do_clear();
-         }, nullptr, m_index_instances);
+        static_assert(valid_index_list(Modified{}), "modify_batch() declares an index which doesn't exist");
+        indices_premodify_cache_tuple index_cache;
+
+        foreach_index([]<int I>(const node_type* node, nth_index_t<I>& instance, const auto& unlinked, auto& cache) TMI_CPP23_STATIC {
+            if constexpr (nth_index_t<I>::requires_premodify_cache() && lists_index<I>(Modified{})) {
+                if (!unlinked) instance.create_premodify_cache(node, cache);
+            }
+        }, node, m_index_instances, unlinked, index_cache);
+
+        func(node->value());
 
-        auto* node = m_begin;
-        while (node) {
-            auto* to_delete = node;
-            node = node->next();
-            std::allocator_traits<node_allocator_type>::destroy(m_alloc, to_delete);
-            std::allocator_traits<node_allocator_type>::deallocate(m_alloc, to_delete, 1);
+        foreach_index([]<int I>(node_type* node, nth_index_t<I>& instance, auto& unlinked, auto& cache) TMI_CPP23_STATIC {
+            if constexpr (lists_index<I>(Modified{})) {
+                if (!unlinked) unlinked = instance.erase_if_modified(node, cache);
+            } else {
+                assert(instance.unmodified(node) && "modify_batch() changed the key of an index it didn't declare");
+            }
+        }, node, m_index_instances, unlinked, index_cache);
+    }
+
+    /* Relink the elements of a batch modify which left any Modified index,
+       in the order they were first modified. Each is first unlinked from the
+       Modified indices it is still in, so that all are relinked alike.
+       Elements which then conflict with another are unlinked from the
+       container and handed back rather than destroyed. */
+    template <typename Modified>
+    std::vector<node_handle> do_modify_batch(const std::vector<std::pair<node_type*, std::array<bool, num_indices>>>& pending)
+    {
+        std::vector<node_handle> rejected;
+        std::vector<node_type*> nodes;
+        for (const auto& [node, unlinked] : pending) {
+            if (std::find(unlinked.begin(), unlinked.end(), true) == unlinked.end()) {
+                continue;
+            }
+            foreach_index([]<int I>(node_type* node, nth_index_t<I>& instance, const auto& unlinked) TMI_CPP23_STATIC {
+                if constexpr (lists_index<I>(Modified{})) {
+                    if (!unlinked) instance.remove_node(node);
+                }
+            }, node, m_index_instances, unlinked);
+            nodes.push_back(node);
+        }
+        if (nodes.empty()) {
+            return rejected;
+        }
+
+        auto reject = [this, &rejected](node_type* node) {
+            foreach_index([]<int I>(node_type* node, nth_index_t<I>& instance) TMI_CPP23_STATIC {
+                if constexpr (!lists_index<I>(Modified{})) {
+                    instance.remove_node(node);
+                }
+            }, node, m_index_instances);
+            do_erase_cleanup(node);
+            rejected.push_back(node_handle(m_alloc, node));
+        };
+
+        /* Sorting pays off once the batch outweighs what is still linked, and
+           sorted indices can rebuild rather than search. */
+        if (nodes.size() < bulk_relink_min || nodes.size() < m_size - nodes.size()) {
+            for (node_type* node : nodes) {
+                indices_hints_tuple hints;
+                const bool insertable = get_foreach_index([]<int I>(const node_type* node, nth_index_t<I>& instance, auto& hints) TMI_CPP23_STATIC {
+                    if constexpr (lists_index<I>(Modified{})) {
+                        return instance.preinsert_node(node->value(), hints) == nullptr;
+                    }
+                    return true;
+                }, node, m_index_instances, hints);
+                if (!insertable) {
+                    reject(node);
+                    continue;
+                }
+                foreach_index([]<int I>(node_type* node, nth_index_t<I>& instance, const auto& hints) TMI_CPP23_STATIC {
+                    if constexpr (lists_index<I>(Modified{})) {
+                        instance.insert_node(node, hints);
+                    }
+                }, node, m_index_instances, hints);
+            }
+        } else {
+            do_insert_batch<Modified>(nodes, [&reject](node_type* node, bool accepted) {
+                if (!accepted) {
+                    reject(node);
+                }
+            });
+        }
+        return rejected;
+    }
+
+    void do_clear()
+    {
+        if constexpr (Indices::insertion_list) {
+            foreach_index([]<int I>(std::nullptr_t, nth_index_t<I>& instance) TMI_CPP23_STATIC {
+                instance.do_clear();
+             }, nullptr, m_index_instances);
+
+            auto* node = m_begin;
+            while (node) {
+                auto* to_delete = node;
+                node = node->next();
+                do_destroy_node(to_delete);
+            }
+            m_begin = m_end = nullptr;
+        } else {
+            /* Without the list, the first index hands over each node as it
+               is taken apart. */
+            foreach_index([]<int I>(parent_type* parent, nth_index_t<I>& instance) TMI_CPP23_STATIC {
+                if constexpr (I == 0) {
+                    instance.do_clear([parent](node_type* node) { parent->do_destroy_node(node); });
+                } else {
+                    instance.do_clear();
+                }
+             }, this, m_index_instances);
         }
-        m_begin = m_end = nullptr;
+        m_size = 0;
     }
 
     size_t get_size() const
@@ -348,14 +718,16 @@ public:
     multi_index_container(const allocator_type& alloc = {})
         : inherited_index(*this, alloc),
           m_index_instances(index_tuple_helper<std::make_index_sequence<num_indices>>::make_index_types(*this, alloc)),
-          m_alloc(alloc)
+          m_alloc(alloc),
+          m_value_alloc(alloc)
     {
     }
 
     multi_index_container(const ctor_args_list& args, const allocator_type& alloc = {})
         : inherited_index(*this, alloc, std::get<0>(args)),
           m_index_instances(index_tuple_helper<std::make_index_sequence<num_indices>>::make_index_types(*this, alloc, args)),
-          m_alloc(alloc)
+          m_alloc(alloc),
+          m_value_alloc(alloc)
     {
     }
 
@@ -367,42 +739,53 @@ public:
     multi_index_container(const multi_index_container& rhs)
         : inherited_index(*this, *static_cast<const inherited_index*>(&rhs)),
           m_index_instances(index_tuple_helper<std::make_index_sequence<num_indices>>::make_index_types(*this, rhs.m_index_instances)),
-          m_alloc(std::allocator_traits<allocator_type>::select_on_container_copy_construction(rhs.m_alloc))
+          m_alloc(std::allocator_traits<allocator_type>::select_on_container_copy_construction(rhs.m_alloc)),
+          m_value_alloc(allocator_type(m_alloc))
     {
         if (!rhs.m_size) {
             return;
         }
-        node_type* from_node = rhs.m_begin;
-        node_type* prev_node = nullptr;
-        node_type* to_node = nullptr;
-        m_begin = to_node;
-        for(size_t i = 0; i < rhs.m_size; i++)
-        {
-            to_node = m_alloc.allocate(1);
-            std::uninitialized_construct_using_allocator<node_type>(to_node, m_alloc, *from_node);
-            if(i == 0) {
-                m_begin = to_node;
+        /* Copy the nodes, remembering which copy belongs to which original.
+           Each index then copies its structure from rhs, swapping in the
+           copies. No keys are compared or hashed. */
+        detail::node_map<node_type> copies(rhs.m_size);
+        if constexpr (Indices::insertion_list) {
+            node_type* from_node = rhs.m_begin;
+            node_type* prev_node = nullptr;
+            node_type* to_node = nullptr;
+            m_begin = to_node;
+            for(size_t i = 0; i < rhs.m_size; i++)
+            {
+                to_node = detail::create_node<node_type>(m_alloc, m_value_alloc, *from_node);
+                if(i == 0) {
+                    m_begin = to_node;
+                }
+                to_node->link(prev_node);
+                copies.insert(from_node, to_node);
+                prev_node = to_node;
+                from_node = from_node->next();
+            }
+            m_end = prev_node;
+        } else {
+            // Without the list, copy the nodes in the first index's order.
+            for (const T& elem : static_cast<const inherited_index&>(rhs)) {
+                const node_type* from_node = &node_type::node_cast(elem);
+                node_type* to_node = detail::create_node<node_type>(m_alloc, m_value_alloc, *from_node);
+                copies.insert(from_node, to_node);
             }
-            to_node->link(prev_node);
-            prev_node = to_node;
-            from_node = from_node->next();
         }
-        m_end = prev_node;
+        m_size = rhs.m_size;
 
-        to_node = m_begin;
-        while(to_node) {
-            foreach_index([]<int I>(node_type* node, nth_index_t<I>& instance) TMI_CPP23_STATIC {
-                instance.insert_node_direct(node);
-            }, to_node, m_index_instances);
-            to_node = to_node->next();
-            m_size++;
-        }
+        foreach_index([]<int I>(const detail::node_map<node_type>* copies, nth_index_t<I>& instance, const nth_index_t<I>& rhs_instance) TMI_CPP23_STATIC {
+            instance.clone_from(rhs_instance, *copies);
+        }, &copies, m_index_instances, rhs.m_index_instances);
     }
 
     multi_index_container(multi_index_container&& rhs)
-        : inherited_index(*this, std::move(*static_cast<const inherited_index*>(&rhs))),
+        : inherited_index(*this, std::move(static_cast<inherited_index&>(rhs))),
           m_index_instances(index_tuple_helper<std::make_index_sequence<num_indices>>::make_index_types(*this, std::move(rhs.m_index_instances))),
-          m_alloc(std::move(rhs.m_alloc))
+          m_alloc(std::move(rhs.m_alloc)),
+          m_value_alloc(std::move(rhs.m_value_alloc))
     {
         m_size = rhs.m_size;
         m_begin = rhs.m_begin;
@@ -417,6 +800,107 @@ public:
         return sizeof(node_type);
     }
 
+    /* Make room for count elements in every hashed index, so that none of
+       them rehashes until the container holds more. Ordered indices have
+       nothing to presize. An allocator which can reserve, such as
+       node_pool_allocator, is asked to make room for the missing nodes. */
+    void reserve(size_t count)
+    {
+        if constexpr (requires { m_alloc.reserve(count); }) {
+            if (count > m_size) {
+                m_alloc.reserve(count - m_size);
+            }
+        }
+        foreach_index([]<int I>(size_t count, nth_index_t<I>& instance) TMI_CPP23_STATIC {
+            if constexpr (requires { instance.reserve(count); }) {
+                instance.reserve(count);
+            }
+        }, count, m_index_instances);
+    }
+
+    /*
+        A set of changes to many elements, relinked all at once by commit().
+        Obtained from modify_batch().
+
+        modify() applies func right away, to an element found through any
+        index. An element whose key changed in one of the declared indices
+        leaves it, and is only relinked by commit(). Until then the declared
+        indices stay usable but are missing those elements, and elements in
+        the batch must not be erased. commit() relinks the elements in the
+        order they were first modified, and sorts the batch once when it
+        outweighs the rest of the container. Elements which now conflict
+        with another in a unique index are unlinked and returned, rather
+        than destroyed as modify() does. Destroying an uncommitted batch
+        commits it, dropping any conflicts.
+    */
+    template <typename Modified>
+    class batch_modifier
+    {
+        parent_type& m_parent;
+        std::vector<std::pair<node_type*, std::array<bool, num_indices>>> m_pending;
+        detail::node_map<node_type, size_t> m_positions{0};
+
+    public:
+        explicit batch_modifier(parent_type& parent) : m_parent(parent) {}
+        batch_modifier(const batch_modifier&) = delete;
+        batch_modifier& operator=(const batch_modifier&) = delete;
+
+        ~batch_modifier()
+        {
+            commit();
+        }
+
+        template <typename IteratorType, typename Callable>
+        bool modify(IteratorType it, Callable&& func)
+        {
+            static constexpr size_t from_iterator_index = index_iterator_v<IteratorType>;
+            node_type* node = const_cast<node_type*>(std::get<from_iterator_index>(m_parent.m_index_instances).node_from_iterator(it));
+            if (!node) return false;
+            size_t pos;
+            if (const size_t* found = m_positions.find(node)) {
+                pos = *found;
+            } else {
+                pos = m_pending.size();
+                m_positions.insert(node, pos);
+                m_pending.emplace_back(node, std::array<bool, num_indices>{});
+            }
+            m_parent.template do_modify_deferred<Modified>(node, std::forward<Callable>(func), m_pending[pos].second);
+            return true;
+        }
+
+        size_t pending() const noexcept
+        {
+            return m_pending.size();
+        }
+
+        std::vector<node_handle> commit()
+        {
+            std::vector<node_handle> rejected = m_parent.template do_modify_batch<Modified>(m_pending);
+            m_pending.clear();
+            m_positions = detail::node_map<node_type, size_t>{0};
+            return rejected;
+        }
+    };
+
+    batch_modifier<all_indices> modify_batch()
+    {
+        return batch_modifier<all_indices>(*this);
+    }
+
+    /* As above, declaring that the batch only changes the keys of the
+       listed indices, by number or by tag. The others are left alone. */
+    template <int Modified, int... MoreModified>
+    batch_modifier<std::integer_sequence<int, Modified, MoreModified...>> modify_batch()
+    {
+        return batch_modifier<std::integer_sequence<int, Modified, MoreModified...>>(*this);
+    }
+
+    template <typename Tag, typename... MoreTags>
+    batch_modifier<std::integer_sequence<int, static_cast<int>(index_v<Tag>), static_cast<int>(index_v<MoreTags>)...>> modify_batch()
+    {
+        return modify_batch<static_cast<int>(index_v<Tag>), static_cast<int>(index_v<MoreTags>)...>();
+    }
+
     template<size_t I, typename IteratorType>
     typename nth_index_t<I>::iterator project(IteratorType it)
     {
@@ -0,0 +1,280 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TMI_ARENA_H_
+#define TMI_ARENA_H_
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace tmi {
+namespace detail {
+
+/* Nodes in an arena live in chunks of this many bytes, aligned to their
+   size. */
+static constexpr size_t arena_chunk_bytes = size_t{1} << 16;
+
+/* The start of every arena chunk. All chunks of an arena point to the same
+   table, which holds the address of the first node in each chunk. */
+struct arena_chunk_header
+{
+    std::byte* const* m_table;
+    uint32_t m_index;
+};
+
+/*
+    32-bit references between nodes of the same arena.
+
+    A link is the number of the chunk a node is in and its slot within the
+    chunk, plus one so that 0 can stand for nullptr. Links fit in 31 bits,
+    leaving one spare for the tree's rank parity.
+
+    Following a link needs the arena's chunk table, which is reached through
+    the header of the chunk holding the link: chunks are aligned to their
+    size, so that header is found by masking the link's own address. Links
+    can thus be followed from any node, without the container at hand, and
+    copied between nodes of the same arena as they are.
+*/
+template <typename Node>
+struct arena_links
+{
+    static constexpr size_t first_offset = (sizeof(arena_chunk_header) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    static_assert(first_offset + sizeof(Node) <= arena_chunk_bytes, "node too large for an arena chunk");
+    static constexpr size_t chunk_nodes = (arena_chunk_bytes - first_offset) / sizeof(Node);
+    static constexpr int slot_bits = std::bit_width(chunk_nodes - 1);
+    static constexpr uint32_t slot_mask = (uint32_t{1} << slot_bits) - 1;
+    static constexpr size_t max_chunks = (size_t{1} << (31 - slot_bits)) - 1;
+
+    static const arena_chunk_header* header(const void* ptr) noexcept
+    {
+        return reinterpret_cast<const arena_chunk_header*>(reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t{arena_chunk_bytes - 1});
+    }
+
+    static uint32_t encode(const Node* node) noexcept
+    {
+        if (node == nullptr) {
+            return 0;
+        }
+        const arena_chunk_header* chunk = header(node);
+        const size_t offset = static_cast<size_t>(reinterpret_cast<const std::byte*>(node) - reinterpret_cast<const std::byte*>(chunk)) - first_offset;
+        return ((chunk->m_index << slot_bits) | static_cast<uint32_t>(offset / sizeof(Node))) + 1;
+    }
+
+    // from is any address within a chunk of the same arena.
+    static Node* decode(const void* from, uint32_t link) noexcept
+    {
+        if (link == 0) {
+            return nullptr;
+        }
+        const uint32_t ref = link - 1;
+        std::byte* first = header(from)->m_table[ref >> slot_bits];
+        return std::launder(reinterpret_cast<Node*>(first + (ref & slot_mask) * sizeof(Node)));
+    }
+};
+
+/*
+    Fixed-size node blocks carved from aligned chunks, for containers whose
+    nodes link to each other with arena_links.
+
+    As in node_pool, freed blocks are reused last-in first-out and chunks are
+    only returned when the arena is destroyed. Chunks come from Allocator.
+*/
+template <typename Node, typename Allocator>
+class node_arena
+{
+    struct alignas(arena_chunk_bytes) chunk
+    {
+        std::byte m_bytes[arena_chunk_bytes];
+    };
+    struct free_block
+    {
+        free_block* m_next;
+    };
+    static_assert(sizeof(Node) >= sizeof(free_block) && alignof(Node) >= alignof(free_block));
+
+    using links = arena_links<Node>;
+    using chunk_allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<chunk>;
+    using chunk_traits = std::allocator_traits<chunk_allocator_type>;
+
+    chunk_allocator_type m_alloc;
+    std::vector<std::byte*> m_table;
+    free_block* m_free{nullptr};
+    std::byte* m_bump{nullptr};
+    std::byte* m_bump_end{nullptr};
+    size_t m_in_use{0};
+
+    static arena_chunk_header* header_of(std::byte* first) noexcept
+    {
+        return reinterpret_cast<arena_chunk_header*>(first - links::first_offset);
+    }
+
+    void push_free(void* ptr) noexcept
+    {
+        m_free = ::new (ptr) free_block{m_free};
+    }
+
+    void add_chunk()
+    {
+        if (m_table.size() == links::max_chunks) {
+            throw std::length_error("tmi: node arena is full");
+        }
+        /* Every header points to the table, so they follow it when it
+           moves. It grows geometrically, so that each header is rewritten
+           O(log n) times rather than once per new chunk. */
+        if (m_table.size() == m_table.capacity()) {
+            m_table.reserve(std::max<size_t>(16, 2 * m_table.size()));
+            for (std::byte* chunk_first : m_table) {
+                header_of(chunk_first)->m_table = m_table.data();
+            }
+        }
+        chunk* new_chunk = chunk_traits::allocate(m_alloc, 1);
+        std::byte* first = new_chunk->m_bytes + links::first_offset;
+        ::new (new_chunk->m_bytes) arena_chunk_header{m_table.data(), static_cast<uint32_t>(m_table.size())};
+        m_table.push_back(first);
+        /* Whatever is left of the current chunk goes on the free list, so
+           that the new one can be carved from the start. */
+        while (m_bump != m_bump_end) {
+            push_free(m_bump);
+            m_bump += sizeof(Node);
+        }
+        m_bump = first;
+        m_bump_end = first + links::chunk_nodes * sizeof(Node);
+    }
+
+public:
+    explicit node_arena(const Allocator& alloc) : m_alloc(alloc) {}
+
+    node_arena(const node_arena&) = delete;
+    node_arena& operator=(const node_arena&) = delete;
+
+    ~node_arena()
+    {
+        assert(m_in_use == 0);
+        for (std::byte* first : m_table) {
+            chunk_traits::deallocate(m_alloc, reinterpret_cast<chunk*>(header_of(first)), 1);
+        }
+    }
+
+    Allocator get_allocator() const noexcept
+    {
+        return Allocator(m_alloc);
+    }
+
+    Node* allocate()
+    {
+        void* ret;
+        if (m_free != nullptr) {
+            ret = m_free;
+            m_free = m_free->m_next;
+        } else {
+            if (m_bump == m_bump_end) {
+                add_chunk();
+            }
+            ret = m_bump;
+            m_bump += sizeof(Node);
+        }
+        m_in_use++;
+        return static_cast<Node*>(ret);
+    }
+
+    void deallocate(Node* ptr) noexcept
+    {
+        assert(m_in_use > 0);
+        push_free(ptr);
+        m_in_use--;
+    }
+
+    // Make sure count more nodes can be allocated without a new chunk.
+    void reserve(size_t count)
+    {
+        const size_t capacity = m_table.size() * links::chunk_nodes;
+        if (capacity - m_in_use >= count) {
+            return;
+        }
+        const size_t missing = count - (capacity - m_in_use);
+        for (size_t i = 0; i < (missing + links::chunk_nodes - 1) / links::chunk_nodes; i++) {
+            add_chunk();
+        }
+    }
+};
+
+/*
+    The node allocator of a container declared with indexed_by_compact.
+    Nodes come from a node_arena, whose chunks are allocated with the
+    container's Allocator. Copies share the arena and compare equal, and a
+    copied container gets an arena of its own. Node handles keep their arena
+    alive, but can only be inserted into containers which share it.
+*/
+template <typename Node, typename Allocator>
+class arena_allocator
+{
+    using arena_type = node_arena<Node, Allocator>;
+    std::shared_ptr<arena_type> m_arena;
+
+public:
+    using value_type = Node;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    explicit arena_allocator(const Allocator& alloc) : m_arena(std::make_shared<arena_type>(alloc)) {}
+
+    /* No move constructor: a moved-from allocator must still be usable, and
+       equal to the one it was moved into. */
+    arena_allocator(const arena_allocator&) noexcept = default;
+    arena_allocator& operator=(const arena_allocator&) noexcept = default;
+
+    arena_allocator select_on_container_copy_construction() const
+    {
+        return arena_allocator(std::allocator_traits<Allocator>::select_on_container_copy_construction(m_arena->get_allocator()));
+    }
+
+    operator Allocator() const noexcept
+    {
+        return m_arena->get_allocator();
+    }
+
+    [[nodiscard]] Node* allocate([[maybe_unused]] size_t count)
+    {
+        assert(count == 1);
+        return m_arena->allocate();
+    }
+
+    void deallocate(Node* ptr, [[maybe_unused]] size_t count) noexcept
+    {
+        assert(count == 1);
+        m_arena->deallocate(ptr);
+    }
+
+    void reserve(size_t count)
+    {
+        m_arena->reserve(count);
+    }
+
+    bool operator==(const arena_allocator& rhs) const noexcept
+    {
+        return m_arena == rhs.m_arena;
+    }
+};
+
+/* The allocator a container uses for its nodes: an arena_allocator when
+   they use 32-bit links, otherwise Allocator rebound to Node. */
+template <typename Allocator, typename Node>
+using node_allocator_t = std::conditional_t<Node::indices_type::compact_links,
+                                            arena_allocator<Node, Allocator>,
+                                            typename std::allocator_traits<Allocator>::template rebind_alloc<Node>>;
+
+} // namespace detail
+} // namespace tmi
+
+#endif // TMI_ARENA_H_
@@ -0,0 +1,1211 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TMI_BTREE_H_
+#define TMI_BTREE_H_
+
+#include "tmi_bulk.h"
+#include "tmi_nodehandle.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tmi {
+namespace detail {
+
+/* Common header of btree leaf and inner pages. Nodes point back to the leaf
+   holding them through this type, see tminode_base. */
+struct btree_page
+{
+    btree_page* m_parent{nullptr};
+    uint32_t m_count{0};
+    bool m_leaf{false};
+};
+
+} // namespace detail
+
+/*
+    An ordered index backed by a B+tree.
+
+    Leaves hold sorted arrays of node pointers and are linked to their
+    neighbours, so iteration walks contiguous memory. Inner pages hold their
+    children along with the smallest key below each of them. Keys which are
+    small and trivially copyable are copied into the pages so that a lookup
+    only touches the node it ends up at. Other keys are reached through a
+    pointer to the node holding them.
+
+    Each node stores a pointer to its leaf, so erasing or iterating from a
+    node doesn't require a search. Pages are cache-line aligned.
+*/
+template <typename T, typename Node, typename Comparator, typename Parent, typename Allocator, int I>
+class tmi_btree
+{
+public:
+    class iterator;
+
+    using node_type = Node;
+    using base_type = typename node_type::base_type;
+    using key_from_value = typename Comparator::key_from_value_type;
+    using key_compare = typename Comparator::comparator;
+    using key_type = typename key_from_value::result_type;
+    using ctor_args = std::tuple<key_from_value,key_compare>;
+    using allocator_type = Allocator;
+    using node_allocator_type = detail::node_allocator_t<Allocator, node_type>;
+    using node_handle = detail::node_handle<Allocator, Node>;
+    using insert_return_type = detail::insert_return_type<iterator, node_handle>;
+
+private:
+    static constexpr bool sorted_unique() { return Comparator::is_ordered_unique(); }
+    friend Parent;
+
+    static constexpr size_t leaf_capacity = 32;
+    static constexpr size_t inner_capacity = 32;
+    static constexpr size_t leaf_min = leaf_capacity / 2;
+    static constexpr size_t inner_min = inner_capacity / 2;
+
+    static constexpr bool caches_keys = std::is_trivially_copyable_v<key_type> && std::is_default_constructible_v<key_type> && sizeof(key_type) <= 16;
+    using sep_type = std::conditional_t<caches_keys, key_type, const node_type*>;
+
+    struct alignas(64) leaf_page : detail::btree_page
+    {
+        leaf_page* m_prev{nullptr};
+        leaf_page* m_next{nullptr};
+        std::array<node_type*, leaf_capacity> m_nodes;
+        [[no_unique_address]] std::conditional_t<caches_keys, std::array<key_type, leaf_capacity>, std::tuple<>> m_keys;
+    };
+
+    struct alignas(64) inner_page : detail::btree_page
+    {
+        std::array<detail::btree_page*, inner_capacity> m_children;
+        std::array<sep_type, inner_capacity> m_mins;
+    };
+
+    using leaf_allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<leaf_page>;
+    using inner_allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<inner_page>;
+
+    /* A slot in a leaf. m_pos may be one past the leaf's last slot. */
+    struct position {
+        leaf_page* m_leaf{nullptr};
+        size_t m_pos{0};
+    };
+    using insert_hints = position;
+
+    /* Filled in by erase_if_modified: an old neighbour, from whose leaf the
+       node is repositioned. */
+    struct premodify_cache {
+        const node_type* m_from{nullptr};
+    };
+    static constexpr bool requires_premodify_cache() { return false; }
+    using bulk_state = detail::sorted_bulk_state<node_type>;
+
+    Parent& m_parent;
+    leaf_allocator_type m_leaf_alloc;
+    inner_allocator_type m_inner_alloc;
+
+    detail::btree_page* m_root{nullptr};
+    leaf_page* m_first{nullptr};
+    leaf_page* m_last{nullptr};
+
+    /* Bumped whenever nodes may have moved between slots. Iterators use it to
+       tell whether their cached slot is still valid. */
+    size_t m_epoch{0};
+
+    key_from_value m_key_from_value;
+    key_compare m_comparator;
+
+    tmi_btree(Parent& parent, const allocator_type& alloc) : m_parent(parent), m_leaf_alloc(alloc), m_inner_alloc(alloc) {}
+
+    tmi_btree(Parent& parent, const allocator_type& alloc, const ctor_args& args) : m_parent(parent), m_leaf_alloc(alloc), m_inner_alloc(alloc), m_key_from_value(std::get<0>(args)), m_comparator(std::get<1>(args)){}
+    tmi_btree(Parent& parent, const tmi_btree& rhs) : m_parent(parent),
+        m_leaf_alloc(std::allocator_traits<leaf_allocator_type>::select_on_container_copy_construction(rhs.m_leaf_alloc)),
+        m_inner_alloc(std::allocator_traits<inner_allocator_type>::select_on_container_copy_construction(rhs.m_inner_alloc)),
+        m_key_from_value(rhs.m_key_from_value), m_comparator(rhs.m_comparator){}
+    tmi_btree(Parent& parent, tmi_btree&& rhs) : m_parent(parent), m_leaf_alloc(std::move(rhs.m_leaf_alloc)), m_inner_alloc(std::move(rhs.m_inner_alloc)),
+        m_root(rhs.m_root), m_first(rhs.m_first), m_last(rhs.m_last), m_key_from_value(std::move(rhs.m_key_from_value)), m_comparator(std::move(rhs.m_comparator))
+    {
+        rhs.m_root = nullptr;
+        rhs.m_first = rhs.m_last = nullptr;
+    }
+
+    static leaf_page* as_leaf(detail::btree_page* page)
+    {
+        assert(page->m_leaf);
+        return static_cast<leaf_page*>(page);
+    }
+
+    static const leaf_page* as_leaf(const detail::btree_page* page)
+    {
+        assert(page->m_leaf);
+        return static_cast<const leaf_page*>(page);
+    }
+
+    static inner_page* as_inner(detail::btree_page* page)
+    {
+        assert(!page->m_leaf);
+        return static_cast<inner_page*>(page);
+    }
+
+    static const inner_page* as_inner(const detail::btree_page* page)
+    {
+        assert(!page->m_leaf);
+        return static_cast<const inner_page*>(page);
+    }
+
+    static inner_page* parent_of(const detail::btree_page* page)
+    {
+        return static_cast<inner_page*>(page->m_parent);
+    }
+
+    static size_t child_position(const inner_page* parent, const detail::btree_page* child)
+    {
+        size_t pos = 0;
+        while (parent->m_children[pos] != child) {
+            pos++;
+            assert(pos < parent->m_count);
+        }
+        return pos;
+    }
+
+    static position locate(const node_type* node)
+    {
+        leaf_page* leaf = static_cast<leaf_page*>(node->get_base()->template btree_leaf<I>());
+        size_t pos = 0;
+        while (leaf->m_nodes[pos] != node) {
+            pos++;
+            assert(pos < leaf->m_count);
+        }
+        return {leaf, pos};
+    }
+
+    static position next_position(position pos)
+    {
+        if (pos.m_pos + 1 < pos.m_leaf->m_count) {
+            return {pos.m_leaf, pos.m_pos + 1};
+        }
+        return {pos.m_leaf->m_next, 0};
+    }
+
+    /* Leaves other than an empty root are never empty, so a position past the
+       end of a leaf can be moved to the start of the next one. */
+    static position normalize(position pos)
+    {
+        if (pos.m_leaf != nullptr && pos.m_pos == pos.m_leaf->m_count) {
+            return {pos.m_leaf->m_next, 0};
+        }
+        return pos;
+    }
+
+    decltype(auto) sep_key(const sep_type& sep) const
+    {
+        if constexpr (caches_keys) {
+            return (sep);
+        } else {
+            return m_key_from_value(sep->value());
+        }
+    }
+
+    decltype(auto) leaf_key(const leaf_page* leaf, size_t pos) const
+    {
+        if constexpr (caches_keys) {
+            return (leaf->m_keys[pos]);
+        } else {
+            return m_key_from_value(leaf->m_nodes[pos]->value());
+        }
+    }
+
+    static sep_type leaf_sep(const leaf_page* leaf, size_t pos)
+    {
+        if constexpr (caches_keys) {
+            return leaf->m_keys[pos];
+        } else {
+            return leaf->m_nodes[pos];
+        }
+    }
+
+    static sep_type page_min(const detail::btree_page* page)
+    {
+        if (page->m_leaf) {
+            return leaf_sep(as_leaf(page), 0);
+        }
+        return as_inner(page)->m_mins[0];
+    }
+
+    /* Whether an element with key elem belongs before the position being
+       searched for: the first element not less than key, or with Upper, the
+       first element greater than key. */
+    template <bool Upper, typename ElemKey, typename CompatibleKey>
+    bool before(const ElemKey& elem, const CompatibleKey& key) const
+    {
+        if constexpr (Upper) {
+            return !m_comparator(key, elem);
+        } else {
+            return m_comparator(elem, key);
+        }
+    }
+
+    template <bool Upper, typename CompatibleKey>
+    position search(const CompatibleKey& key) const
+    {
+        detail::btree_page* page = m_root;
+        if (page == nullptr) {
+            return {};
+        }
+        while (!page->m_leaf) {
+            const inner_page* inner = as_inner(page);
+            // The first child's min is never consulted; everything smaller
+            // than the second child's min belongs below the first child.
+            size_t lo = 1;
+            size_t hi = inner->m_count;
+            while (lo < hi) {
+                const size_t mid = lo + (hi - lo) / 2;
+                if (before<Upper>(sep_key(inner->m_mins[mid]), key)) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            page = inner->m_children[lo - 1];
+        }
+        leaf_page* leaf = as_leaf(page);
+        return {leaf, search_leaf<Upper>(leaf, key)};
+    }
+
+    template <bool Upper, typename CompatibleKey>
+    size_t search_leaf(const leaf_page* leaf, const CompatibleKey& key) const
+    {
+        size_t lo = 0;
+        size_t hi = leaf->m_count;
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+            if (before<Upper>(leaf_key(leaf, mid), key)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    /* As search, but first tries the leaf holding hint (the last leaf for a
+       null hint). Keys inside that leaf's range, or past the end of the last
+       leaf, are found without descending from the root. */
+    template <bool Upper, typename CompatibleKey>
+    position search_near(const node_type* hint, const CompatibleKey& key) const
+    {
+        if (m_root == nullptr) {
+            return {};
+        }
+        leaf_page* leaf = hint ? static_cast<leaf_page*>(hint->get_base()->template btree_leaf<I>()) : m_last;
+        if (before<Upper>(leaf_key(leaf, 0), key) &&
+            (leaf->m_next == nullptr || !before<Upper>(leaf_key(leaf, leaf->m_count - 1), key))) {
+            return {leaf, search_leaf<Upper>(leaf, key)};
+        }
+        return search<Upper>(key);
+    }
+
+    template <typename Array>
+    static void move_range(Array& src, size_t src_pos, Array& dst, size_t dst_pos, size_t count)
+    {
+        const auto first = src.begin() + static_cast<std::ptrdiff_t>(src_pos);
+        const auto last = first + static_cast<std::ptrdiff_t>(count);
+        if (&src == &dst && dst_pos > src_pos) {
+            std::copy_backward(first, last, dst.begin() + static_cast<std::ptrdiff_t>(dst_pos + count));
+        } else {
+            std::copy(first, last, dst.begin() + static_cast<std::ptrdiff_t>(dst_pos));
+        }
+    }
+
+    /* Move count slots between (or within) leaves, updating the nodes' leaf
+       pointers. Counts are left to the caller. */
+    static void move_slots(leaf_page* src, size_t src_pos, leaf_page* dst, size_t dst_pos, size_t count)
+    {
+        move_range(src->m_nodes, src_pos, dst->m_nodes, dst_pos, count);
+        if constexpr (caches_keys) {
+            move_range(src->m_keys, src_pos, dst->m_keys, dst_pos, count);
+        }
+        if (src != dst) {
+            for (size_t i = dst_pos; i < dst_pos + count; i++) {
+                dst->m_nodes[i]->get_base()->template set_btree_leaf<I>(dst);
+            }
+        }
+    }
+
+    static void move_children(inner_page* src, size_t src_pos, inner_page* dst, size_t dst_pos, size_t count)
+    {
+        move_range(src->m_children, src_pos, dst->m_children, dst_pos, count);
+        move_range(src->m_mins, src_pos, dst->m_mins, dst_pos, count);
+        if (src != dst) {
+            for (size_t i = dst_pos; i < dst_pos + count; i++) {
+                dst->m_children[i]->m_parent = dst;
+            }
+        }
+    }
+
+    void set_slot(leaf_page* leaf, size_t pos, node_type* node)
+    {
+        leaf->m_nodes[pos] = node;
+        if constexpr (caches_keys) {
+            leaf->m_keys[pos] = m_key_from_value(node->value());
+        }
+        node->get_base()->template set_btree_leaf<I>(leaf);
+    }
+
+    leaf_page* new_leaf()
+    {
+        leaf_page* leaf = std::allocator_traits<leaf_allocator_type>::allocate(m_leaf_alloc, 1);
+        std::allocator_traits<leaf_allocator_type>::construct(m_leaf_alloc, leaf);
+        leaf->m_leaf = true;
+        return leaf;
+    }
+
+    inner_page* new_inner()
+    {
+        inner_page* inner = std::allocator_traits<inner_allocator_type>::allocate(m_inner_alloc, 1);
+        std::allocator_traits<inner_allocator_type>::construct(m_inner_alloc, inner);
+        return inner;
+    }
+
+    void free_leaf(leaf_page* leaf)
+    {
+        std::allocator_traits<leaf_allocator_type>::destroy(m_leaf_alloc, leaf);
+        std::allocator_traits<leaf_allocator_type>::deallocate(m_leaf_alloc, leaf, 1);
+    }
+
+    void free_inner(inner_page* inner)
+    {
+        std::allocator_traits<inner_allocator_type>::destroy(m_inner_alloc, inner);
+        std::allocator_traits<inner_allocator_type>::deallocate(m_inner_alloc, inner, 1);
+    }
+
+    void free_page(detail::btree_page* page)
+    {
+        if (page->m_leaf) {
+            free_leaf(as_leaf(page));
+            return;
+        }
+        inner_page* inner = as_inner(page);
+        for (size_t i = 0; i < inner->m_count; i++) {
+            free_page(inner->m_children[i]);
+        }
+        free_inner(inner);
+    }
+
+    /* Propagate a change of page's smallest key to its ancestors. Only the
+       first child of a page contributes to that page's min. */
+    static void update_min(detail::btree_page* page)
+    {
+        const sep_type min = page_min(page);
+        for (inner_page* parent = parent_of(page); parent != nullptr; page = parent, parent = parent_of(parent)) {
+            const size_t pos = child_position(parent, page);
+            parent->m_mins[pos] = min;
+            if (pos != 0) break;
+        }
+    }
+
+    /* Link right into left's parent directly after left, splitting the
+       parent or growing a new root as needed. */
+    void insert_child(detail::btree_page* left, detail::btree_page* right)
+    {
+        inner_page* parent = parent_of(left);
+        if (parent == nullptr) {
+            parent = new_inner();
+            parent->m_children[0] = left;
+            parent->m_mins[0] = page_min(left);
+            parent->m_count = 1;
+            left->m_parent = parent;
+            m_root = parent;
+        } else if (parent->m_count == inner_capacity) {
+            split_inner(parent);
+            parent = parent_of(left);
+        }
+        const size_t pos = child_position(parent, left) + 1;
+        move_children(parent, pos, parent, pos + 1, parent->m_count - pos);
+        parent->m_children[pos] = right;
+        parent->m_mins[pos] = page_min(right);
+        right->m_parent = parent;
+        parent->m_count++;
+    }
+
+    void split_inner(inner_page* inner)
+    {
+        inner_page* right = new_inner();
+        const size_t keep = inner->m_count / 2;
+        move_children(inner, keep, right, 0, inner->m_count - keep);
+        right->m_count = inner->m_count - static_cast<uint32_t>(keep);
+        inner->m_count = static_cast<uint32_t>(keep);
+        insert_child(inner, right);
+    }
+
+    leaf_page* split_leaf(leaf_page* leaf)
+    {
+        leaf_page* right = new_leaf();
+        const size_t keep = leaf->m_count / 2;
+        move_slots(leaf, keep, right, 0, leaf->m_count - keep);
+        right->m_count = leaf->m_count - static_cast<uint32_t>(keep);
+        leaf->m_count = static_cast<uint32_t>(keep);
+
+        right->m_prev = leaf;
+        right->m_next = leaf->m_next;
+        if (leaf->m_next != nullptr) {
+            leaf->m_next->m_prev = right;
+        } else {
+            m_last = right;
+        }
+        leaf->m_next = right;
+
+        insert_child(leaf, right);
+        return right;
+    }
+
+    void insert_at(position pos, node_type* node)
+    {
+        m_epoch++;
+        leaf_page* leaf = pos.m_leaf;
+        size_t index = pos.m_pos;
+        if (leaf == nullptr) {
+            assert(m_root == nullptr);
+            leaf = new_leaf();
+            m_root = m_first = m_last = leaf;
+            index = 0;
+        } else if (leaf->m_count == leaf_capacity) {
+            leaf_page* right = split_leaf(leaf);
+            if (index > leaf->m_count) {
+                index -= leaf->m_count;
+                leaf = right;
+            }
+        }
+        move_slots(leaf, index, leaf, index + 1, leaf->m_count - index);
+        set_slot(leaf, index, node);
+        leaf->m_count++;
+        if (index == 0) {
+            update_min(leaf);
+        }
+    }
+
+    /* Remove the child at pos, which is never the first, and fix up any
+       resulting underflow. */
+    void remove_child(inner_page* inner, size_t pos)
+    {
+        assert(pos > 0);
+        move_children(inner, pos + 1, inner, pos, inner->m_count - pos - 1);
+        inner->m_count--;
+        if (inner == m_root) {
+            if (inner->m_count == 1) {
+                m_root = inner->m_children[0];
+                m_root->m_parent = nullptr;
+                free_inner(inner);
+            }
+            return;
+        }
+        if (inner->m_count < inner_min) {
+            rebalance_inner(inner);
+        }
+    }
+
+    void merge_inners(inner_page* left, inner_page* right)
+    {
+        move_children(right, 0, left, left->m_count, right->m_count);
+        left->m_count += right->m_count;
+        inner_page* parent = parent_of(right);
+        const size_t pos = child_position(parent, right);
+        free_inner(right);
+        remove_child(parent, pos);
+    }
+
+    /* Borrow a child from a sibling if it can spare one, otherwise merge
+       with it. */
+    void rebalance_inner(inner_page* inner)
+    {
+        inner_page* parent = parent_of(inner);
+        const size_t pos = child_position(parent, inner);
+        if (pos > 0) {
+            inner_page* left = as_inner(parent->m_children[pos - 1]);
+            if (left->m_count > inner_min) {
+                move_children(inner, 0, inner, 1, inner->m_count);
+                move_children(left, left->m_count - 1, inner, 0, 1);
+                left->m_count--;
+                inner->m_count++;
+                parent->m_mins[pos] = inner->m_mins[0];
+            } else {
+                merge_inners(left, inner);
+            }
+        } else {
+            inner_page* right = as_inner(parent->m_children[1]);
+            if (right->m_count > inner_min) {
+                move_children(right, 0, inner, inner->m_count, 1);
+                move_children(right, 1, right, 0, right->m_count - 1);
+                right->m_count--;
+                inner->m_count++;
+                parent->m_mins[1] = right->m_mins[0];
+            } else {
+                merge_inners(inner, right);
+            }
+        }
+    }
+
+    void merge_leaves(leaf_page* left, leaf_page* right)
+    {
+        const bool left_was_empty = left->m_count == 0;
+        move_slots(right, 0, left, left->m_count, right->m_count);
+        left->m_count += right->m_count;
+        left->m_next = right->m_next;
+        if (right->m_next != nullptr) {
+            right->m_next->m_prev = left;
+        } else {
+            m_last = left;
+        }
+        if (left_was_empty) {
+            update_min(left);
+        }
+        inner_page* parent = parent_of(right);
+        const size_t pos = child_position(parent, right);
+        free_leaf(right);
+        remove_child(parent, pos);
+    }
+
+    void rebalance_leaf(leaf_page* leaf)
+    {
+        inner_page* parent = parent_of(leaf);
+        const size_t pos = child_position(parent, leaf);
+        if (pos > 0) {
+            leaf_page* left = as_leaf(parent->m_children[pos - 1]);
+            if (left->m_count > leaf_min) {
+                move_slots(leaf, 0, leaf, 1, leaf->m_count);
+                move_slots(left, left->m_count - 1, leaf, 0, 1);
+                left->m_count--;
+                leaf->m_count++;
+                parent->m_mins[pos] = leaf_sep(leaf, 0);
+            } else {
+                merge_leaves(left, leaf);
+            }
+        } else {
+            leaf_page* right = as_leaf(parent->m_children[1]);
+            if (right->m_count > leaf_min) {
+                move_slots(right, 0, leaf, leaf->m_count, 1);
+                move_slots(right, 1, right, 0, right->m_count - 1);
+                right->m_count--;
+                leaf->m_count++;
+                parent->m_mins[1] = leaf_sep(right, 0);
+                if (leaf->m_count == 1) {
+                    update_min(leaf);
+                }
+            } else {
+                merge_leaves(leaf, right);
+            }
+        }
+    }
+
+    void erase_at(position pos)
+    {
+        m_epoch++;
+        leaf_page* leaf = pos.m_leaf;
+        move_slots(leaf, pos.m_pos + 1, leaf, pos.m_pos, leaf->m_count - pos.m_pos - 1);
+        leaf->m_count--;
+        if (leaf == m_root) {
+            if (leaf->m_count == 0) {
+                free_leaf(leaf);
+                m_root = m_first = m_last = nullptr;
+            }
+            return;
+        }
+        if (pos.m_pos == 0 && leaf->m_count != 0) {
+            update_min(leaf);
+        }
+        if (leaf->m_count < leaf_min) {
+            rebalance_leaf(leaf);
+        }
+    }
+
+    void remove_node(node_type* node)
+    {
+        erase_at(locate(node));
+    }
+
+    /* Copy rhs's pages, swapping in the copies of its nodes. */
+    template <typename Map>
+    void clone_from(const tmi_btree& rhs, const Map& copies)
+    {
+        if (rhs.m_root == nullptr) {
+            return;
+        }
+        leaf_page* prev_leaf = nullptr;
+        m_root = clone_page(rhs.m_root, nullptr, prev_leaf, copies);
+        m_last = prev_leaf;
+    }
+
+    /* Leaves are visited in order; prev_leaf is the last one cloned. */
+    template <typename Map>
+    detail::btree_page* clone_page(const detail::btree_page* src, detail::btree_page* parent, leaf_page*& prev_leaf, const Map& copies)
+    {
+        if (src->m_leaf) {
+            const leaf_page* src_leaf = as_leaf(src);
+            leaf_page* leaf = new_leaf();
+            leaf->m_parent = parent;
+            leaf->m_count = src_leaf->m_count;
+            for (size_t i = 0; i < src_leaf->m_count; i++) {
+                node_type* node = copies(src_leaf->m_nodes[i]);
+                leaf->m_nodes[i] = node;
+                node->get_base()->template set_btree_leaf<I>(leaf);
+            }
+            if constexpr (caches_keys) {
+                leaf->m_keys = src_leaf->m_keys;
+            }
+            leaf->m_prev = prev_leaf;
+            if (prev_leaf != nullptr) {
+                prev_leaf->m_next = leaf;
+            } else {
+                m_first = leaf;
+            }
+            prev_leaf = leaf;
+            return leaf;
+        }
+        const inner_page* src_inner = as_inner(src);
+        inner_page* inner = new_inner();
+        inner->m_parent = parent;
+        inner->m_count = src_inner->m_count;
+        for (size_t i = 0; i < src_inner->m_count; i++) {
+            inner->m_children[i] = clone_page(src_inner->m_children[i], inner, prev_leaf, copies);
+            if constexpr (caches_keys) {
+                inner->m_mins[i] = src_inner->m_mins[i];
+            } else {
+                inner->m_mins[i] = copies(src_inner->m_mins[i]);
+            }
+        }
+        return inner;
+    }
+
+    node_type* preinsert_node(const T& value, insert_hints& hints)
+    {
+        return preinsert_node<false>(value, hints, nullptr);
+    }
+
+    /* A hinted insert places the node just before hint (nullptr meaning the
+       end) when it belongs there. Otherwise the search starts from the
+       hint's leaf. */
+    template <bool Hinted = true>
+    node_type* preinsert_node(const T& value, insert_hints& hints, const node_type* hint)
+    {
+        const auto& key = m_key_from_value(value);
+        constexpr bool upper = !sorted_unique();
+        if constexpr (Hinted) {
+            if (m_root != nullptr) {
+                const position next = hint ? locate(hint) : position{m_last, m_last->m_count};
+                position prev{};
+                if (next.m_pos > 0) {
+                    prev = {next.m_leaf, next.m_pos - 1};
+                } else if (next.m_leaf->m_prev != nullptr) {
+                    prev = {next.m_leaf->m_prev, next.m_leaf->m_prev->m_count - 1};
+                }
+                if ((prev.m_leaf == nullptr || before<upper>(leaf_key(prev.m_leaf, prev.m_pos), key)) &&
+                    (hint == nullptr || !before<!upper>(leaf_key(next.m_leaf, next.m_pos), key))) {
+                    hints = next;
+                    return nullptr;
+                }
+            }
+        }
+        hints = Hinted ? search_near<upper>(hint, key) : search<upper>(key);
+        if constexpr (sorted_unique()) {
+            const position next = normalize(hints);
+            if (next.m_leaf != nullptr && !m_comparator(key, leaf_key(next.m_leaf, next.m_pos))) {
+                return next.m_leaf->m_nodes[next.m_pos];
+            }
+        }
+        return nullptr;
+    }
+
+    void insert_node(node_type* node, const insert_hints& hints)
+    {
+        insert_at(hints, node);
+    }
+
+    /* Whether the node at pos, now with key, no longer fits between its
+       neighbours. For unique indices a key equal to a neighbour's is a
+       conflict which must be detected by re-inserting. */
+    template <typename CompatibleKey>
+    bool needs_resort(const position& pos, const CompatibleKey& key) const
+    {
+        position prev{};
+        if (pos.m_pos > 0) {
+            prev = {pos.m_leaf, pos.m_pos - 1};
+        } else if (pos.m_leaf->m_prev != nullptr) {
+            prev = {pos.m_leaf->m_prev, pos.m_leaf->m_prev->m_count - 1};
+        }
+        const position next = normalize({pos.m_leaf, pos.m_pos + 1});
+
+        if constexpr (sorted_unique()) {
+            return ((next.m_leaf != nullptr && !m_comparator(key, leaf_key(next.m_leaf, next.m_pos))) ||
+                    (prev.m_leaf != nullptr && !m_comparator(leaf_key(prev.m_leaf, prev.m_pos), key)));
+        } else {
+            return ((next.m_leaf != nullptr && m_comparator(leaf_key(next.m_leaf, next.m_pos), key)) ||
+                    (prev.m_leaf != nullptr && m_comparator(key, leaf_key(prev.m_leaf, prev.m_pos))));
+        }
+    }
+
+    bool erase_if_modified(node_type* node, premodify_cache& cache)
+    {
+        const position pos = locate(node);
+        const auto& key = m_key_from_value(node->value());
+        if (needs_resort(pos, key)) {
+            const position next = normalize({pos.m_leaf, pos.m_pos + 1});
+            if (next.m_leaf != nullptr) {
+                cache.m_from = next.m_leaf->m_nodes[next.m_pos];
+            } else if (pos.m_pos > 0) {
+                cache.m_from = pos.m_leaf->m_nodes[pos.m_pos - 1];
+            } else if (pos.m_leaf->m_prev != nullptr) {
+                cache.m_from = pos.m_leaf->m_prev->m_nodes[pos.m_leaf->m_prev->m_count - 1];
+            }
+            erase_at(pos);
+            return true;
+        }
+        if constexpr (caches_keys) {
+            pos.m_leaf->m_keys[pos.m_pos] = key;
+            if (pos.m_pos == 0) {
+                update_min(pos.m_leaf);
+            }
+        }
+        return false;
+    }
+
+    /* Find where a node removed by erase_if_modified now belongs, searching
+       from the leaf of its old neighbour. */
+    node_type* preinsert_modified(const node_type* node, const premodify_cache& cache, insert_hints& hints)
+    {
+        if (cache.m_from == nullptr) {
+            return preinsert_node(node->value(), hints);
+        }
+        return preinsert_node(node->value(), hints, cache.m_from);
+    }
+
+    /* Whether node is still where its key belongs, and any copy of its key
+       in the pages is still equivalent. For checking modify()
+       declarations. */
+    bool unmodified(const node_type* node) const
+    {
+        const position pos = locate(node);
+        const auto& key = m_key_from_value(node->value());
+        if constexpr (caches_keys) {
+            const auto& cached = pos.m_leaf->m_keys[pos.m_pos];
+            return !m_comparator(key, cached) && !m_comparator(cached, key);
+        } else {
+            return !needs_resort(pos, key);
+        }
+    }
+
+    void bulk_prepare(const std::vector<node_type*>& nodes, bulk_state& state)
+    {
+        state.template prepare<sorted_unique()>(nodes, m_key_from_value, m_comparator);
+    }
+
+    node_type* bulk_preinsert(const node_type* node, size_t pos, bulk_state& state, insert_hints& hints)
+    {
+        if constexpr (sorted_unique()) {
+            if (node_type* conflict = state.conflict(pos)) {
+                return conflict;
+            }
+            return preinsert_node(node->value(), hints);
+        }
+        return nullptr;
+    }
+
+    void bulk_insert(node_type* node, size_t pos, bulk_state& state, const insert_hints&)
+    {
+        if constexpr (sorted_unique()) {
+            state.accept(pos, node);
+        }
+    }
+
+    /* Link the accepted part of the batch in key order. Elements past the
+       current last one are appended to the last leaf without a search. */
+    void bulk_finish(const std::vector<node_type*>& nodes, const std::vector<bool>& accepted, bulk_state& state)
+    {
+        for (size_t pos : state.m_order) {
+            if (accepted[pos]) {
+                insert_hints hints;
+                preinsert_node(nodes[pos]->value(), hints, nullptr);
+                insert_node(nodes[pos], hints);
+            }
+        }
+    }
+
+    void do_clear()
+    {
+        if (m_root != nullptr) {
+            free_page(m_root);
+        }
+        m_root = nullptr;
+        m_first = m_last = nullptr;
+        m_epoch++;
+    }
+
+    /* Clear the index, passing each node to destroy. */
+    template <typename Destroy>
+    void do_clear(Destroy&& destroy)
+    {
+        for (const leaf_page* leaf = m_first; leaf != nullptr; leaf = leaf->m_next) {
+            for (size_t i = 0; i < leaf->m_count; i++) {
+                destroy(leaf->m_nodes[i]);
+            }
+        }
+        do_clear();
+    }
+
+public:
+
+    class iterator
+    {
+        const node_type* m_node{};
+        const tmi_btree* m_index{};
+        const leaf_page* m_leaf{};
+        size_t m_pos{0};
+        size_t m_epoch{0};
+        iterator(const node_type* node, const tmi_btree* index) : m_node(node), m_index(index){}
+        iterator(position pos, const tmi_btree* index) : m_node(pos.m_leaf->m_nodes[pos.m_pos]), m_index(index), m_leaf(pos.m_leaf), m_pos(pos.m_pos), m_epoch(index->m_epoch){}
+        friend tmi_btree;
+
+        /* Re-find the node's slot if nodes may have moved since it was
+           cached. */
+        void reposition()
+        {
+            if (m_leaf == nullptr || m_epoch != m_index->m_epoch) {
+                const position pos = locate(m_node);
+                m_leaf = pos.m_leaf;
+                m_pos = pos.m_pos;
+                m_epoch = m_index->m_epoch;
+            }
+        }
+    public:
+        typedef const T value_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+        typedef std::ptrdiff_t difference_type;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using element_type = const T;
+        iterator() = default;
+        const T& operator*() const { return m_node->value(); }
+        const T* operator->() const { return &m_node->value(); }
+        iterator& operator++()
+        {
+            reposition();
+            if (m_pos + 1 < m_leaf->m_count) {
+                m_pos++;
+            } else if (m_leaf->m_next != nullptr) {
+                m_leaf = m_leaf->m_next;
+                m_pos = 0;
+            } else {
+                m_node = nullptr;
+                m_leaf = nullptr;
+                return *this;
+            }
+            m_node = m_leaf->m_nodes[m_pos];
+            return *this;
+        }
+        iterator& operator--()
+        {
+            if (m_node) {
+                reposition();
+                if (m_pos > 0) {
+                    m_pos--;
+                } else if (m_leaf->m_prev != nullptr) {
+                    m_leaf = m_leaf->m_prev;
+                    m_pos = m_leaf->m_count - 1;
+                } else {
+                    m_node = nullptr;
+                    m_leaf = nullptr;
+                    return *this;
+                }
+            } else {
+                m_leaf = m_index->m_last;
+                assert(m_leaf);
+                m_pos = m_leaf->m_count - 1;
+                m_epoch = m_index->m_epoch;
+            }
+            m_node = m_leaf->m_nodes[m_pos];
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator copy(*this);
+            ++(*this);
+            return copy;
+        }
+        iterator operator--(int)
+        {
+            iterator copy(*this);
+            --(*this);
+            return copy;
+        }
+        bool operator==(iterator rhs) const { return m_node == rhs.m_node; }
+        bool operator!=(iterator rhs) const { return m_node != rhs.m_node; }
+    };
+    using const_iterator = iterator;
+
+    template <typename... Args>
+    std::pair<iterator,bool> emplace(Args&&... args)
+    {
+        auto [node, success] = m_parent.do_emplace(std::forward<Args>(args)...);
+        return std::make_pair(make_iterator(node), success);
+    }
+
+    /* Emplace an element constructed from args, which must have key as its
+       key in this index, unless this index already holds an equal key.
+       Nothing is allocated or constructed in that case. */
+    template <typename... Args>
+    std::pair<iterator,bool> try_emplace(const key_type& key, Args&&... args) requires (sorted_unique())
+    {
+        const iterator it = find(key);
+        if (it != end()) {
+            return std::make_pair(it, false);
+        }
+        return emplace(std::forward<Args>(args)...);
+    }
+
+    /* The value is checked against every index before a node is allocated
+       for it, so rejecting a duplicate costs no allocation. */
+    std::pair<iterator,bool> insert(const T& value)
+    {
+        auto [node, success] = m_parent.do_insert_value(value);
+        return std::make_pair(make_iterator(node), success);
+    }
+
+    std::pair<iterator,bool> insert(T&& value)
+    {
+        auto [node, success] = m_parent.do_insert_value(std::move(value));
+        return std::make_pair(make_iterator(node), success);
+    }
+
+    template <typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args)
+    {
+        return make_iterator(m_parent.template do_emplace_hint<I>(hint.m_node, std::forward<Args>(args)...).first);
+    }
+
+    iterator insert(const_iterator hint, const T& value)
+    {
+        return make_iterator(m_parent.template do_insert_hint<I>(hint.m_node, value).first);
+    }
+
+    /* Insert a range of elements, skipping any which conflict with an
+       existing or earlier element. Much faster than inserting one at a time
+       for large ranges, see multi_index_container::do_insert_range. */
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        m_parent.do_insert_range(first, last);
+    }
+
+    /* Replace the contents with a range of elements. */
+    template <typename InputIt>
+    void assign(InputIt first, InputIt last)
+    {
+        m_parent.do_clear();
+        m_parent.do_insert_range(first, last);
+    }
+
+    template <typename Range>
+    void assign(const Range& range)
+    {
+        assign(std::begin(range), std::end(range));
+    }
+
+    iterator begin() const
+    {
+        if (m_first == nullptr)
+            return end();
+        return make_iterator(position{m_first, 0});
+    }
+
+    iterator end() const
+    {
+        return make_iterator(nullptr);
+    }
+
+    iterator iterator_to(const T& entry) const
+    {
+        const node_type* node = &node_type::node_cast(entry);
+        return make_iterator(node);
+    }
+
+    template <typename Callable>
+    bool modify(iterator it, Callable&& func)
+    {
+        node_type* node = const_cast<node_type*>(it.m_node);
+        if (!node) return false;
+        return m_parent.do_modify(node, std::forward<Callable>(func));
+    }
+
+    /* As above, declaring that func only changes the keys of the listed
+       indices, by number or by tag. The other indices skip all of their
+       modify() work. For augmented indices, a change to the aggregated
+       value counts as a key change. Debug builds assert the declaration. */
+    template <int Modified, int... MoreModified, typename Callable>
+    bool modify(iterator it, Callable&& func)
+    {
+        node_type* node = const_cast<node_type*>(it.m_node);
+        if (!node) return false;
+        return m_parent.template do_modify<std::integer_sequence<int, Modified, MoreModified...>>(node, std::forward<Callable>(func));
+    }
+
+    template <typename Tag, typename... MoreTags, typename Callable>
+    bool modify(iterator it, Callable&& func)
+    {
+        return modify<static_cast<int>(Parent::template index_v<Tag>), static_cast<int>(Parent::template index_v<MoreTags>)...>(it, std::forward<Callable>(func));
+    }
+
+    template<typename CompatibleKey>
+    iterator find(const CompatibleKey& key) const
+    {
+        const position pos = normalize(search<false>(key));
+        if (pos.m_leaf == nullptr || m_comparator(key, leaf_key(pos.m_leaf, pos.m_pos))) {
+            return end();
+        }
+        return make_iterator(pos);
+    }
+
+    template<typename CompatibleKey>
+    iterator find(const_iterator hint, const CompatibleKey& key) const
+    {
+        const position pos = normalize(search_near<false>(hint.m_node, key));
+        if (pos.m_leaf == nullptr || m_comparator(key, leaf_key(pos.m_leaf, pos.m_pos))) {
+            return end();
+        }
+        return make_iterator(pos);
+    }
+
+    template<typename CompatibleKey>
+    iterator lower_bound(const CompatibleKey& key) const
+    {
+        const position pos = normalize(search<false>(key));
+        if (pos.m_leaf == nullptr) {
+            return end();
+        }
+        return make_iterator(pos);
+    }
+
+    template<typename CompatibleKey>
+    iterator upper_bound(const CompatibleKey& key) const
+    {
+        const position pos = normalize(search<true>(key));
+        if (pos.m_leaf == nullptr) {
+            return end();
+        }
+        return make_iterator(pos);
+    }
+
+    template<typename CompatibleKey>
+    std::pair<iterator, iterator> equal_range(const CompatibleKey& key) const
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    template<typename CompatibleKey>
+    size_t count(const CompatibleKey& key) const
+    {
+        size_t ret = 0;
+        for (position pos = normalize(search<false>(key)); pos.m_leaf != nullptr && !m_comparator(key, leaf_key(pos.m_leaf, pos.m_pos)); pos = next_position(pos)) {
+            ret++;
+            if constexpr (sorted_unique()) break;
+        }
+        return ret;
+    }
+
+    iterator erase(iterator it)
+    {
+        node_type* node = const_cast<node_type*>(it.m_node);
+        iterator next = it;
+        ++next;
+        m_parent.do_erase(node);
+        return make_iterator(next.m_node);
+    }
+
+    iterator erase(iterator first, iterator last)
+    {
+        while (first != last) {
+            first = erase(first);
+        }
+        return last;
+    }
+
+    size_t erase(const key_type& key)
+    {
+        size_t ret = 0;
+        iterator it = lower_bound(key);
+        while (it != end() && !m_comparator(key, m_key_from_value(*it))) {
+            it = erase(it);
+            ret++;
+        }
+        return ret;
+    }
+
+    void clear()
+    {
+        m_parent.do_clear();
+    }
+
+    size_t size() const
+    {
+        return m_parent.get_size();
+    }
+
+    bool empty() const
+    {
+        return m_parent.get_empty();
+    }
+
+    insert_return_type insert(node_handle&& handle)
+    {
+        node_type* node = handle.m_node;
+        if(!node) {
+            return {end(), false, {}};
+        }
+        // The node must have come from this container's allocator.
+        assert(*handle.m_alloc == m_parent.m_alloc);
+        node_type* conflict = m_parent.do_insert(node);
+        if (conflict) {
+            return {make_iterator(conflict), false, std::move(handle)};
+        }
+        handle.m_node = nullptr;
+        return {make_iterator(node), true, {}};
+    }
+
+    node_handle extract(const_iterator it)
+    {
+        return m_parent.do_extract(const_cast<node_type*>(it.m_node));
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return m_parent.get_allocator();
+    }
+
+private:
+
+    const node_type* node_from_iterator(iterator it) const
+    {
+        return it.m_node;
+    }
+
+    iterator make_iterator(const node_type* node) const
+    {
+        return iterator(node, this);
+    }
+
+    iterator make_iterator(position pos) const
+    {
+        return iterator(pos, this);
+    }
+
+};
+
+} // namespace tmi
+
+#endif // TMI_BTREE_H_
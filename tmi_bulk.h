@@ -0,0 +1,91 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TMI_BULK_H_
+#define TMI_BULK_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tmi {
+namespace detail {
+
+/*
+    Per-index state for a bulk insert into a sorted index.
+
+    The batch is sorted once up front. Elements are then accepted or rejected
+    in batch order, exactly as if they were inserted one at a time: for a
+    unique index, an element conflicts with the first element accepted from
+    its run of equal keys. Once every index has had its say, the accepted
+    elements are linked in key order.
+*/
+template <typename Node>
+struct sorted_bulk_state
+{
+    // Batch positions in key order, equal keys in batch order.
+    std::vector<size_t> m_order;
+    // Unique indices only: the run of equal keys each batch position is in,
+    // and the element accepted from each run so far.
+    std::vector<size_t> m_run;
+    std::vector<Node*> m_run_node;
+
+    template <bool Unique, typename KeyFromValue, typename Compare>
+    void prepare(const std::vector<Node*>& nodes, const KeyFromValue& key_from_value, const Compare& comp)
+    {
+        using key_type = std::remove_cvref_t<decltype(key_from_value(nodes[0]->value()))>;
+        m_order.resize(nodes.size());
+        if constexpr (std::is_trivially_copyable_v<key_type> && sizeof(key_type) <= 16) {
+            // Sort copies of small keys, rather than chasing a pointer to
+            // each node for every comparison.
+            std::vector<std::pair<key_type, size_t>> keyed;
+            keyed.reserve(nodes.size());
+            for (size_t i = 0; i < nodes.size(); i++) {
+                keyed.emplace_back(key_from_value(nodes[i]->value()), i);
+            }
+            std::sort(keyed.begin(), keyed.end(), [&](const auto& lhs, const auto& rhs) {
+                if (comp(lhs.first, rhs.first)) return true;
+                if (comp(rhs.first, lhs.first)) return false;
+                return lhs.second < rhs.second;
+            });
+            for (size_t i = 0; i < keyed.size(); i++) {
+                m_order[i] = keyed[i].second;
+            }
+        } else {
+            std::iota(m_order.begin(), m_order.end(), size_t{0});
+            std::stable_sort(m_order.begin(), m_order.end(), [&](size_t lhs, size_t rhs) {
+                return comp(key_from_value(nodes[lhs]->value()), key_from_value(nodes[rhs]->value()));
+            });
+        }
+        if constexpr (Unique) {
+            m_run.resize(nodes.size());
+            size_t run = 0;
+            for (size_t i = 0; i < m_order.size(); i++) {
+                if (i > 0 && comp(key_from_value(nodes[m_order[i - 1]]->value()), key_from_value(nodes[m_order[i]]->value()))) {
+                    run++;
+                }
+                m_run[m_order[i]] = run;
+            }
+            m_run_node.assign(m_order.empty() ? 0 : run + 1, nullptr);
+        }
+    }
+
+    Node* conflict(size_t pos) const
+    {
+        return m_run_node[m_run[pos]];
+    }
+
+    void accept(size_t pos, Node* node)
+    {
+        m_run_node[m_run[pos]] = node;
+    }
+};
+
+} // namespace detail
+} // namespace tmi
+
+#endif // TMI_BULK_H_
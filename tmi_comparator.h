@@ -2,23 +2,33 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-// Parts of this file have been copied from LLVM's libc++ and modified
-// to work here. Their license applies to those functions. They are intended
-// to serve only as a proof of concept for the red-black tree and should be
-// rewritten asap.
-
 #ifndef TMI_COMPARATOR_H_
 #define TMI_COMPARATOR_H_
 
+#include "tmi_bulk.h"
 #include "tmi_nodehandle.h"
+#include "tmi_tree.h"
 
 #include <cassert>
+#include <concepts>
 #include <cstddef>
 #include <iterator>
 #include <utility>
 #include <tuple>
+#include <type_traits>
+#include <vector>
 
 namespace tmi {
+namespace detail {
+
+template <typename Comparator, int I>
+struct ordered_augment { using type = wavl_no_augment; };
+template <typename Comparator, int I> requires std::is_base_of_v<ranked_type, Comparator>
+struct ordered_augment<Comparator, I> { using type = wavl_subtree_size<I>; };
+template <typename Comparator, int I> requires std::is_base_of_v<augmented_type, Comparator>
+struct ordered_augment<Comparator, I> { using type = wavl_aggregate<I, typename Comparator::aggregate_type>; };
+
+} // namespace detail
 
 template <typename T, typename Node, typename Comparator, typename Parent, typename Allocator, int I>
 class tmi_comparator
@@ -28,18 +38,19 @@ public:
 
     using node_type = Node;
     using base_type = typename node_type::base_type;
-    using Color = typename base_type::Color;
     using key_from_value = typename Comparator::key_from_value_type;
     using key_compare = typename Comparator::comparator;
     using key_type = typename key_from_value::result_type;
     using ctor_args = std::tuple<key_from_value,key_compare>;
     using allocator_type = Allocator;
-    using node_allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<node_type>;
+    using node_allocator_type = detail::node_allocator_t<Allocator, node_type>;
     using node_handle = detail::node_handle<Allocator, Node>;
     using insert_return_type = detail::insert_return_type<iterator, node_handle>;
 
 private:
     static constexpr bool sorted_unique() { return Comparator::is_ordered_unique(); }
+    static constexpr bool ranked() { return std::is_base_of_v<detail::ranked_type, Comparator>; }
+    static constexpr bool augmented() { return std::is_base_of_v<detail::augmented_type, Comparator>; }
     friend Parent;
 
     struct insert_hints {
@@ -47,602 +58,587 @@ private:
         bool m_inserted_left{false};
     };
 
-    struct premodify_cache{};
+    /* Filled in by erase_if_modified: the old neighbour on the side the
+       key moved towards, from which the node is repositioned. */
+    struct premodify_cache {
+        base_type* m_from{nullptr};
+        bool m_moved_right{false};
+    };
     static constexpr bool requires_premodify_cache() { return false; }
 
+    /* How many neighbours a repositioning modify looks at before it
+       searches from the root instead. */
+    static constexpr int reposition_steps = 4;
+    using bulk_state = detail::sorted_bulk_state<node_type>;
+
     Parent& m_parent;
 
-    base_type m_roots;
+    base_type* m_root{nullptr};
     key_from_value m_key_from_value;
     key_compare m_comparator;
 
-    tmi_comparator(Parent& parent, const allocator_type&) : m_parent(parent){}
+    using augment = typename detail::ordered_augment<Comparator, I>::type;
+    using tree = detail::wavl_tree<base_type, I, augment>;
 
-    tmi_comparator(Parent& parent, const allocator_type&, const ctor_args& args) : m_parent(parent), m_key_from_value(std::get<0>(args)), m_comparator(std::get<1>(args)){}
-    tmi_comparator(Parent& parent, const tmi_comparator& rhs) : m_parent(parent), m_key_from_value(rhs.m_key_from_value), m_comparator(rhs.m_comparator){}
-    tmi_comparator(Parent& parent, tmi_comparator&& rhs) : m_parent(parent), m_roots(std::move(rhs.m_roots)), m_key_from_value(std::move(rhs.m_key_from_value)), m_comparator(std::move(rhs.m_comparator))
+    static size_t subtree_size(const base_type* base) requires (ranked())
     {
-        rhs.m_roots = {};
+        return base ? base->template subtree_size<I>() : 0;
     }
 
-    base_type* get_root_base() const
+    /* Number of elements less than key, or with Upper, not greater than key. */
+    template<bool Upper, typename CompatibleKey>
+    size_t rank_of_bound(const CompatibleKey& key) const requires (ranked())
     {
-        return m_roots.template left<I>();
+        size_t ret = 0;
+        const base_type* curr = m_root;
+        while (curr != nullptr) {
+            const auto& curr_key = m_key_from_value(curr->node()->value());
+            const bool before = Upper ? !m_comparator(key, curr_key) : m_comparator(curr_key, key);
+            if (before) {
+                ret += subtree_size(curr->template left<I>()) + 1;
+                curr = curr->template right<I>();
+            } else {
+                curr = curr->template left<I>();
+            }
+        }
+        return ret;
     }
 
-    void set_root_node(node_type* node)
+    /* Combined aggregate of the elements in curr's subtree which are less
+       than key. */
+    template<typename CompatibleKey>
+    auto aggregate_before(const base_type* curr, const CompatibleKey& key) const requires (augmented())
     {
-        m_roots.template set_left<I>(node->get_base());
+        const typename Comparator::aggregate_type agg{};
+        typename Comparator::aggregate_type::result_type ret{};
+        while (curr != nullptr) {
+            if (m_comparator(m_key_from_value(curr->node()->value()), key)) {
+                if (curr->template left<I>() != nullptr) {
+                    ret = agg.combine(ret, curr->template left<I>()->template aggregate<I>());
+                }
+                ret = agg.combine(ret, agg(curr->node()->value()));
+                curr = curr->template right<I>();
+            } else {
+                curr = curr->template left<I>();
+            }
+        }
+        return ret;
     }
 
-    static void set_right(base_type* lhs, base_type* rhs)
+    /* Combined aggregate of the elements in curr's subtree which are not
+       less than key. */
+    template<typename CompatibleKey>
+    auto aggregate_from(const base_type* curr, const CompatibleKey& key) const requires (augmented())
     {
-        lhs->template set_right<I>(rhs);
+        const typename Comparator::aggregate_type agg{};
+        typename Comparator::aggregate_type::result_type ret{};
+        while (curr != nullptr) {
+            if (m_comparator(m_key_from_value(curr->node()->value()), key)) {
+                curr = curr->template right<I>();
+            } else {
+                if (curr->template right<I>() != nullptr) {
+                    ret = agg.combine(curr->template right<I>()->template aggregate<I>(), ret);
+                }
+                ret = agg.combine(agg(curr->node()->value()), ret);
+                curr = curr->template left<I>();
+            }
+        }
+        return ret;
     }
 
-    static void set_left(base_type* lhs, base_type* rhs)
+    tmi_comparator(Parent& parent, const allocator_type&) : m_parent(parent){}
+
+    tmi_comparator(Parent& parent, const allocator_type&, const ctor_args& args) : m_parent(parent), m_key_from_value(std::get<0>(args)), m_comparator(std::get<1>(args)){}
+    tmi_comparator(Parent& parent, const tmi_comparator& rhs) : m_parent(parent), m_key_from_value(rhs.m_key_from_value), m_comparator(rhs.m_comparator){}
+    tmi_comparator(Parent& parent, tmi_comparator&& rhs) : m_parent(parent), m_root(rhs.m_root), m_key_from_value(std::move(rhs.m_key_from_value)), m_comparator(std::move(rhs.m_comparator))
     {
-        lhs->template set_left<I>(rhs);
+        rhs.m_root = nullptr;
     }
 
-    static base_type* get_parent(base_type* base)
+    void remove_node(node_type* node)
     {
-        return base->template parent<I>();
+        tree::remove(m_root, node->get_base());
     }
 
-    static void set_parent(base_type* lhs, base_type* rhs)
+    void insert_node_direct(node_type* node)
     {
-        lhs->template set_parent<I>(rhs);
+        base_type* base = node->get_base();
+        base_type* parent = nullptr;
+        base_type* curr = m_root;
+        const auto& key = m_key_from_value(node->value());
+
+        bool inserted_left = false;
+        while (curr != nullptr) {
+            parent = curr;
+            const auto& curr_key = m_key_from_value(curr->node()->value());
+            if (m_comparator(key, curr_key)) {
+                curr = curr->template left<I>();
+                inserted_left = true;
+            } else {
+                curr = curr->template right<I>();
+                inserted_left = false;
+            }
+        }
+
+        tree::insert(m_root, parent, inserted_left, base);
     }
 
-    static Color get_color(base_type* base)
+    /* Find where key belongs in the subtree rooted at curr. For unique
+       indices, returns a node with an equal key if there is one. */
+    template<typename CompatibleKey>
+    node_type* preinsert_below(base_type* curr, const CompatibleKey& key, insert_hints& hints) const
     {
-        return base->template color<I>();
+        base_type* parent = nullptr;
+
+        bool inserted_left = false;
+        while (curr != nullptr) {
+            parent = curr;
+            const auto& curr_key = m_key_from_value(curr->node()->value());
+            if constexpr (sorted_unique()) {
+                if (m_comparator(key, curr_key)) {
+                    curr = curr->template left<I>();
+                    inserted_left = true;
+                } else if (m_comparator(curr_key, key)) {
+                    curr = curr->template right<I>();
+                    inserted_left = false;
+                } else {
+                    return curr->node();
+                }
+            } else {
+                if (m_comparator(key, curr_key)) {
+                    curr = curr->template left<I>();
+                    inserted_left = true;
+                } else {
+                    curr = curr->template right<I>();
+                    inserted_left = false;
+                }
+            }
+        }
+        hints.m_inserted_left = inserted_left;
+        hints.m_parent = parent;
+        return nullptr;
     }
 
-    static void set_color(base_type* base, Color color)
+    /* Finger search: climb from start to the root of the smallest subtree
+       whose key range covers key, so that a search can continue downwards
+       from there. The cost depends on how far key is from start rather than
+       on the size of the tree.
+
+       boundary is set to the ancestor which bounds that range on key's
+       side (or to start itself), and is the only node outside the subtree
+       which may compare equal to key. */
+    template<typename CompatibleKey>
+    base_type* finger_climb(base_type* start, const CompatibleKey& key, base_type*& boundary) const
     {
-        base->template set_color<I>(color);
+        base_type* curr = start;
+        boundary = nullptr;
+        const auto& start_key = m_key_from_value(start->node()->value());
+        if (m_comparator(start_key, key)) {
+            for (base_type* parent = curr->template parent<I>(); parent != nullptr; curr = parent, parent = parent->template parent<I>()) {
+                if (curr == parent->template left<I>() && !m_comparator(m_key_from_value(parent->node()->value()), key)) {
+                    boundary = parent;
+                    break;
+                }
+            }
+        } else if (m_comparator(key, start_key)) {
+            for (base_type* parent = curr->template parent<I>(); parent != nullptr; curr = parent, parent = parent->template parent<I>()) {
+                if (curr == parent->template right<I>() && !m_comparator(key, m_key_from_value(parent->node()->value()))) {
+                    boundary = parent;
+                    break;
+                }
+            }
+        } else {
+            boundary = start;
+        }
+        return curr;
     }
 
-    static base_type* get_left(base_type* base)
+    template<typename CompatibleKey>
+    bool equivalent(const base_type* base, const CompatibleKey& key) const
     {
-        return base->template left<I>();
+        const auto& base_key = m_key_from_value(base->node()->value());
+        return !m_comparator(base_key, key) && !m_comparator(key, base_key);
     }
 
-    static base_type* get_right(base_type* base)
+    /* Copy rhs's tree shape onto the copies of its nodes. Rank parities and
+       augmented data came along with the nodes. */
+    template <typename Map>
+    void clone_from(const tmi_comparator& rhs, const Map& copies)
     {
-        return base->template right<I>();
+        auto copy_of = [&copies](const base_type* base) -> base_type* {
+            return base ? copies(base->node())->get_base() : nullptr;
+        };
+        m_root = copy_of(rhs.m_root);
+        for (const base_type* src = rhs.m_root ? tree::min(rhs.m_root) : nullptr; src != nullptr; src = tree::next(src)) {
+            base_type* dst = copy_of(src);
+            dst->template set_left<I>(copy_of(src->template left<I>()));
+            dst->template set_right<I>(copy_of(src->template right<I>()));
+            dst->template set_parent<I>(copy_of(src->template parent<I>()));
+        }
     }
 
-    /*
-
-    The below insert/erase impls were copied from libc++
-
-    Their base type inheritance was dropped in order to come closer to
-    providing a standard layout. Keeping T as he first member allows us to
-    convert Between T* and node_type*. This is the trick that makes iterator_to
-    work.
-
-    Their root node trick is borrowed as well. The following is adapted from
-    their comment:
-
-//===----------------------------------------------------------------------===//
-//
-// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
-// See https://llvm.org/LICENSE.txt for license information.
-// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
-//
-//===----------------------------------------------------------------------===//
-
-    The algorithms taking base_type* are red black tree algorithms.  Those
-    algorithms taking a parameter named root should assume that root
-    points to a proper red black tree (unless otherwise specified).
-
-    Each algorithm herein assumes that root->m_parent points to a non-null
-    structure which has a member m_left which points back to root.  No other
-    member is read or written to at root->m_parent.
-
-    root->m_parent_ will be referred to below (in comments only) as m_roots[I].
-    m_roots[I]->m_left is an externably accessible lvalue for root, and can be
-    changed by node insertion and removal (without explicit reference to
-    m_roots[I]).
-
-    All nodes (with the exception of m_roots[I]), even the node referred to as
-    root, have a non-null m_parent field.
+    node_type* preinsert_node(const T& value, insert_hints& hints)
+    {
+        return preinsert_below(m_root, m_key_from_value(value), hints);
+    }
 
-*/
+    /* As above, but the node is placed as close as possible to just before
+       hint (nullptr meaning the end). Keys which belong right there are
+       linked without a search; others are found by a finger search from
+       the hint. */
+    node_type* preinsert_node(const T& value, insert_hints& hints, const node_type* hint)
+    {
+        if (m_root == nullptr) {
+            return preinsert_node(value, hints);
+        }
+        const auto& key = m_key_from_value(value);
+        base_type* next = hint ? const_cast<node_type*>(hint)->get_base() : nullptr;
+        base_type* prev = next ? tree::prev(next) : tree::max(m_root);
+
+        bool fits;
+        if constexpr (sorted_unique()) {
+            fits = (prev == nullptr || m_comparator(m_key_from_value(prev->node()->value()), key)) &&
+                   (next == nullptr || m_comparator(key, m_key_from_value(next->node()->value())));
+        } else {
+            fits = (prev == nullptr || !m_comparator(key, m_key_from_value(prev->node()->value()))) &&
+                   (next == nullptr || !m_comparator(m_key_from_value(next->node()->value()), key));
+        }
+        if (fits) {
+            // prev is the rightmost node of next's left subtree, if any.
+            if (next != nullptr && next->template left<I>() == nullptr) {
+                hints.m_parent = next;
+                hints.m_inserted_left = true;
+            } else {
+                hints.m_parent = prev;
+                hints.m_inserted_left = false;
+            }
+            return nullptr;
+        }
 
-    static base_type* tree_max(base_type* x) {
-      while (x->template right<I>() != nullptr)
-        x = x->template right<I>();
-      return x;
+        base_type* boundary;
+        base_type* start = finger_climb(next ? next : prev, key, boundary);
+        if constexpr (sorted_unique()) {
+            if (boundary != nullptr && equivalent(boundary, key)) {
+                return boundary->node();
+            }
+        }
+        return preinsert_below(start, key, hints);
     }
 
-    static const base_type* tree_max(const base_type* x) {
-      while (x->template right<I>() != nullptr)
-        x = x->template right<I>();
-      return x;
+    /* Find where a node removed by erase_if_modified now belongs, with the
+       same result as preinsert_node. Keys usually move only a few places,
+       so step along from the old neighbour first, and only search from the
+       root once that gets too far. */
+    node_type* preinsert_modified(const node_type* node, const premodify_cache& cache, insert_hints& hints)
+    {
+        if (cache.m_from == nullptr) {
+            return preinsert_node(node->value(), hints);
+        }
+        const auto& key = m_key_from_value(node->value());
+        const bool right = cache.m_moved_right;
+
+        base_type* curr = cache.m_from;
+        for (int step = 0; step < reposition_steps; step++) {
+            const auto& curr_key = m_key_from_value(curr->node()->value());
+            if constexpr (sorted_unique()) {
+                if (!m_comparator(key, curr_key) && !m_comparator(curr_key, key)) {
+                    return curr->node();
+                }
+            }
+            // Equal keys go after those already there.
+            if (right && m_comparator(key, curr_key)) {
+                link_before(curr, hints);
+                return nullptr;
+            }
+            if (!right && !m_comparator(key, curr_key)) {
+                link_after(curr, hints);
+                return nullptr;
+            }
+            base_type* next = right ? tree::next(curr) : tree::prev(curr);
+            if (next == nullptr) {
+                hints.m_parent = curr;
+                hints.m_inserted_left = !right;
+                return nullptr;
+            }
+            curr = next;
+        }
+        return preinsert_node(node->value(), hints);
     }
 
-    static bool tree_is_left_child(base_type* x)
+    /* Set hints to link a node right before or after base. The free child
+       slot is either base's own or its in-order neighbour's. */
+    static void link_before(base_type* base, insert_hints& hints)
     {
-        return x == x->template parent<I>()->template left<I>();
+        if (base->template left<I>() == nullptr) {
+            hints.m_parent = base;
+            hints.m_inserted_left = true;
+        } else {
+            hints.m_parent = tree::prev(base);
+            hints.m_inserted_left = false;
+        }
     }
 
-    static bool tree_is_left_child(const base_type* x)
+    static void link_after(base_type* base, insert_hints& hints)
     {
-        return x == x->template parent<I>()->template left<I>();
+        if (base->template right<I>() == nullptr) {
+            hints.m_parent = base;
+            hints.m_inserted_left = false;
+        } else {
+            hints.m_parent = tree::next(base);
+            hints.m_inserted_left = true;
+        }
     }
 
-    static base_type* tree_min(base_type* x)
+    void insert_node(node_type* node, const insert_hints& hints)
     {
-        while (x->template left<I>() != nullptr)
-            x = x->template left<I>();
-        return x;
+        tree::insert(m_root, hints.m_parent, hints.m_inserted_left, node->get_base());
     }
 
-    static base_type* tree_next(base_type* x)
+    /* Whether base's key no longer fits between its neighbours'. For unique
+       indices a key equal to a neighbour's is a conflict which must be
+       detected by re-inserting. */
+    bool needs_resort(const base_type* base) const
     {
-        if (x->template right<I>() != nullptr)
-            return tree_min(x->template right<I>());
-        while (!tree_is_left_child(x))
-            x = x->template parent<I>();
-        return x->template parent<I>();
+        const base_type* prev_ptr = tree::prev(base);
+        const base_type* next_ptr = tree::next(base);
+
+        const auto& key = m_key_from_value(base->node()->value());
+
+        if constexpr (sorted_unique()) {
+            return ((next_ptr != nullptr && !m_comparator(key, m_key_from_value(next_ptr->node()->value()))) ||
+                    (prev_ptr != nullptr && !m_comparator(m_key_from_value(prev_ptr->node()->value()), key)));
+        } else {
+            return ((next_ptr != nullptr && m_comparator(m_key_from_value(next_ptr->node()->value()), key)) ||
+                    (prev_ptr != nullptr && m_comparator(key, m_key_from_value(prev_ptr->node()->value()))));
+        }
     }
 
-    static const base_type* tree_next(const base_type* x)
+    bool erase_if_modified(node_type* node, premodify_cache& cache)
     {
-        if (x->template right<I>() != nullptr)
-            return tree_min(x->template right<I>());
-        while (!tree_is_left_child(x))
-            x = x->template parent<I>();
-        return x->template parent<I>();
+        base_type* base = node->get_base();
+        if (needs_resort(base)) {
+            base_type* next = tree::next(base);
+            const auto& key = m_key_from_value(node->value());
+            if constexpr (sorted_unique()) {
+                cache.m_moved_right = next != nullptr && !m_comparator(key, m_key_from_value(next->node()->value()));
+            } else {
+                cache.m_moved_right = next != nullptr && m_comparator(m_key_from_value(next->node()->value()), key);
+            }
+            cache.m_from = cache.m_moved_right ? next : tree::prev(base);
+            tree::remove(m_root, base);
+            return true;
+        }
+        if constexpr (augmented()) {
+            tree::update_path(base);
+        }
+        return false;
     }
 
-    static base_type* tree_prev(base_type* x) {
-      if (x->template left<I>() != nullptr)
-        return tree_max(x->template left<I>());
-      while (tree_is_left_child(x))
-        x = x->template parent<I>();
-      return x->template parent<I>();
+    /* Whether node is still where its key belongs, and for augmented
+       indices (if the aggregate can be compared) still has the right
+       aggregate. For checking modify() declarations. */
+    bool unmodified(const node_type* node) const
+    {
+        const base_type* base = node->get_base();
+        if (needs_resort(base)) {
+            return false;
+        }
+        if constexpr (augmented()) {
+            using aggregate_type = typename Comparator::aggregate_type;
+            if constexpr (std::equality_comparable<typename aggregate_type::result_type>) {
+                const aggregate_type agg{};
+                typename aggregate_type::result_type result = agg(node->value());
+                if (base->template left<I>() != nullptr)
+                    result = agg.combine(base->template left<I>()->template aggregate<I>(), result);
+                if (base->template right<I>() != nullptr)
+                    result = agg.combine(result, base->template right<I>()->template aggregate<I>());
+                return result == base->template aggregate<I>();
+            }
+        }
+        return true;
     }
 
-    static const base_type* tree_prev(const base_type* x) {
-      if (x->template left<I>() != nullptr)
-        return tree_max(x->template left<I>());
-      while (tree_is_left_child(x))
-        x = x->template parent<I>();
-      return x->template parent<I>();
+    void bulk_prepare(const std::vector<node_type*>& nodes, bulk_state& state)
+    {
+        state.template prepare<sorted_unique()>(nodes, m_key_from_value, m_comparator);
     }
 
-    static void tree_left_rotate(base_type* x)
+    node_type* bulk_preinsert(const node_type* node, size_t pos, bulk_state& state, insert_hints& hints)
     {
-        base_type* y = x->template right<I>();
-        x->template set_right<I>(y->template left<I>());
-        if (x->template right<I>() != nullptr)
-            x->template right<I>()->template set_parent<I>(x);
-        y->template set_parent<I>(x->template parent<I>());
-        if (tree_is_left_child(x))
-            x->template parent<I>()->template set_left<I>(y);
-        else
-            x->template parent<I>()->template set_right<I>(y);
-        y->template set_left<I>(x);
-        x->template set_parent<I>(y);
+        if constexpr (sorted_unique()) {
+            if (node_type* conflict = state.conflict(pos)) {
+                return conflict;
+            }
+            return preinsert_below(m_root, m_key_from_value(node->value()), hints);
+        }
+        return nullptr;
     }
 
-    static void tree_right_rotate(base_type* x)
+    void bulk_insert(node_type* node, size_t pos, bulk_state& state, const insert_hints&)
     {
-        base_type* y = x->template left<I>();
-        x->template set_left<I>(y->template right<I>());
-        if (x->template left<I>() != nullptr)
-            x->template left<I>()->template set_parent<I>(x);
-        y->template set_parent<I>(x->template parent<I>());
-        if (tree_is_left_child(x))
-            x->template parent<I>()->template set_left<I>(y);
-        else
-            x->template parent<I>()->template set_right<I>(y);
-        y->template set_right<I>(x);
-        x->template set_parent<I>(y);
+        if constexpr (sorted_unique()) {
+            state.accept(pos, node);
+        }
     }
 
-
-    // Precondition:  root != nullptr && z != nullptr.
-    //                tree_invariant(root) == true.
-    //                z == root or == a direct or indirect child of root.
-    // Effects:  unlinks z from the tree rooted at root, rebalancing as needed.
-    // Postcondition: tree_invariant(end_node->template left<I>()) == true && end_node->template left<I>()
-    //                nor any of its children refer to z.  end_node->template left<I>()
-    //                may be different than the value passed in as root.
-    void tree_remove(base_type* z)
+    /* Link the accepted part of the batch. Unless the tree is already larger
+       than the batch, merge the two in key order (existing elements first
+       among equals) and rebuild, as in erase_range. */
+    void bulk_finish(const std::vector<node_type*>& nodes, const std::vector<bool>& accepted, bulk_state& state)
     {
-        base_type* root = get_root_base();
-        assert(root);
-        assert(z);
-        // z will be removed from the tree.  Client still needs to destruct/deallocate it
-        // y is either z, or if z has two children, tree_next(z).
-        // y will have at most one child.
-        // y will be the initial hole in the tree (make the hole at a leaf)
-        base_type* y = (z->template left<I>() == nullptr || z->template right<I>() == nullptr) ?
-                        z : tree_next(z);
-        // x is y's possibly null single child
-        base_type* x = y->template left<I>() != nullptr ? y->template left<I>() : y->template right<I>();
-        // w is x's possibly null uncle (will become x's sibling)
-        base_type* w = nullptr;
-        // link x to y's parent, and find w
-        if (x != nullptr)
-            x->template set_parent<I>(y->template parent<I>());
-        if (tree_is_left_child(y))
-        {
-            y->template parent<I>()->template set_left<I>(x);
-            if (y != root)
-                w = y->template parent<I>()->template right<I>();
-            else
-                root = x;  // w == nullptr
+        size_t num_accepted = 0;
+        for (size_t pos : state.m_order) {
+            num_accepted += accepted[pos];
         }
-        else
-        {
-            y->template parent<I>()->template set_right<I>(x);
-            // y can't be root if it is a right child
-            w = y->template parent<I>()->template left<I>();
-        }
-        bool removed_black = y->template color<I>() == Color::BLACK;
-        // If we didn't remove z, do so now by splicing in y for z,
-        //    but copy z's color.  This does not impact x or w.
-        if (y != z)
-        {
-            // z->template left<I>() != nulptr but z->template right<I>() might == x == nullptr
-            y->template set_parent<I>(z->template parent<I>());
-            if (tree_is_left_child(z))
-                y->template parent<I>()->template set_left<I>(y);
-            else
-                y->template parent<I>()->template set_right<I>(y);
-            y->template set_left<I>(z->template left<I>());
-            y->template left<I>()->template set_parent<I>(y);
-            y->template set_right<I>(z->template right<I>());
-            if (y->template right<I>() != nullptr)
-                y->template right<I>()->template set_parent<I>(y);
-            y->template set_color<I>(z->template color<I>());
-            if (root == z)
-                root = y;
-        }
-        if (removed_black && root != nullptr)
-        {
-            // Rebalance:
-            // x has an implicit black color (transferred from the removed y)
-            //    associated with it, no matter what its color is.
-            // If x is root (in which case it can't be null), it is supposed
-            //    to be black anyway, and if it is doubly black, then the double
-            //    can just be ignored.
-            // If x is red (in which case it can't be null), then it can absorb
-            //    the implicit black just by setting its color to black.
-            // Since y was black and only had one child (which x points to), x
-            //   is either red with no children, else null, otherwise y would have
-            //   different black heights under left and right pointers.
-            // if (x == root || x != nullptr && !x->is_black_)
-            if (x != nullptr)
-                x->template set_color<I>(Color::BLACK);
-            else {
-                //  Else x isn't root, and is "doubly black", even though it may
-                //     be null.  w can not be null here, else the parent would
-                //     see a black height >= 2 on the x side and a black height
-                //     of 1 on the w side (w must be a non-null black or a red
-                //     with a non-null black child).
-                fixup_after_remove(root, w);
-            }
-        }
-    }
-
-    static void tree_balance_after_insert(base_type* root, base_type* x)
-    {
-        x->template set_color<I>(x == root ? Color::BLACK : Color::RED);
-        while (x != root && x->template parent<I>()->template color<I>() == Color::RED)
-        {
-            // x->template parent<I>() != root because x->template parent<I>()->is_black == false
-            if (tree_is_left_child(x->template parent<I>()))
-            {
-                base_type* y = x->template parent<I>()->template parent<I>()->template right<I>();
-                if (y != nullptr && y->template color<I>() == Color::RED)
-                {
-                    x = x->template parent<I>();
-                    x->template set_color<I>(Color::BLACK);
-                    x = x->template parent<I>();
-                    x->template set_color<I>(x == root ? Color::BLACK : Color::RED);
-                    y->template set_color<I>(Color::BLACK);
-                }
-                else
-                {
-                    if (!tree_is_left_child(x))
-                    {
-                        x = x->template parent<I>();
-                        tree_left_rotate(x);
-                    }
-                    x = x->template parent<I>();
-                    x->template set_color<I>(Color::BLACK);
-                    x = x->template parent<I>();
-                    x->template set_color<I>(Color::RED);
-                    tree_right_rotate(x);
-                    break;
-                }
-            }
-            else
-            {
-                base_type* y = x->template parent<I>()->template parent<I>()->template left<I>();
-                if (y != nullptr && y->template color<I>() == Color::RED)
-                {
-                    x = x->template parent<I>();
-                    x->template set_color<I>(Color::BLACK);
-                    x = x->template parent<I>();
-                    x->template set_color<I>(x == root ? Color::BLACK : Color::RED);
-                    y->template set_color<I>(Color::BLACK);
-                }
-                else
-                {
-                    if (tree_is_left_child(x))
-                    {
-                        x = x->template parent<I>();
-                        tree_right_rotate(x);
-                    }
-                    x = x->template parent<I>();
-                    x->template set_color<I>(Color::BLACK);
-                    x = x->template parent<I>();
-                    x->template set_color<I>(Color::RED);
-                    tree_left_rotate(x);
-                    break;
+        const size_t num_existing = size() - num_accepted;
+        if (num_existing > num_accepted) {
+            for (size_t pos : state.m_order) {
+                if (accepted[pos]) {
+                    insert_node_direct(nodes[pos]);
                 }
             }
+            return;
         }
-    }
-
-    static void fixup_after_remove(base_type* root, base_type* w)
-    {
-        base_type* x = nullptr;
-        while (true)
-        {
-            if (!tree_is_left_child(w))  // if x is left child
-            {
-                if (w->template color<I>() == Color::RED)
-                {
-                    w->template set_color<I>(Color::BLACK);
-                    w->template parent<I>()->template set_color<I>(Color::RED);
-                    tree_left_rotate(w->template parent<I>());
-                    // x is still valid
-                    // reset root only if necessary
-                    if (root == w->template left<I>())
-                        root = w;
-                    // reset sibling, and it still can't be null
-                    w = w->template left<I>()->template right<I>();
-                }
-                // w->is_black_ is now true, w may have null children
-                if ((w->template left<I>()  == nullptr || w->template left<I>()->template color<I>() == Color::BLACK) &&
-                    (w->template right<I>() == nullptr || w->template right<I>()->template color<I>() == Color::BLACK))
-                {
-                    w->template set_color<I>(Color::RED);
-                    x = w->template parent<I>();
-                    // x can no longer be null
-                    if (x == root || x->template color<I>() == Color::RED)
-                    {
-                        x->template set_color<I>(Color::BLACK);
-                        break;
-                    }
-                    // reset sibling, and it still can't be null
-                    w = tree_is_left_child(x) ?
-                                x->template parent<I>()->template right<I>() :
-                                x->template parent<I>()->template left<I>();
-                    // continue;
-                }
-                else  // w has a red child
-                {
-                    if (w->template right<I>() == nullptr || w->template right<I>()->template color<I>() == Color::BLACK)
-                    {
-                        // w left child is non-null and red
-                        w->template left<I>()->template set_color<I>(Color::BLACK);
-                        w->template set_color<I>(Color::RED);
-                        tree_right_rotate(w);
-                        // w is known not to be root, so root hasn't changed
-                        // reset sibling, and it still can't be null
-                        w = w->template parent<I>();
-                    }
-                    // w has a right red child, left child may be null
-                    w->template set_color<I>(w->template parent<I>()->template color<I>());
-                    w->template parent<I>()->template set_color<I>(Color::BLACK);
-                    w->template right<I>()->template set_color<I>(Color::BLACK);
-                    tree_left_rotate(w->template parent<I>());
-                    break;
-                }
+        base_type* merged = nullptr;
+        base_type* existing = m_root ? tree::min(m_root) : nullptr;
+        auto batch = state.m_order.begin();
+        while (true) {
+            while (batch != state.m_order.end() && !accepted[*batch]) {
+                ++batch;
             }
-            else
-            {
-                if (w->template color<I>() == Color::RED)
-                {
-                    w->template set_color<I>(Color::BLACK);
-                    w->template parent<I>()->template set_color<I>(Color::RED);
-                    tree_right_rotate(w->template parent<I>());
-                    // x is still valid
-                    // reset root only if necessary
-                    if (root == w->template right<I>())
-                        root = w;
-                    // reset sibling, and it still can't be null
-                    w = w->template right<I>()->template left<I>();
-                }
-                // w->is_black_ is now true, w may have null children
-                if ((w->template left<I>()  == nullptr || w->template left<I>()->template color<I>() == Color::BLACK) &&
-                    (w->template right<I>() == nullptr || w->template right<I>()->template color<I>() == Color::BLACK))
-                {
-                    w->template set_color<I>(Color::RED);
-                    x = w->template parent<I>();
-                    // x can no longer be null
-                    if (x->template color<I>() == Color::RED || x == root)
-                    {
-                        x->template set_color<I>(Color::BLACK);
-                        break;
-                    }
-                    // reset sibling, and it still can't be null
-                    w = tree_is_left_child(x) ?
-                                x->template parent<I>()->template right<I>() :
-                                x->template parent<I>()->template left<I>();
-                    // continue;
-                }
-                else  // w has a red child
-                {
-                    if (w->template left<I>() == nullptr || w->template left<I>()->template color<I>() == Color::BLACK)
-                    {
-                        // w right child is non-null and red
-                        w->template right<I>()->template set_color<I>(Color::BLACK);
-                        w->template set_color<I>(Color::RED);
-                        tree_left_rotate(w);
-                        // w is known not to be root, so root hasn't changed
-                        // reset sibling, and it still can't be null
-                        w = w->template parent<I>();
-                    }
-                    // w has a left red child, right child may be null
-                    w->template set_color<I>(w->template parent<I>()->template color<I>());
-                    w->template parent<I>()->template set_color<I>(Color::BLACK);
-                    w->template left<I>()->template set_color<I>(Color::BLACK);
-                    tree_right_rotate(w->template parent<I>());
-                    break;
-                }
+            base_type* curr;
+            if (batch != state.m_order.end() &&
+                (existing == nullptr || m_comparator(m_key_from_value(nodes[*batch]->value()), m_key_from_value(existing->node()->value())))) {
+                curr = nodes[*batch++]->get_base();
+            } else if (existing != nullptr) {
+                curr = existing;
+                existing = tree::next(existing);
+            } else {
+                break;
             }
+            curr->template set_left<I>(merged);
+            merged = curr;
         }
+        tree::build(m_root, merged, size());
     }
 
-//===----------------------------------------------------------------------===//
-//
-//   LLVM Code ends here
-//
-//===----------------------------------------------------------------------===//
-
-
-    void remove_node(node_type* node)
+    void do_clear()
     {
-        tree_remove(node->get_base());
+        m_root = nullptr;
     }
 
-    void insert_node_direct(node_type* node)
+    /* Clear the index, passing each node to destroy. The tree is taken apart
+       by rotating right at the root until it has no left child, so a node
+       is only destroyed once nothing more needs to be read from it. */
+    template <typename Destroy>
+    void do_clear(Destroy&& destroy)
     {
-        base_type* base = node->get_base();
-        base_type* parent = nullptr;
-        base_type* curr = get_root_base();
-        const auto& key = m_key_from_value(node->value());
+        base_type* root = m_root;
+        m_root = nullptr;
+        destroy_tree(root, destroy);
+    }
 
-        bool inserted_left = false;
+    template <typename Destroy>
+    static void destroy_tree(base_type* curr, Destroy& destroy)
+    {
         while (curr != nullptr) {
-            parent = curr;
-            const auto& curr_key = m_key_from_value(curr->node()->value());
-            if (m_comparator(key, curr_key)) {
-                curr = curr->template left<I>();
-                inserted_left = true;
+            base_type* left = curr->template left<I>();
+            if (left != nullptr) {
+                curr->template set_left<I>(left->template right<I>());
+                left->template set_right<I>(curr);
+                curr = left;
             } else {
-                curr = curr->template right<I>();
-                inserted_left = false;
+                base_type* right = curr->template right<I>();
+                destroy(curr->node());
+                curr = right;
             }
         }
+    }
 
-        base->template set_left<I>(nullptr);
-        base->template set_right<I>(nullptr);
-        base->template set_color<I>(Color::RED);
-
-        if(parent) {
-            if (inserted_left) {
-                parent->template set_left<I>(base);
+    /* Erase [first, last) and return the number of elements erased.
+
+       Larger ranges are cut out of this tree as a whole, by splitting it at
+       both ends of the range and joining the outer parts. That costs
+       O(log n) rather than a rebalance per element. The range is then
+       detached from the other indices and destroyed in a single walk.
+       Ranges of fewer than 64 elements are still erased one at a time, as
+       splitting touches O(log n) nodes outside the range, most of them cold,
+       while per-element rebalancing is amortized O(1).
+
+       When at least half of the index goes, this tree skips rebalancing
+       altogether: one in-order walk detaches the range from the other
+       indices and chains the survivors through their left links (only links
+       of already visited nodes are reused, so the walk is unaffected), then
+       the tree is rebuilt from the survivors and the range is destroyed. */
+    size_t erase_range(iterator first, iterator last)
+    {
+        size_t count = 0;
+        for (iterator it = first; it != last; ++it) {
+            count++;
+        }
+        if (count < 64) {
+            for (iterator it = first; it != last;) {
+                it = erase(it);
+            }
+            return count;
+        }
+        if (count * 2 < size()) {
+            base_type* from = const_cast<node_type*>(first.m_node)->get_base();
+            base_type* to = last.m_node != nullptr ? const_cast<node_type*>(last.m_node)->get_base() : nullptr;
+            base_type* erased = tree::remove_range(m_root, from, to);
+            auto destroy = [this](node_type* node) {
+                m_parent.template do_erase_except<I>(node);
+                m_parent.do_destroy_node(node);
+            };
+            destroy_tree(erased, destroy);
+            return count;
+        }
+        base_type* survivors = nullptr;
+        base_type* erased = nullptr;
+        size_t num_survivors = 0;
+        bool in_range = false;
+        for (base_type* curr = m_root ? tree::min(m_root) : nullptr; curr != nullptr;) {
+            base_type* next = tree::next(curr);
+            if (curr->node() == first.m_node) {
+                in_range = true;
+            }
+            if (curr->node() == last.m_node) {
+                in_range = false;
+            }
+            if (in_range) {
+                m_parent.template do_erase_except<I>(curr->node());
+                curr->template set_left<I>(erased);
+                erased = curr;
             } else {
-                parent->template set_right<I>(base);
+                curr->template set_left<I>(survivors);
+                survivors = curr;
+                num_survivors++;
             }
-            base->template set_parent<I>(parent);
-        } else {
-            set_root_node(node);
-            base->template set_parent<I>(&m_roots);
+            curr = next;
+        }
+        tree::build(m_root, survivors, num_survivors);
+        while (erased != nullptr) {
+            base_type* next = erased->template left<I>();
+            m_parent.do_destroy_node(erased->node());
+            erased = next;
         }
-        tree_balance_after_insert(get_root_base(), base);
+        return count;
     }
 
-    node_type* preinsert_node(const node_type* node, insert_hints& hints)
+    template<typename CompatibleKey>
+    iterator find_below(base_type* curr, const CompatibleKey& key) const
     {
-        base_type* parent = nullptr;
-        base_type* curr = get_root_base();
-        const auto& key = m_key_from_value(node->value());
-
-        bool inserted_left = false;
         while (curr != nullptr) {
-            parent = curr;
             const auto& curr_key = m_key_from_value(curr->node()->value());
-            if constexpr (sorted_unique()) {
-                if (m_comparator(key, curr_key)) {
-                    curr = curr->template left<I>();
-                    inserted_left = true;
-                } else if (m_comparator(curr_key, key)) {
-                    curr = curr->template right<I>();
-                    inserted_left = false;
-                } else {
-                    return curr->node();
-                }
+            if (m_comparator(key, curr_key)) {
+                curr = curr->template left<I>();
+            } else if (m_comparator(curr_key, key)) {
+                curr = curr->template right<I>();
             } else {
-                if (m_comparator(key, curr_key)) {
-                    curr = curr->template left<I>();
-                    inserted_left = true;
-                } else {
-                    curr = curr->template right<I>();
-                    inserted_left = false;
-                }
+                return make_iterator(curr->node());
             }
         }
-        hints.m_inserted_left = inserted_left;
-        hints.m_parent = parent;
-        return nullptr;
-    }
-
-    void insert_node(node_type* node, const insert_hints& hints)
-    {
-        base_type* base = node->get_base();
-        base_type* parent = hints.m_parent;
-
-        base->template set_left<I>(nullptr);
-        base->template set_right<I>(nullptr);
-        base->template set_color<I>(Color::RED);
-
-        if (!parent) {
-            set_root_node(node);
-            base->template set_parent<I>(&m_roots);
-        } else if (hints.m_inserted_left) {
-            base->template set_parent<I>(parent);
-            parent->template set_left<I>(base);
-        } else {
-            base->template set_parent<I>(parent);
-            parent->template set_right<I>(base);
-        }
-        tree_balance_after_insert(get_root_base(), base);
-    }
-
-    bool erase_if_modified(node_type* node, const premodify_cache&)
-    {
-        base_type* base = node->get_base();
-        base_type* next_ptr = nullptr;
-        base_type* prev_ptr = nullptr;
-        base_type* root = get_root_base();
-
-        if (base != tree_min(root))
-            prev_ptr = tree_prev(base);
-        if (base != tree_max(root))
-            next_ptr = tree_next(base);
-
-        const auto& key = m_key_from_value(node->value());
-
-        bool needs_resort = ((next_ptr != nullptr && m_comparator(m_key_from_value(next_ptr->node()->value()), key)) ||
-                             (prev_ptr != nullptr && m_comparator(key, m_key_from_value(prev_ptr->node()->value()))));
-        if (needs_resort) {
-            tree_remove(base);
-            base->template set_parent<I>(nullptr);
-            base->template set_left<I>(nullptr);
-            base->template set_right<I>(nullptr);
-            base->template set_color<I>(Color::RED);
-            return true;
-        }
-        return false;
-    }
-
-    void do_clear()
-    {
-        m_roots = {};
+        return end();
     }
 
 public:
@@ -650,8 +646,8 @@ public:
     class iterator
     {
         const node_type* m_node{};
-        const base_type* m_root{};
-        iterator(const node_type* node, const base_type* root) : m_node(node), m_root(root){}
+        base_type* const* m_root{};
+        iterator(const node_type* node, base_type* const* root) : m_node(node), m_root(root){}
         friend tmi_comparator;
     public:
         typedef const T value_type;
@@ -665,7 +661,7 @@ public:
         const T* operator->() const { return &m_node->value(); }
         iterator& operator++()
         {
-            const base_type* next = tree_next(m_node->get_base());
+            const base_type* next = tree::next(m_node->get_base());
             if (next) {
                 m_node = next->node();
             } else {
@@ -676,16 +672,16 @@ public:
         iterator& operator--()
         {
             if (m_node) {
-                const base_type* prev = tree_prev(m_node->get_base());
+                const base_type* prev = tree::prev(m_node->get_base());
                 if (prev) {
                     m_node = prev->node();
                 } else {
                     m_node = nullptr;
                 }
             } else {
-                base_type* root = m_root->template left<I>();
+                base_type* root = *m_root;
                 assert(root);
-                m_node = tree_max(root)->node();
+                m_node = tree::max(root)->node();
             }
             return *this;
         }
@@ -713,18 +709,74 @@ public:
         return std::make_pair(make_iterator(node), success);
     }
 
+    /* Emplace an element constructed from args, which must have key as its
+       key in this index, unless this index already holds an equal key.
+       Nothing is allocated or constructed in that case. */
+    template <typename... Args>
+    std::pair<iterator,bool> try_emplace(const key_type& key, Args&&... args) requires (sorted_unique())
+    {
+        const iterator it = find(key);
+        if (it != end()) {
+            return std::make_pair(it, false);
+        }
+        return emplace(std::forward<Args>(args)...);
+    }
+
+    /* The value is checked against every index before a node is allocated
+       for it, so rejecting a duplicate costs no allocation. */
     std::pair<iterator,bool> insert(const T& value)
     {
-        auto [node, success] = m_parent.do_insert(value);
+        auto [node, success] = m_parent.do_insert_value(value);
         return std::make_pair(make_iterator(node), success);
     }
 
+    std::pair<iterator,bool> insert(T&& value)
+    {
+        auto [node, success] = m_parent.do_insert_value(std::move(value));
+        return std::make_pair(make_iterator(node), success);
+    }
+
+    /* Insert as close as possible to just before hint. Returns the new
+       element, or the conflicting one if insertion failed. */
+    template <typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args)
+    {
+        return make_iterator(m_parent.template do_emplace_hint<I>(hint.m_node, std::forward<Args>(args)...).first);
+    }
+
+    iterator insert(const_iterator hint, const T& value)
+    {
+        return make_iterator(m_parent.template do_insert_hint<I>(hint.m_node, value).first);
+    }
+
+    /* Insert a range of elements, skipping any which conflict with an
+       existing or earlier element. Much faster than inserting one at a time
+       for large ranges, see multi_index_container::do_insert_range. */
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        m_parent.do_insert_range(first, last);
+    }
+
+    /* Replace the contents with a range of elements. */
+    template <typename InputIt>
+    void assign(InputIt first, InputIt last)
+    {
+        m_parent.do_clear();
+        m_parent.do_insert_range(first, last);
+    }
+
+    template <typename Range>
+    void assign(const Range& range)
+    {
+        assign(std::begin(range), std::end(range));
+    }
+
     iterator begin() const
     {
-        base_type* root = get_root_base();
-        if (root == nullptr)
+        if (m_root == nullptr)
             return end();
-        return make_iterator(tree_min(root)->node());
+        return make_iterator(tree::min(m_root)->node());
     }
 
     iterator end() const
@@ -735,7 +787,6 @@ public:
 
     iterator iterator_to(const T& entry) const
     {
-        T& ref = const_cast<T&>(entry);
         const node_type* node = &node_type::node_cast(entry);
         return make_iterator(node);
     }
@@ -748,29 +799,49 @@ public:
         return m_parent.do_modify(node, std::forward<Callable>(func));
     }
 
+    /* As above, declaring that func only changes the keys of the listed
+       indices, by number or by tag. The other indices skip all of their
+       modify() work. For augmented indices, a change to the aggregated
+       value counts as a key change. Debug builds assert the declaration. */
+    template <int Modified, int... MoreModified, typename Callable>
+    bool modify(iterator it, Callable&& func)
+    {
+        node_type* node = const_cast<node_type*>(it.m_node);
+        if (!node) return false;
+        return m_parent.template do_modify<std::integer_sequence<int, Modified, MoreModified...>>(node, std::forward<Callable>(func));
+    }
+
+    template <typename Tag, typename... MoreTags, typename Callable>
+    bool modify(iterator it, Callable&& func)
+    {
+        return modify<static_cast<int>(Parent::template index_v<Tag>), static_cast<int>(Parent::template index_v<MoreTags>)...>(it, std::forward<Callable>(func));
+    }
+
     template<typename CompatibleKey>
     iterator find(const CompatibleKey& key) const
     {
-        base_type* parent = nullptr;
-        base_type* curr = get_root_base();
-        while (curr != nullptr) {
-            parent = curr;
-            const auto& curr_key = m_key_from_value(curr->node()->value());
-            if (m_comparator(key, curr_key)) {
-                curr = curr->template left<I>();
-            } else if (m_comparator(curr_key, key)) {
-                curr = curr->template right<I>();
-            } else {
-                return make_iterator(curr->node());
-            }
+        return find_below(m_root, key);
+    }
+
+    /* Finger search from hint, which is cheap when key is close to it. */
+    template<typename CompatibleKey>
+    iterator find(const_iterator hint, const CompatibleKey& key) const
+    {
+        if (hint.m_node == nullptr) {
+            return find(key);
         }
-        return end();
+        base_type* boundary;
+        base_type* start = finger_climb(const_cast<node_type*>(hint.m_node)->get_base(), key, boundary);
+        if (boundary != nullptr && equivalent(boundary, key)) {
+            return make_iterator(boundary->node());
+        }
+        return find_below(start, key);
     }
 
     template<typename CompatibleKey>
     iterator lower_bound(const CompatibleKey& key) const
     {
-        base_type* curr = get_root_base();
+        base_type* curr = m_root;
         base_type* ret = nullptr;
         while (curr != nullptr) {
             const auto& curr_key = m_key_from_value(curr->node()->value());
@@ -791,7 +862,7 @@ public:
     template<typename CompatibleKey>
     iterator upper_bound(const CompatibleKey& key) const
     {
-        base_type* curr = get_root_base();
+        base_type* curr = m_root;
         base_type* ret = nullptr;
         while (curr != nullptr) {
             const auto& curr_key = m_key_from_value(curr->node()->value());
@@ -810,111 +881,152 @@ public:
     }
 
     template<typename CompatibleKey>
-    size_t count(const CompatibleKey& key) const
+    std::pair<iterator, iterator> equal_range(const CompatibleKey& key) const
     {
-        base_type* parent = nullptr;
-        base_type* curr = get_root_base();
-        size_t ret = 0;
+        /* Descend to the first node matching key. The range's bounds are
+           then below it: the lower bound in its left subtree, the upper
+           bound in its right subtree. */
+        base_type* curr = m_root;
+        base_type* upper = nullptr;
         while (curr != nullptr) {
-            parent = curr;
             const auto& curr_key = m_key_from_value(curr->node()->value());
-            if (m_comparator(key, curr_key)) {
-                curr = curr->template left<I>();
-            } else if (m_comparator(curr_key, key)) {
+            if (m_comparator(curr_key, key)) {
                 curr = curr->template right<I>();
+            } else if (m_comparator(key, curr_key)) {
+                upper = curr;
+                curr = curr->template left<I>();
             } else {
-                ret++;
                 break;
             }
         }
-        if constexpr (sorted_unique()) return ret;
-
-        base_type* found_match = curr;
-        if (found_match) {
-            curr = tree_prev(found_match);
-            while (curr != nullptr)
-            {
-                const auto& curr_key = m_key_from_value(curr->node()->value());
-                if (m_comparator(curr_key, key)) {
-                    break;
+        if (curr == nullptr) {
+            iterator it = upper ? make_iterator(upper->node()) : end();
+            return std::make_pair(it, it);
+        }
+        base_type* lower = curr;
+        if constexpr (sorted_unique()) {
+            upper = tree::next(curr);
+        } else {
+            for (base_type* left = curr->template left<I>(); left != nullptr;) {
+                if (m_comparator(m_key_from_value(left->node()->value()), key)) {
+                    left = left->template right<I>();
+                } else {
+                    lower = left;
+                    left = left->template left<I>();
                 }
-                ret++;
-                curr = tree_prev(curr);
             }
-            curr = tree_next(found_match);
-            while (curr != nullptr)
-            {
-                const auto& curr_key = m_key_from_value(curr->node()->value());
-                if (m_comparator(key, curr_key)) {
-                    break;
+            for (base_type* right = curr->template right<I>(); right != nullptr;) {
+                if (m_comparator(key, m_key_from_value(right->node()->value()))) {
+                    upper = right;
+                    right = right->template left<I>();
+                } else {
+                    right = right->template right<I>();
                 }
-                ret++;
-                curr = tree_next(curr);
             }
         }
-        return ret;
+        return std::make_pair(make_iterator(lower->node()), upper ? make_iterator(upper->node()) : end());
     }
 
-    iterator erase(iterator it)
+    template<typename CompatibleKey>
+    size_t count(const CompatibleKey& key) const
     {
-        node_type* node = const_cast<node_type*>(it.m_node);
-        base_type* next = tree_next(node->get_base());
-        m_parent.do_erase(node);
-        if (next) {
-            return make_iterator(next->node());
+        if constexpr (sorted_unique()) {
+            return find(key) == end() ? 0 : 1;
+        } else if constexpr (ranked()) {
+            return rank_of_bound<true>(key) - rank_of_bound<false>(key);
         } else {
-            return end();
+            auto [first, last] = equal_range(key);
+            return std::distance(first, last);
         }
     }
 
-    size_t erase(const key_type& key) const
+    /* Position of it in the index, or size() for end(). */
+    size_t rank(iterator it) const requires (ranked())
     {
-        base_type* parent = nullptr;
-        base_type* curr = get_root_base();
-        size_t ret = 0;
+        if (it.m_node == nullptr) {
+            return size();
+        }
+        const base_type* curr = it.m_node->get_base();
+        size_t ret = subtree_size(curr->template left<I>());
+        for (const base_type* parent = curr->template parent<I>(); parent != nullptr; curr = parent, parent = parent->template parent<I>()) {
+            if (curr == parent->template right<I>()) {
+                ret += subtree_size(parent->template left<I>()) + 1;
+            }
+        }
+        return ret;
+    }
+
+    /* The element at position n, or end() if n >= size(). */
+    iterator nth(size_t n) const requires (ranked())
+    {
+        const base_type* curr = m_root;
         while (curr != nullptr) {
-            parent = curr;
-            const auto& curr_key = m_key_from_value(curr->node()->value());
-            if (m_comparator(key, curr_key)) {
+            const size_t left_size = subtree_size(curr->template left<I>());
+            if (n < left_size) {
                 curr = curr->template left<I>();
-            } else if (m_comparator(curr_key, key)) {
-                curr = curr->template right<I>();
+            } else if (n == left_size) {
+                return make_iterator(curr->node());
             } else {
-                ret++;
-                break;
+                n -= left_size + 1;
+                curr = curr->template right<I>();
             }
         }
-        base_type* found_match = curr;
-        if (found_match) {
-            if constexpr (!sorted_unique()) {
-                curr = tree_prev(found_match);
-                while (curr != nullptr)
-                {
-                    const auto& curr_key = m_key_from_value(curr->node()->value());
-                    if (m_comparator(curr_key, key)) {
-                        break;
-                    }
-                    ret++;
-                    base_type* to_erase = curr;
-                    curr = tree_prev(curr);
-                    m_parent.do_erase(to_erase->node());
-                }
-                curr = tree_next(found_match);
-                while (curr != nullptr)
-                {
-                    const auto& curr_key = m_key_from_value(curr->node()->value());
-                    if (m_comparator(key, curr_key)) {
-                        break;
-                    }
-                    ret++;
-                    base_type* to_erase = curr;
-                    curr = tree_next(curr);
-                    m_parent.do_erase(to_erase->node());
-                }
+        return end();
+    }
+
+    /* Combined aggregate of all elements less than key, in index order.
+       The aggregate's default constructed result is the identity. */
+    template<typename CompatibleKey>
+    auto prefix_aggregate(const CompatibleKey& key) const requires (augmented())
+    {
+        return aggregate_before(m_root, key);
+    }
+
+    /* Combined aggregate of all elements in [lo, hi), in index order. */
+    template<typename CompatibleKey>
+    auto range_aggregate(const CompatibleKey& lo, const CompatibleKey& hi) const requires (augmented())
+    {
+        const typename Comparator::aggregate_type agg{};
+        /* Find the highest node inside the range. Everything else in the
+           range is in its left subtree (bounded by lo) or its right subtree
+           (bounded by hi). */
+        const base_type* curr = m_root;
+        while (curr != nullptr) {
+            const auto& curr_key = m_key_from_value(curr->node()->value());
+            if (m_comparator(curr_key, lo)) {
+                curr = curr->template right<I>();
+            } else if (!m_comparator(curr_key, hi)) {
+                curr = curr->template left<I>();
+            } else {
+                return agg.combine(agg.combine(aggregate_from(curr->template left<I>(), lo), agg(curr->node()->value())),
+                                   aggregate_before(curr->template right<I>(), hi));
             }
-            m_parent.do_erase(found_match->node());
         }
-        return ret;
+        return typename Comparator::aggregate_type::result_type{};
+    }
+
+    iterator erase(iterator it)
+    {
+        node_type* node = const_cast<node_type*>(it.m_node);
+        base_type* next = tree::next(node->get_base());
+        m_parent.do_erase(node);
+        if (next) {
+            return make_iterator(next->node());
+        } else {
+            return end();
+        }
+    }
+
+    iterator erase(iterator first, iterator last)
+    {
+        erase_range(first, last);
+        return last;
+    }
+
+    size_t erase(const key_type& key)
+    {
+        auto [first, last] = equal_range(key);
+        return erase_range(first, last);
     }
 
     void clear()
@@ -938,6 +1050,8 @@ public:
         if(!node) {
             return {end(), false, {}};
         }
+        // The node must have come from this container's allocator.
+        assert(*handle.m_alloc == m_parent.m_alloc);
         node_type* conflict = m_parent.do_insert(node);
         if (conflict) {
             return {make_iterator(conflict), false, std::move(handle)};
@@ -965,7 +1079,7 @@ private:
 
     iterator make_iterator(const node_type* node) const
     {
-        return iterator(node, &m_roots);
+        return iterator(node, &m_root);
     }
 
 };
@@ -0,0 +1,870 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TMI_FLAT_HASHER_H_
+#define TMI_FLAT_HASHER_H_
+
+#include "tmi_nodehandle.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TMI_FLAT_HASHER_SSE2
+#endif
+
+namespace tmi {
+namespace detail {
+
+/*
+    A group of slots in a flat hash table, probed as a unit.
+
+    Each slot has a control byte: the low 7 bits of its element's hash if it
+    is full, or empty. A lookup compares all of a group's control bytes
+    against its hash at once, and only follows the node pointers which match.
+
+    Bit b of m_overflow is set once an element with overflow bit b has been
+    pushed past the group because it was full. A lookup can stop at the
+    first group without its bit set, rather than having to find an empty
+    slot, and erasing never needs to leave a tombstone behind.
+
+    A group fills exactly one cache line: 7 control bytes and the overflow
+    byte, followed by 7 node pointers. A lookup which hits reads the line and
+    then the node, just like a lookup in a chained table which finds its node
+    first. A miss usually reads the line and nothing else.
+*/
+template <typename Node>
+struct alignas(64) flat_group
+{
+    static constexpr size_t width = 7;
+    static constexpr uint32_t mask = (uint32_t{1} << width) - 1;
+    static constexpr int8_t empty = -128;
+
+    std::array<int8_t, width> m_ctrl;
+    uint8_t m_overflow;
+    std::array<Node*, width> m_slots;
+
+    /* Bitmask of the slots whose control byte is ctrl. */
+    uint32_t match(int8_t ctrl) const
+    {
+#ifdef TMI_FLAT_HASHER_SSE2
+        const __m128i ctrls = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(m_ctrl.data()));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrls, _mm_set1_epi8(ctrl)))) & mask;
+#else
+        uint32_t ret = 0;
+        for (size_t i = 0; i < width; i++) {
+            ret |= static_cast<uint32_t>(m_ctrl[i] == ctrl) << i;
+        }
+        return ret;
+#endif
+    }
+
+    /* Bitmask of the empty slots, which have the sign bit set. The overflow
+       byte is loaded along with the control bytes and masked off. */
+    uint32_t match_free() const
+    {
+#ifdef TMI_FLAT_HASHER_SSE2
+        const __m128i ctrls = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(m_ctrl.data()));
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrls)) & mask;
+#else
+        uint32_t ret = 0;
+        for (size_t i = 0; i < width; i++) {
+            ret |= static_cast<uint32_t>(m_ctrl[i] < 0) << i;
+        }
+        return ret;
+#endif
+    }
+
+    uint32_t match_full() const
+    {
+        return ~match_free() & mask;
+    }
+};
+
+} // namespace detail
+
+/*
+    A hashed index backed by an open-addressing table.
+
+    Slots are arranged in groups, see flat_group. Groups are probed
+    quadratically, and a lookup ends at the first group which nothing with
+    its overflow bit was ever pushed past, so a miss usually costs a single
+    cache line and no node accesses at all. At most 7/8 of the slots are in
+    use.
+
+    Each node stores its hash and the slot holding it, so erasing a node
+    doesn't require a lookup and rehashing doesn't call the hasher.
+*/
+template <typename T, typename Node, typename Hasher, typename Parent, typename Allocator, int I>
+class tmi_flat_hasher
+{
+public:
+    class iterator;
+
+    using node_type = Node;
+    using base_type = typename node_type::base_type;
+    using size_type = size_t;
+    using key_from_value = typename Hasher::key_from_value_type;
+    using key_type = typename key_from_value::result_type;
+    using hasher = typename Hasher::hasher_type;
+    using key_equal = typename Hasher::pred_type;
+    using ctor_args = std::tuple<size_type,key_from_value,hasher,key_equal>;
+    using allocator_type = Allocator;
+    using node_allocator_type = detail::node_allocator_t<Allocator, node_type>;
+    using node_handle = detail::node_handle<Allocator, Node>;
+    using insert_return_type = detail::insert_return_type<iterator, node_handle>;
+    friend Parent;
+
+private:
+    static constexpr bool hashed_unique() { return Hasher::is_hashed_unique(); }
+    static_assert(std::is_same_v<typename Hasher::hash_cache, full_hash_cache>, "flat tables always store each element's hash");
+
+    using group_type = detail::flat_group<node_type>;
+    static constexpr size_t group_width = group_type::width;
+
+    struct insert_hints {
+        size_t m_hash{0};
+    };
+
+    struct premodify_cache{};
+    static constexpr bool requires_premodify_cache() { return false; }
+
+    struct bulk_state{};
+
+    class slot_groups
+    {
+        using group_allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<group_type>;
+        group_allocator_type m_alloc;
+        group_type* m_groups{nullptr};
+        size_t m_group_count{0};
+        size_t m_count{0};
+        size_t m_growth_left{0};
+
+    public:
+        slot_groups(const group_allocator_type& alloc) : m_alloc(alloc) {}
+
+        slot_groups(slot_groups&& rhs) : m_alloc(std::move(rhs.m_alloc)), m_groups(rhs.m_groups), m_group_count(rhs.m_group_count), m_count(rhs.m_count), m_growth_left(rhs.m_growth_left)
+        {
+            rhs.m_groups = nullptr;
+            rhs.m_group_count = 0;
+            rhs.m_count = 0;
+            rhs.m_growth_left = 0;
+        }
+
+        /* Copies the control bytes only. The slots are filled in by
+           tmi_flat_hasher::clone_from. */
+        slot_groups(const slot_groups& rhs) : m_alloc(std::allocator_traits<group_allocator_type>::select_on_container_copy_construction(rhs.m_alloc))
+        {
+            if (rhs.m_group_count) {
+                m_groups = do_allocate(rhs.m_group_count);
+                m_group_count = rhs.m_group_count;
+                for (size_t i = 0; i < m_group_count; i++) {
+                    m_groups[i].m_ctrl = rhs.m_groups[i].m_ctrl;
+                    m_groups[i].m_overflow = rhs.m_groups[i].m_overflow;
+                }
+                m_count = rhs.m_count;
+                m_growth_left = rhs.m_growth_left;
+            }
+        }
+
+        slot_groups(const group_allocator_type& alloc, size_t count) : m_alloc(alloc)
+        {
+            if (count) {
+                m_group_count = group_count_for(count);
+                m_groups = do_allocate(m_group_count);
+                m_growth_left = max_load();
+            }
+        }
+
+        ~slot_groups()
+        {
+            do_deallocate(m_groups, m_group_count);
+        }
+
+        /* The number of groups needed to hold count elements. */
+        static size_t group_count_for(size_t count)
+        {
+            size_t group_count = std::bit_ceil((count + count / 7 + group_width) / group_width);
+            while (group_count * group_width * 7 / 8 < count) {
+                group_count *= 2;
+            }
+            return group_count;
+        }
+
+        size_t group_count() const
+        {
+            return m_group_count;
+        }
+
+        size_t capacity() const
+        {
+            return m_group_count * group_width;
+        }
+
+        size_t max_load() const
+        {
+            return capacity() * 7 / 8;
+        }
+
+        size_t size() const
+        {
+            return m_count;
+        }
+
+        size_t growth_left() const
+        {
+            return m_growth_left;
+        }
+
+        const group_type& at(size_t group) const
+        {
+            return m_groups[group];
+        }
+
+        group_type& at(size_t group)
+        {
+            return m_groups[group];
+        }
+
+        /* Take the first free slot on the probe sequence for mixed, marking
+           the full groups passed on the way. There always is one, as at
+           most 7/8 of the slots are in use. */
+        size_t claim_slot(size_t mixed)
+        {
+            const size_t mask = m_group_count - 1;
+            size_t group = (mixed >> 7) & mask;
+            for (size_t step = 1;; step++) {
+                const uint32_t free = m_groups[group].match_free();
+                if (free) {
+                    return group * group_width + static_cast<size_t>(std::countr_zero(free));
+                }
+                m_groups[group].m_overflow |= overflow_bit(mixed);
+                group = (group + step) & mask;
+            }
+        }
+
+        void set(size_t slot, node_type* node, int8_t ctrl)
+        {
+            group_type& group = m_groups[slot / group_width];
+            const size_t pos = slot % group_width;
+            assert(group.m_ctrl[pos] == group_type::empty);
+            assert(m_growth_left);
+            group.m_ctrl[pos] = ctrl;
+            group.m_slots[pos] = node;
+            m_growth_left--;
+            m_count++;
+        }
+
+        /* Freeing a slot in a group which has overflowed doesn't shorten
+           any lookups, so it doesn't count towards the next rehash. */
+        void erase(size_t slot)
+        {
+            group_type& group = m_groups[slot / group_width];
+            const size_t pos = slot % group_width;
+            assert(group.m_ctrl[pos] >= 0);
+            group.m_ctrl[pos] = group_type::empty;
+            if (!group.m_overflow) {
+                m_growth_left++;
+            }
+            m_count--;
+        }
+
+        /* Move every element to a new table of group_count groups, which
+           also clears the overflow bits. Nodes come with their hashes, so
+           the hasher isn't called. A group_count of 0 releases the table. */
+        void rehash(size_t group_count)
+        {
+            assert(group_count * group_width * 7 / 8 >= m_count);
+            group_type* old_groups = m_groups;
+            const size_t old_group_count = m_group_count;
+            m_groups = do_allocate(group_count);
+            m_group_count = group_count;
+            m_growth_left = max_load() - m_count;
+            for (size_t i = 0; i < old_group_count; i++) {
+                const group_type& old_group = old_groups[i];
+                for (uint32_t full = old_group.match_full(); full; full &= full - 1) {
+                    node_type* node = old_group.m_slots[static_cast<size_t>(std::countr_zero(full))];
+                    base_type* base = node->get_base();
+                    const size_t mixed = mix(base->template hash<I>());
+                    const size_t slot = claim_slot(mixed);
+                    group_type& group = m_groups[slot / group_width];
+                    group.m_ctrl[slot % group_width] = tag(mixed);
+                    group.m_slots[slot % group_width] = node;
+                    base->template set_flat_slot<I>(slot);
+                }
+            }
+            do_deallocate(old_groups, old_group_count);
+        }
+
+        void clear()
+        {
+            for (size_t i = 0; i < m_group_count; i++) {
+                m_groups[i].m_ctrl.fill(group_type::empty);
+                m_groups[i].m_overflow = 0;
+            }
+            m_count = 0;
+            m_growth_left = max_load();
+        }
+
+    private:
+        group_type* do_allocate(size_t group_count)
+        {
+            if (!group_count) {
+                return nullptr;
+            }
+            group_type* ret = std::allocator_traits<group_allocator_type>::allocate(m_alloc, group_count);
+            for (size_t i = 0; i < group_count; i++) {
+                ret[i].m_ctrl.fill(group_type::empty);
+                ret[i].m_overflow = 0;
+            }
+            return ret;
+        }
+
+        void do_deallocate(group_type* groups, size_t group_count)
+        {
+            if (group_count) {
+                std::allocator_traits<group_allocator_type>::deallocate(m_alloc, groups, group_count);
+            }
+        }
+    };
+
+    static constexpr size_t first_group_count = 8;
+
+    Parent& m_parent;
+    slot_groups m_groups;
+    key_from_value m_key_from_value;
+    hasher m_hasher;
+    key_equal m_pred;
+    float m_min_load_factor{0};
+    /* The table size asked for by reserve(), rehash() or a bulk insert.
+       Shrinking never goes below it. */
+    size_t m_reserved_groups{0};
+
+    tmi_flat_hasher(Parent& parent, const allocator_type& alloc) : m_parent(parent), m_groups(alloc) {}
+
+    tmi_flat_hasher(Parent& parent, const allocator_type& alloc, const ctor_args& args) : m_parent(parent), m_groups(alloc, std::get<0>(args)), m_key_from_value(std::get<1>(args)), m_hasher(std::get<2>(args)), m_pred(std::get<3>(args)){}
+
+    tmi_flat_hasher(Parent& parent, const tmi_flat_hasher& rhs) : m_parent(parent), m_groups(rhs.m_groups), m_key_from_value(rhs.m_key_from_value), m_hasher(rhs.m_hasher), m_pred(rhs.m_pred), m_min_load_factor(rhs.m_min_load_factor), m_reserved_groups(rhs.m_reserved_groups){}
+    tmi_flat_hasher(Parent& parent, tmi_flat_hasher&& rhs) : m_parent(parent), m_groups(std::move(rhs.m_groups)), m_key_from_value(std::move(rhs.m_key_from_value)), m_hasher(std::move(rhs.m_hasher)), m_pred(std::move(rhs.m_pred)), m_min_load_factor(rhs.m_min_load_factor), m_reserved_groups(rhs.m_reserved_groups) {}
+
+    /* Spread the hasher's output over all bits. The low 7 bits become the
+       control byte, the top 3 the overflow bit, and the rest pick the first
+       group to probe, so hashers which leave some bits constant (like
+       std::hash for integers) still get an even spread and few false tag
+       matches. */
+    static size_t mix(size_t hash)
+    {
+        uint64_t x = hash;
+        x ^= x >> 32;
+        x *= 0x9e3779b97f4a7c15;
+        x ^= x >> 29;
+        return static_cast<size_t>(x);
+    }
+
+    static int8_t tag(size_t mixed)
+    {
+        return static_cast<int8_t>(mixed & 0x7f);
+    }
+
+    static uint8_t overflow_bit(size_t mixed)
+    {
+        return static_cast<uint8_t>(1 << (mixed >> (std::numeric_limits<size_t>::digits - 3)));
+    }
+
+    /* The first node matching key, or nullptr. */
+    template <typename CompatibleKey>
+    node_type* find_node(const CompatibleKey& key, size_t hash) const
+    {
+        if (!m_groups.group_count()) {
+            return nullptr;
+        }
+        const size_t mixed = mix(hash);
+        const int8_t key_tag = tag(mixed);
+        const size_t mask = m_groups.group_count() - 1;
+        size_t group_index = (mixed >> 7) & mask;
+        for (size_t step = 1; step <= m_groups.group_count(); step++) {
+            const group_type& group = m_groups.at(group_index);
+            for (uint32_t match = group.match(key_tag); match; match &= match - 1) {
+                node_type* node = group.m_slots[static_cast<size_t>(std::countr_zero(match))];
+                if (m_pred(m_key_from_value(node->value()), key)) {
+                    return node;
+                }
+            }
+            if (!(group.m_overflow & overflow_bit(mixed))) {
+                break;
+            }
+            group_index = (group_index + step) & mask;
+        }
+        return nullptr;
+    }
+
+    void remove_node(const node_type* node)
+    {
+        if (!m_groups.group_count()) {
+            return;
+        }
+        const size_t slot = node->get_base()->template flat_slot<I>();
+        assert(m_groups.at(slot / group_width).m_slots[slot % group_width] == node);
+        m_groups.erase(slot);
+    }
+
+    /* rhs's control and overflow bytes were copied along with its groups, and the nodes
+       came with their hashes and slots. Only the slots remain. */
+    template <typename Map>
+    void clone_from(const tmi_flat_hasher& rhs, const Map& copies)
+    {
+        for (size_t i = 0; i < rhs.m_groups.group_count(); i++) {
+            const group_type& src = rhs.m_groups.at(i);
+            group_type& dst = m_groups.at(i);
+            for (uint32_t full = src.match_full(); full; full &= full - 1) {
+                const size_t pos = static_cast<size_t>(std::countr_zero(full));
+                dst.m_slots[pos] = copies(src.m_slots[pos]);
+            }
+        }
+    }
+
+    /* Make room for one more element, if needed. A table which ran out of
+       room through erasing from overflowed groups, rather than by filling
+       up, is rebuilt at the same size rather than grown. A table which
+       erasing has taken below the minimum load factor shrinks to fit, but
+       not below the size last reserved. */
+    void reserve_one()
+    {
+        if (!m_groups.group_count()) {
+            m_groups.rehash(first_group_count);
+        } else if (!m_groups.growth_left()) {
+            const bool grow = m_groups.size() + 1 > m_groups.max_load() / 2;
+            m_groups.rehash(grow ? m_groups.group_count() * 2 : m_groups.group_count());
+        } else if (static_cast<float>(m_groups.size()) < m_min_load_factor * static_cast<float>(m_groups.capacity())) {
+            const size_t shrunk = std::max({first_group_count, m_reserved_groups, slot_groups::group_count_for(m_groups.size() + 1)});
+            if (shrunk < m_groups.group_count()) {
+                m_groups.rehash(shrunk);
+            }
+        }
+    }
+
+    node_type* preinsert_node(const T& value, insert_hints& hints)
+    {
+        const auto& key = m_key_from_value(value);
+        const size_t hash = m_hasher(key);
+        if constexpr (hashed_unique()) {
+            node_type* conflict = find_node(key, hash);
+            if (conflict) {
+                return conflict;
+            }
+        }
+        reserve_one();
+        hints.m_hash = hash;
+        return nullptr;
+    }
+
+    void insert_node(node_type* node, const insert_hints& hints)
+    {
+        const size_t mixed = mix(hints.m_hash);
+        const size_t slot = m_groups.claim_slot(mixed);
+        base_type* base = node->get_base();
+        base->template set_hash<I>(hints.m_hash);
+        base->template set_flat_slot<I>(slot);
+        m_groups.set(slot, node, tag(mixed));
+    }
+
+    /* Size the table so that count elements fit without a rehash. */
+    void presize(size_t count)
+    {
+        const size_t group_count = std::max(first_group_count, slot_groups::group_count_for(count));
+        m_reserved_groups = std::max(m_reserved_groups, group_count);
+        if (group_count > m_groups.group_count()) {
+            m_groups.rehash(group_count);
+        }
+    }
+
+    void bulk_prepare(const std::vector<node_type*>& nodes, bulk_state&)
+    {
+        presize(m_parent.get_size() + nodes.size());
+    }
+
+    node_type* bulk_preinsert(const node_type* node, size_t, bulk_state&, insert_hints& hints)
+    {
+        return preinsert_node(node->value(), hints);
+    }
+
+    void bulk_insert(node_type* node, size_t, bulk_state&, const insert_hints& hints)
+    {
+        insert_node(node, hints);
+    }
+
+    void bulk_finish(const std::vector<node_type*>&, const std::vector<bool>&, bulk_state&) {}
+
+    bool erase_if_modified(const node_type* node, const premodify_cache&)
+    {
+        if (m_hasher(m_key_from_value(node->value())) != node->get_base()->template hash<I>()) {
+            remove_node(node);
+            return true;
+        }
+        return false;
+    }
+
+    node_type* preinsert_modified(const node_type* node, const premodify_cache&, insert_hints& hints)
+    {
+        return preinsert_node(node->value(), hints);
+    }
+
+    /* Whether node's key still hashes to the hash it is filed under. For
+       checking modify() declarations. */
+    bool unmodified(const node_type* node) const
+    {
+        return m_hasher(m_key_from_value(node->value())) == node->get_base()->template hash<I>();
+    }
+
+    void do_clear()
+    {
+        m_groups.clear();
+    }
+
+    /* Clear the index, passing each node to destroy. */
+    template <typename Destroy>
+    void do_clear(Destroy&& destroy)
+    {
+        for (size_t i = 0; i < m_groups.group_count(); i++) {
+            const group_type& group = m_groups.at(i);
+            for (uint32_t full = group.match_full(); full; full &= full - 1) {
+                destroy(group.m_slots[static_cast<size_t>(std::countr_zero(full))]);
+            }
+        }
+        m_groups.clear();
+    }
+
+public:
+
+    class iterator
+    {
+        const node_type* m_node{};
+        const slot_groups* m_groups{nullptr};
+
+        iterator(const node_type* node, const slot_groups* groups) : m_node(node), m_groups(groups) {}
+        friend class tmi_flat_hasher;
+    public:
+
+        typedef const T value_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+        using difference_type = std::ptrdiff_t;
+        using element_type = const T;
+        using iterator_category = std::forward_iterator_tag;
+        iterator() = default;
+        const T& operator*() const { return m_node->value(); }
+        const T* operator->() const { return &m_node->value(); }
+        iterator& operator++()
+        {
+            m_node = first_from(*m_groups, m_node->get_base()->template flat_slot<I>() + 1);
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator copy(m_node, m_groups);
+            ++(*this);
+            return copy;
+        }
+        bool operator==(iterator rhs) const { return m_node == rhs.m_node; }
+        bool operator!=(iterator rhs) const { return m_node != rhs.m_node; }
+    };
+    using const_iterator = iterator;
+
+    iterator begin()
+    {
+        return make_iterator(first_from(m_groups, 0));
+    }
+
+    const_iterator begin() const
+    {
+        return make_iterator(first_from(m_groups, 0));
+    }
+
+    iterator end()
+    {
+        return make_iterator(nullptr);
+    }
+
+    const_iterator end() const
+    {
+        return make_iterator(nullptr);
+    }
+
+    iterator iterator_to(const T& entry)
+    {
+        const node_type* node = &node_type::node_cast(entry);
+        return make_iterator(node);
+    }
+
+    const_iterator iterator_to(const T& entry) const
+    {
+        const node_type* node = &node_type::node_cast(entry);
+        return make_iterator(node);
+    }
+
+    template <typename... Args>
+    std::pair<iterator,bool> emplace(Args&&... args)
+    {
+        auto [node, success] = m_parent.do_emplace(std::forward<Args>(args)...);
+        return std::make_pair(make_iterator(node), success);
+    }
+
+    /* Emplace an element constructed from args, which must have key as its
+       key in this index, unless this index already holds an equal key.
+       Nothing is allocated or constructed in that case. */
+    template <typename... Args>
+    std::pair<iterator,bool> try_emplace(const key_type& key, Args&&... args) requires (hashed_unique())
+    {
+        const iterator it = find(key);
+        if (it != end()) {
+            return std::make_pair(it, false);
+        }
+        return emplace(std::forward<Args>(args)...);
+    }
+
+    /* The value is checked against every index before a node is allocated
+       for it, so rejecting a duplicate costs no allocation. */
+    std::pair<iterator,bool> insert(const T& value)
+    {
+        auto [node, success] = m_parent.do_insert_value(value);
+        return std::make_pair(make_iterator(node), success);
+    }
+
+    std::pair<iterator,bool> insert(T&& value)
+    {
+        auto [node, success] = m_parent.do_insert_value(std::move(value));
+        return std::make_pair(make_iterator(node), success);
+    }
+
+    /* Insert a range of elements, skipping any which conflict with an
+       existing or earlier element. The table is sized for the whole range up
+       front, see multi_index_container::do_insert_range. */
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        m_parent.do_insert_range(first, last);
+    }
+
+    /* Replace the contents with a range of elements. */
+    template <typename InputIt>
+    void assign(InputIt first, InputIt last)
+    {
+        m_parent.do_clear();
+        m_parent.do_insert_range(first, last);
+    }
+
+    template <typename Range>
+    void assign(const Range& range)
+    {
+        assign(std::begin(range), std::end(range));
+    }
+
+    template <typename Callable>
+    bool modify(iterator it, Callable&& func)
+    {
+        node_type* node = const_cast<node_type*>(it.m_node);
+        if (!node) return false;
+        return m_parent.do_modify(node, std::forward<Callable>(func));
+    }
+
+    /* As above, declaring that func only changes the keys of the listed
+       indices, by number or by tag. The other indices skip all of their
+       modify() work. For augmented indices, a change to the aggregated
+       value counts as a key change. Debug builds assert the declaration. */
+    template <int Modified, int... MoreModified, typename Callable>
+    bool modify(iterator it, Callable&& func)
+    {
+        node_type* node = const_cast<node_type*>(it.m_node);
+        if (!node) return false;
+        return m_parent.template do_modify<std::integer_sequence<int, Modified, MoreModified...>>(node, std::forward<Callable>(func));
+    }
+
+    template <typename Tag, typename... MoreTags, typename Callable>
+    bool modify(iterator it, Callable&& func)
+    {
+        return modify<static_cast<int>(Parent::template index_v<Tag>), static_cast<int>(Parent::template index_v<MoreTags>)...>(it, std::forward<Callable>(func));
+    }
+
+    template <typename CompatibleKey>
+    iterator find(const CompatibleKey& key) const
+    {
+        return make_iterator(find_node(key, m_hasher(key)));
+    }
+
+    iterator erase(iterator it)
+    {
+        node_type* node = const_cast<node_type*>(it++.m_node);
+        m_parent.do_erase(node);
+        return it;
+    }
+
+    template <typename CompatibleKey>
+    size_t count(const CompatibleKey& key) const
+    {
+        if constexpr (hashed_unique()) {
+            return find_node(key, m_hasher(key)) != nullptr;
+        } else {
+            if (!m_groups.group_count()) {
+                return 0;
+            }
+            size_t ret = 0;
+            const size_t mixed = mix(m_hasher(key));
+            const int8_t key_tag = tag(mixed);
+            const size_t mask = m_groups.group_count() - 1;
+            size_t group_index = (mixed >> 7) & mask;
+            for (size_t step = 1; step <= m_groups.group_count(); step++) {
+                const group_type& group = m_groups.at(group_index);
+                for (uint32_t match = group.match(key_tag); match; match &= match - 1) {
+                    const node_type* node = group.m_slots[static_cast<size_t>(std::countr_zero(match))];
+                    if (m_pred(m_key_from_value(node->value()), key)) {
+                        ret++;
+                    }
+                }
+                if (!(group.m_overflow & overflow_bit(mixed))) {
+                    break;
+                }
+                group_index = (group_index + step) & mask;
+            }
+            return ret;
+        }
+    }
+
+    void clear()
+    {
+        m_parent.do_clear();
+    }
+
+    /* The number of slots. */
+    size_type bucket_count() const
+    {
+        return m_groups.capacity();
+    }
+
+    float load_factor() const
+    {
+        return m_groups.capacity() ? static_cast<float>(m_groups.size()) / static_cast<float>(m_groups.capacity()) : 0;
+    }
+
+    /* Fixed: the table grows once 7/8 of its slots are in use. */
+    float max_load_factor() const
+    {
+        return 7.0f / 8;
+    }
+
+    float min_load_factor() const
+    {
+        return m_min_load_factor;
+    }
+
+    /* When above zero, an insert which finds the load factor below ml first
+       shrinks the table to fit the current elements. Erasing never rehashes.
+       Must be less than half the maximum load factor. 0 (the default) never
+       shrinks. */
+    void min_load_factor(float ml)
+    {
+        assert(ml >= 0 && ml < max_load_factor() / 2);
+        m_min_load_factor = ml;
+    }
+
+    /* Rehash to at least count slots, or fewer if that's enough for the
+       current elements. rehash(0) shrinks the table to fit, releasing it
+       entirely when empty. A minimum load factor won't shrink the table
+       below count slots. */
+    void rehash(size_type count)
+    {
+        size_t group_count = count ? std::bit_ceil((count + group_width - 1) / group_width) : 0;
+        m_reserved_groups = group_count;
+        if (m_groups.size()) {
+            group_count = std::max(group_count, slot_groups::group_count_for(m_groups.size()));
+        }
+        m_groups.rehash(group_count);
+    }
+
+    /* Make room for count elements without a rehash. Never shrinks, and
+       neither will a minimum load factor below this size. */
+    void reserve(size_type count)
+    {
+        m_reserved_groups = count ? slot_groups::group_count_for(count) : 0;
+        if (count && slot_groups::group_count_for(count) > m_groups.group_count()) {
+            m_groups.rehash(slot_groups::group_count_for(count));
+        }
+    }
+
+    size_t size() const
+    {
+        return m_parent.get_size();
+    }
+
+    bool empty() const
+    {
+        return m_parent.get_empty();
+    }
+
+    insert_return_type insert(node_handle&& handle)
+    {
+        node_type* node = handle.m_node;
+        if(!node) {
+            return {end(), false, {}};
+        }
+        // The node must have come from this container's allocator.
+        assert(*handle.m_alloc == m_parent.m_alloc);
+        node_type* conflict = m_parent.do_insert(node);
+        if (conflict) {
+            return {make_iterator(conflict), false, std::move(handle)};
+        }
+        handle.m_node = nullptr;
+        return {make_iterator(node), true, {}};
+    }
+
+    node_handle extract(const_iterator it)
+    {
+        return m_parent.do_extract(const_cast<node_type*>(it.m_node));
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return m_parent.get_allocator();
+    }
+private:
+
+    /* The node in the first full slot at or after slot, or nullptr. */
+    static const node_type* first_from(const slot_groups& groups, size_t slot)
+    {
+        for (size_t i = slot / group_width; i < groups.group_count(); i++) {
+            uint32_t full = groups.at(i).match_full();
+            if (i == slot / group_width) {
+                full &= ~((uint32_t{1} << (slot % group_width)) - 1);
+            }
+            if (full) {
+                return groups.at(i).m_slots[static_cast<size_t>(std::countr_zero(full))];
+            }
+        }
+        return nullptr;
+    }
+
+    const node_type* node_from_iterator(iterator it) const
+    {
+        return it.m_node;
+    }
+
+    iterator make_iterator(const node_type* node) const
+    {
+        return iterator(node, &m_groups);
+    }
+};
+
+} // namespace tmi
+
+#endif // TMI_FLAT_HASHER_H_
@@ -15,5 +15,11 @@ class tmi_comparator;
 template <typename, typename, typename, typename, typename, int>
 class tmi_hasher;
 
+template <typename, typename, typename, typename, typename, int>
+class tmi_btree;
+
+template <typename, typename, typename, typename, typename, int>
+class tmi_flat_hasher;
+
 } // namespace tmi
 #endif // TMI_FWD_H_
@@ -8,14 +8,25 @@
 #include "tmi_nodehandle.h"
 
 #include <algorithm>
+#include <array>
 #include <bit>
 #include <cassert>
 #include <cstring>
 #include <cstddef>
 #include <iterator>
 #include <limits>
+#include <span>
 #include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TMI_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define TMI_PREFETCH(addr) static_cast<void>(addr)
+#endif
+
 namespace tmi {
 
 template <typename T, typename Node, typename Hasher, typename Parent, typename Allocator, int I>
@@ -33,7 +44,7 @@ public:
     using key_equal = typename Hasher::pred_type;
     using ctor_args = std::tuple<size_type,key_from_value,hasher,key_equal>;
     using allocator_type = Allocator;
-    using node_allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<node_type>;
+    using node_allocator_type = detail::node_allocator_t<Allocator, node_type>;
     using node_handle = detail::node_handle<Allocator, Node>;
     using insert_return_type = detail::insert_return_type<iterator, node_handle>;
     friend Parent;
@@ -41,15 +52,36 @@ public:
 private:
     static constexpr bool hashed_unique() { return Hasher::is_hashed_unique(); }
 
+    /* Chains are doubly linked, so a node can be unlinked without walking
+       its bucket to find its predecessor. */
+    static constexpr bool doubly_linked = std::is_base_of_v<detail::hashed_linked_type, Hasher>;
+
+    /* See full_hash_cache. Buckets are powers of two, indexed by the low bits
+       of a hash, so a 32-bit hash finds the same bucket as the full one. */
+    using hash_cache = typename Hasher::hash_cache;
+    static constexpr bool stores_hash = !std::is_same_v<hash_cache, no_hash_cache>;
+    static constexpr bool stores_full_hash = std::is_same_v<hash_cache, full_hash_cache>;
+
     struct insert_hints {
         size_t m_hash{0};
         base_type** m_bucket{nullptr};
     };
 
-    struct premodify_cache {
+    /* Where a node sits in its singly linked chain, and its hash before the
+       modification if nodes don't store all of it. Comparing only 32 bits
+       would take a changed key for an unchanged one whenever the low bits
+       of their hashes agree, and skip the uniqueness check. */
+    struct chain_position {
         base_type** m_bucket{nullptr};
         base_type* m_prev{nullptr};
+        size_t m_hash{0};
     };
+    struct previous_hash {
+        size_t m_hash{0};
+    };
+    using premodify_cache = std::conditional_t<doubly_linked, std::conditional_t<stores_full_hash, std::tuple<>, previous_hash>, chain_position>;
+
+    struct bulk_state{};
 
     class hash_buckets
     {
@@ -59,6 +91,15 @@ private:
         size_t m_bucket_count{0};
         size_t m_capacity{0};
 
+        /* While growing incrementally, the previous bucket array. Its
+           buckets below m_migrated have been moved into m_buckets, the rest
+           still hold their chains. */
+        base_type** m_old{nullptr};
+        size_t m_old_count{0};
+        size_t m_old_capacity{0};
+        size_t m_migrated{0};
+        bool m_incremental{false};
+
         struct allocation_result
         {
             typename std::allocator_traits<bucket_allocator_type>::pointer ptr;
@@ -68,15 +109,28 @@ private:
         public:
         hash_buckets(const bucket_allocator_type& alloc) : m_alloc(alloc) {}
 
-        hash_buckets(hash_buckets&& rhs) : m_alloc(std::move(rhs.m_alloc)), m_buckets(rhs.m_buckets), m_bucket_count(rhs.m_bucket_count), m_capacity(rhs.m_capacity)
+        hash_buckets(hash_buckets&& rhs) : m_alloc(std::move(rhs.m_alloc)), m_buckets(rhs.m_buckets), m_bucket_count(rhs.m_bucket_count), m_capacity(rhs.m_capacity),
+            m_old(rhs.m_old), m_old_count(rhs.m_old_count), m_old_capacity(rhs.m_old_capacity), m_migrated(rhs.m_migrated), m_incremental(rhs.m_incremental)
         {
             rhs.m_buckets = nullptr;
             rhs.m_capacity = 0;
             rhs.m_bucket_count = 0;
+            rhs.m_old = nullptr;
+            rhs.m_old_count = 0;
+            rhs.m_old_capacity = 0;
+            rhs.m_migrated = 0;
         }
-        hash_buckets(const hash_buckets& rhs) : m_alloc(std::allocator_traits<bucket_allocator_type>::select_on_container_copy_construction(rhs.m_alloc))
+        hash_buckets(const hash_buckets& rhs) : m_alloc(std::allocator_traits<bucket_allocator_type>::select_on_container_copy_construction(rhs.m_alloc)), m_incremental(rhs.m_incremental)
         {
-            init(rhs.m_bucket_count);
+            if (rhs.m_bucket_count) {
+                init(rhs.m_bucket_count);
+            }
+            if (rhs.migrating()) {
+                m_old = do_allocate(rhs.m_old_count);
+                m_old_count = rhs.m_old_count;
+                m_old_capacity = rhs.m_old_count;
+                m_migrated = rhs.m_migrated;
+            }
         }
         hash_buckets(const bucket_allocator_type& alloc, size_t size) : m_alloc(alloc)
         {
@@ -85,6 +139,7 @@ private:
         ~hash_buckets()
         {
             do_deallocate(m_buckets, m_capacity);
+            do_deallocate(m_old, m_old_capacity);
         }
         void init(size_t requested_size)
         {
@@ -97,51 +152,169 @@ private:
             }
             m_bucket_count = new_bucket_count;
         }
-        void rehash(size_t size)
+        /* Move every chain to an array of size buckets, which may be
+           smaller than the current one. A size of 0 releases the array. */
+        void rehash(size_t size, const tmi_hasher& index)
         {
-            size_t new_bucket_count = std::bit_ceil(size);
+            finish_migration(index);
+            size_t new_bucket_count = size ? std::bit_ceil(size) : 0;
             if (m_capacity >= new_bucket_count && new_bucket_count > m_bucket_count) {
-                do_rehash_inplace(new_bucket_count);
+                do_rehash_inplace(new_bucket_count, index);
             } else {
-                do_rehash_copy(new_bucket_count);
+                do_rehash_copy(new_bucket_count, index);
             }
         }
-        void clear()
+
+        /* Grow to at least size buckets. In incremental mode the chains are
+           left where they are and moved over by later calls to migrate(),
+           unless the existing allocation is already big enough. The new
+           array isn't zeroed here either: bucket counts are powers of two,
+           so old bucket i only feeds new buckets i, i + old count, ..., and
+           those are cleared as bucket i is migrated. Until then they are
+           never read. */
+        void grow(size_t size, const tmi_hasher& index)
         {
-            std::memset(m_buckets, 0, m_bucket_count);
-            m_bucket_count = 0;
+            const size_t new_bucket_count = std::bit_ceil(size);
+            if (!m_incremental || m_capacity >= new_bucket_count) {
+                rehash(new_bucket_count, index);
+                return;
+            }
+            finish_migration(index);
+            m_old = m_buckets;
+            m_old_count = m_bucket_count;
+            m_old_capacity = m_capacity;
+            m_migrated = 0;
+            m_buckets = do_allocate(new_bucket_count, false);
+            m_bucket_count = new_bucket_count;
+            m_capacity = new_bucket_count;
         }
-        size_t size() const
+
+        /* Move up to count of the old buckets' chains into the new array,
+           releasing the old array once it is empty. */
+        void migrate(size_t count, const tmi_hasher& index)
         {
-            return m_bucket_count;
+            if (!migrating()) {
+                return;
+            }
+            const size_t end = std::min(m_old_count, m_migrated + count);
+            for (; m_migrated < end; m_migrated++) {
+                for (size_t i = m_migrated; i < m_bucket_count; i += m_old_count) {
+                    m_buckets[i] = nullptr;
+                }
+                base_type* cur_node = m_old[m_migrated];
+                while (cur_node) {
+                    base_type* next_node = cur_node->template next_hash<I>();
+                    link_front(m_buckets[index.node_hash(cur_node) % m_bucket_count], cur_node);
+                    cur_node = next_node;
+                }
+                m_old[m_migrated] = nullptr;
+            }
+            if (m_migrated == m_old_count) {
+                do_deallocate(m_old, m_old_capacity);
+                m_old = nullptr;
+                m_old_count = 0;
+                m_old_capacity = 0;
+                m_migrated = 0;
+            }
         }
-        bool empty() const
+        void finish_migration(const tmi_hasher& index)
         {
-            return m_bucket_count == 0;
+            migrate(m_old_count, index);
         }
-        const base_type* const* begin() const
+        bool migrating() const
         {
-            return &m_buckets[0];
+            return m_old != nullptr;
         }
-        const base_type* const* end() const
+        void set_incremental(bool incremental, const tmi_hasher& index)
         {
-            return &m_buckets[0] + m_bucket_count;
+            m_incremental = incremental;
+            if (!incremental) {
+                finish_migration(index);
+            }
         }
-        base_type** begin()
+
+        /* The chain which holds, or would hold, elements with this hash. */
+        const base_type* const& chain(size_t hash) const
         {
-            return &m_buckets[0];
+            if (m_old != nullptr && hash % m_old_count >= m_migrated) {
+                return m_old[hash % m_old_count];
+            }
+            return m_buckets[hash % m_bucket_count];
         }
-        base_type** end()
+        base_type*& chain(size_t hash)
         {
-            return &m_buckets[0] + m_bucket_count;
+            if (m_old != nullptr && hash % m_old_count >= m_migrated) {
+                return m_old[hash % m_old_count];
+            }
+            return m_buckets[hash % m_bucket_count];
         }
-        const base_type* const& at(size_t index) const
+
+        /* Iteration visits the new array first, followed by any old buckets
+           which have not been migrated yet. */
+        const base_type* first() const
         {
-            return m_buckets[index];
+            return first_from(0);
         }
-        base_type*& at(size_t index)
+        const base_type* next(const base_type* node, const tmi_hasher& index) const
         {
-            return m_buckets[index];
+            const base_type* next = node->template next_hash<I>();
+            if (next != nullptr) {
+                return next;
+            }
+            const size_t hash = index.node_hash(node);
+            if (m_old != nullptr && hash % m_old_count >= m_migrated) {
+                return first_from(m_bucket_count + hash % m_old_count + 1);
+            }
+            return first_from(hash % m_bucket_count + 1);
+        }
+
+        void clear()
+        {
+            if (m_buckets != nullptr) {
+                std::memset(m_buckets, 0, m_bucket_count * sizeof(*m_buckets));
+            }
+            do_deallocate(m_old, m_old_capacity);
+            m_old = nullptr;
+            m_old_count = 0;
+            m_old_capacity = 0;
+            m_migrated = 0;
+            m_bucket_count = 0;
+        }
+
+        /* Copy rhs's chains, swapping in the copies of its nodes. The arrays
+           were sized like rhs's by the copy constructor. */
+        template <typename Map>
+        void clone_chains(const hash_buckets& rhs, const Map& copies)
+        {
+            for (size_t i = 0; i < rhs.m_bucket_count; i++) {
+                if (rhs.m_old == nullptr || i % rhs.m_old_count < rhs.m_migrated) {
+                    clone_chain(m_buckets[i], rhs.m_buckets[i], copies);
+                }
+            }
+            for (size_t i = rhs.m_migrated; i < rhs.m_old_count; i++) {
+                clone_chain(m_old[i], rhs.m_old[i], copies);
+            }
+        }
+        /* Call func with the head of every chain, in either array. */
+        template <typename Callable>
+        void for_each_chain(Callable&& func) const
+        {
+            for (size_t i = 0; i < m_bucket_count; i++) {
+                if (m_old == nullptr || i % m_old_count < m_migrated) {
+                    func(m_buckets[i]);
+                }
+            }
+            for (size_t i = m_migrated; i < m_old_count; i++) {
+                func(m_old[i]);
+            }
+        }
+        size_t size() const
+        {
+            return m_bucket_count;
+        }
+        bool empty() const
+        {
+            return m_bucket_count == 0;
         }
         size_type bucket_count() const
         {
@@ -164,7 +337,46 @@ private:
 
         private:
 
-        void do_rehash_copy(size_t new_bucket_count)
+        const base_type* first_from(size_t pos) const
+        {
+            for (; pos < m_bucket_count; pos++) {
+                if (m_old != nullptr && pos % m_old_count >= m_migrated) {
+                    continue;
+                }
+                if (m_buckets[pos] != nullptr) {
+                    return m_buckets[pos];
+                }
+            }
+            for (size_t i = std::max(pos - m_bucket_count, m_migrated); i < m_old_count; i++) {
+                if (m_old[i] != nullptr) {
+                    return m_old[i];
+                }
+            }
+            return nullptr;
+        }
+
+        template <typename Map>
+        static void clone_chain(base_type*& bucket, const base_type* src, const Map& copies)
+        {
+            base_type* prev = nullptr;
+            for (; src != nullptr; src = src->template next_hash<I>()) {
+                base_type* dst = copies(src->node())->get_base();
+                if (prev != nullptr) {
+                    prev->template set_next_hashptr<I>(dst);
+                } else {
+                    bucket = dst;
+                }
+                if constexpr (doubly_linked) {
+                    dst->template set_prev_hashptr<I>(prev);
+                }
+                prev = dst;
+            }
+            if (prev != nullptr) {
+                prev->template set_next_hashptr<I>(nullptr);
+            }
+        }
+
+        void do_rehash_copy(size_t new_bucket_count, const tmi_hasher& index)
         {
             base_type** new_buckets = do_allocate(new_bucket_count);
             base_type** old_buckets = m_buckets;
@@ -173,10 +385,7 @@ private:
                 base_type* cur_node = old_buckets[i];
                 while (cur_node) {
                     base_type* next_node = cur_node->template next_hash<I>();
-                    const size_t index = cur_node->template hash<I>() % new_bucket_count;
-                    base_type*& new_bucket = new_buckets[index];
-                    cur_node->template set_next_hashptr<I>(new_bucket);
-                    new_bucket = cur_node;
+                    link_front(new_buckets[index.node_hash(cur_node) % new_bucket_count], cur_node);
                     cur_node = next_node;
                 }
             }
@@ -186,38 +395,44 @@ private:
             do_deallocate(old_buckets, old_capacity);
         }
 
-        void do_rehash_inplace(size_t new_bucket_count)
+        void do_rehash_inplace(size_t new_bucket_count, const tmi_hasher& index)
         {
             for(size_t i = 0; i < m_bucket_count; i++) {
                 base_type* cur_node = m_buckets[i];
                 base_type* prev_node = nullptr;
                 while (cur_node) {
                     base_type* next_node = cur_node->template next_hash<I>();
-                    const size_t index = cur_node->template hash<I>() % new_bucket_count;
-                    base_type*& new_bucket = m_buckets[index];
-                    if (index != i) {
+                    const size_t pos = index.node_hash(cur_node) % new_bucket_count;
+                    if (pos != i) {
                         if (prev_node == nullptr) {
-                            m_buckets[i] = cur_node->template next_hash<I>();
+                            m_buckets[i] = next_node;
                         } else {
-                            prev_node->template set_next_hashptr<I>(cur_node->template next_hash<I>());
+                            prev_node->template set_next_hashptr<I>(next_node);
+                        }
+                        if constexpr (doubly_linked) {
+                            if (next_node != nullptr) {
+                                next_node->template set_prev_hashptr<I>(prev_node);
+                            }
                         }
-                        cur_node->template set_next_hashptr<I>(new_bucket);
-                        new_bucket = cur_node;
+                        link_front(m_buckets[pos], cur_node);
+                    } else {
+                        prev_node = cur_node;
                     }
-                    prev_node = cur_node;
                     cur_node = next_node;
                 }
             }
             m_bucket_count = new_bucket_count;
         }
-        base_type** do_allocate(size_t new_capacity)
+        base_type** do_allocate(size_t new_capacity, bool zero = true)
         {
             if (!new_capacity)
             {
                 return nullptr;
             }
             base_type** ret = std::allocator_traits<bucket_allocator_type>::allocate(m_alloc, new_capacity);
-            std::memset(ret, 0, new_capacity * sizeof(*ret));
+            if (zero) {
+                std::memset(ret, 0, new_capacity * sizeof(*ret));
+            }
             return ret;
         }
         void do_deallocate(base_type** buckets, size_t capacity)
@@ -230,22 +445,35 @@ private:
 
     };
 
-    static constexpr bool requires_premodify_cache() { return true; }
+    static constexpr bool requires_premodify_cache() { return !doubly_linked || !stores_full_hash; }
 
     static constexpr size_t first_hashes_resize = 2048;
 
+    static constexpr float default_max_load_factor = 0.8f;
+
+    /* Old buckets moved over per insert while growing incrementally. The
+       table doubles at its maximum load factor, so at the default this
+       finishes well before the next growth is due. Growing again before
+       then finishes the previous migration first. */
+    static constexpr size_t buckets_migrated_per_insert = 4;
+
     Parent& m_parent;
     hash_buckets m_buckets;
     key_from_value m_key_from_value;
     hasher m_hasher;
     key_equal m_pred;
+    float m_max_load_factor{default_max_load_factor};
+    float m_min_load_factor{0};
+    /* The table size asked for by reserve(), rehash() or a bulk insert.
+       Shrinking never goes below it. */
+    size_t m_reserved_buckets{0};
 
     tmi_hasher(Parent& parent, const allocator_type& alloc) : m_parent(parent), m_buckets(alloc) {}
 
     tmi_hasher(Parent& parent, const allocator_type& alloc, const ctor_args& args) : m_parent(parent), m_buckets(alloc, std::get<0>(args)), m_key_from_value(std::get<1>(args)), m_hasher(std::get<2>(args)), m_pred(std::get<3>(args)){}
 
-    tmi_hasher(Parent& parent, const tmi_hasher& rhs) : m_parent(parent), m_buckets(rhs.m_buckets.size(), nullptr), m_key_from_value(rhs.m_key_from_value), m_hasher(rhs.m_hasher), m_pred(rhs.m_pred){}
-    tmi_hasher(Parent& parent, tmi_hasher&& rhs) : m_parent(parent), m_buckets(std::move(rhs.m_buckets)), m_key_from_value(std::move(rhs.m_key_from_value)), m_hasher(std::move(rhs.m_hasher)), m_pred(std::move(rhs.m_pred))
+    tmi_hasher(Parent& parent, const tmi_hasher& rhs) : m_parent(parent), m_buckets(rhs.m_buckets), m_key_from_value(rhs.m_key_from_value), m_hasher(rhs.m_hasher), m_pred(rhs.m_pred), m_max_load_factor(rhs.m_max_load_factor), m_min_load_factor(rhs.m_min_load_factor), m_reserved_buckets(rhs.m_reserved_buckets){}
+    tmi_hasher(Parent& parent, tmi_hasher&& rhs) : m_parent(parent), m_buckets(std::move(rhs.m_buckets)), m_key_from_value(std::move(rhs.m_key_from_value)), m_hasher(std::move(rhs.m_hasher)), m_pred(std::move(rhs.m_pred)), m_max_load_factor(rhs.m_max_load_factor), m_min_load_factor(rhs.m_min_load_factor), m_reserved_buckets(rhs.m_reserved_buckets)
     {
         rhs.m_buckets.clear();
     }
@@ -255,14 +483,37 @@ private:
         return base->template next_hash<I>();
     }
 
-    static size_t get_hash(base_type* base)
+    /* A hash in the form nodes store it. */
+    static size_t stored_hash(size_t hash)
     {
-        return base->template hash<I>();
+        if constexpr (std::is_same_v<hash_cache, hash32_cache>) {
+            return static_cast<uint32_t>(hash);
+        } else {
+            return hash;
+        }
     }
 
-    static void set_hash(base_type* base, size_t hash)
+    /* The hash node is filed under, recomputed if it isn't stored. In the
+       32-bit case only the low bits are known, which is enough to find its
+       bucket. */
+    size_t node_hash(const base_type* base) const
     {
-        base->template set_hash<I>(hash);
+        if constexpr (stores_hash) {
+            return base->template hash<I>();
+        } else {
+            return m_hasher(m_key_from_value(base->node()->value()));
+        }
+    }
+
+    /* Whether node may hold a key with this hash. Without stored hashes,
+       the keys must be compared. */
+    static bool hash_matches(const base_type* base, size_t hash)
+    {
+        if constexpr (stores_hash) {
+            return base->template hash<I>() == stored_hash(hash);
+        } else {
+            return true;
+        }
     }
 
     static void set_next_hashptr(base_type* lhs, base_type* rhs)
@@ -270,6 +521,36 @@ private:
         lhs->template set_next_hashptr<I>(rhs);
     }
 
+    /* Push node onto the front of a chain. */
+    static void link_front(base_type*& bucket, base_type* node)
+    {
+        node->template set_next_hashptr<I>(bucket);
+        if constexpr (doubly_linked) {
+            node->template set_prev_hashptr<I>(nullptr);
+            if (bucket != nullptr) {
+                bucket->template set_prev_hashptr<I>(node);
+            }
+        }
+        bucket = node;
+    }
+
+    /* Unlink a node, filed under hash, from a doubly linked chain. */
+    void unlink(const base_type* base, size_t hash)
+    {
+        base_type* next = base->template next_hash<I>();
+        base_type* prev = base->template prev_hash<I>();
+        if (prev != nullptr) {
+            prev->template set_next_hashptr<I>(next);
+        } else {
+            base_type*& bucket = m_buckets.chain(hash);
+            assert(bucket == base);
+            bucket = next;
+        }
+        if (next != nullptr) {
+            next->template set_prev_hashptr<I>(prev);
+        }
+    }
+
     void remove_node(const node_type* node)
     {
         const base_type* base = node->get_base();
@@ -277,9 +558,11 @@ private:
         if (!bucket_count) {
             return;
         }
-        const size_t index = base->template hash<I>() % bucket_count;
-
-        base_type*& bucket = m_buckets.at(index);
+        if constexpr (doubly_linked) {
+            unlink(base, node_hash(base));
+            return;
+        }
+        base_type*& bucket = m_buckets.chain(node_hash(base));
         base_type* cur_node = bucket;
         base_type* prev_node = cur_node;
         while (cur_node) {
@@ -297,60 +580,111 @@ private:
         }
     }
 
-    void insert_node_direct(node_type* node)
+    /* Copy rhs's hash chains, swapping in the copies of its nodes. The
+       nodes came with their hashes. */
+    template <typename Map>
+    void clone_from(const tmi_hasher& rhs, const Map& copies)
     {
-        base_type* base = node->get_base();
+        m_buckets.clone_chains(rhs.m_buckets, copies);
+    }
 
-        if (base->template hash<I>() == 0) {
-            const size_t hash = m_hasher(m_key_from_value(node->value()));
-            base->template set_hash<I>(hash);
+    /* The number of buckets needed to hold count elements below the
+       maximum load factor. */
+    size_t buckets_for(size_t count) const
+    {
+        if (!count) {
+            return 0;
         }
-        const size_t index = base->template hash<I>() % m_buckets.size();
-        base_type*& bucket = m_buckets.at(index);
-
-        base->template set_next_hashptr<I>(bucket);
-        bucket = base;
+        return std::bit_ceil(static_cast<size_t>(static_cast<float>(count) / m_max_load_factor) + 1);
     }
 
-    /*
-        First rehash if necessary, using first_hashes_resize as the initial
-        size if empty. Then find calculate the bucket and insert there.
-    */
-    node_type* preinsert_node(const node_type* node, insert_hints& hints)
+    /* Make room for one more element before linking it. The table grows
+       once the maximum load factor is reached. If a minimum load factor is
+       set and erasing has taken the table below it, the table shrinks to
+       fit instead, but never below first_hashes_resize buckets or the size
+       last reserved. */
+    void reserve_one()
     {
-        size_t bucket_count = m_buckets.size();
-        const auto& key = m_key_from_value(node->value());
-        const size_t hash = m_hasher(key);
-
+        const size_t size = m_parent.get_size();
+        const size_t bucket_count = m_buckets.size();
         if (!bucket_count) {
             m_buckets.init(first_hashes_resize);
-            bucket_count = first_hashes_resize;
-        } else if (static_cast<double>(m_parent.get_size()) / static_cast<double>(bucket_count) >= 0.8) {
-            bucket_count *= 2;
-            m_buckets.rehash(bucket_count);
+        } else if (static_cast<float>(size) >= m_max_load_factor * static_cast<float>(bucket_count)) {
+            m_buckets.grow(std::max(bucket_count * 2, buckets_for(size + 1)), *this);
+        } else if (static_cast<float>(size) < m_min_load_factor * static_cast<float>(bucket_count)) {
+            const size_t shrunk = std::max({first_hashes_resize, m_reserved_buckets, buckets_for(size + 1)});
+            if (shrunk < bucket_count) {
+                m_buckets.rehash(shrunk, *this);
+            }
         }
+        m_buckets.migrate(buckets_migrated_per_insert, *this);
+    }
 
-        const size_t index = hash % m_buckets.size();
-        base_type*& bucket = m_buckets.at(index);
+    /*
+        Check for a conflict in the bucket for node's hash. Only if there is
+        none, make room for the node (which may rehash, see reserve_one) and
+        then find the bucket it will be linked into.
+    */
+    node_type* preinsert_node(const T& value, insert_hints& hints)
+    {
+        const auto& key = m_key_from_value(value);
+        const size_t hash = m_hasher(key);
 
         if constexpr (hashed_unique()) {
-            base_type* curr = bucket;
-            base_type* prev = curr;
-            while (curr) {
-                if (curr->template hash<I>() == hash) {
-                    if (m_pred(m_key_from_value(curr->node()->value()), key)) {
-                        return curr->node();
+            if (!m_buckets.empty()) {
+                base_type* curr = m_buckets.chain(hash);
+                while (curr) {
+                    if (hash_matches(curr, hash)) {
+                        if (m_pred(m_key_from_value(curr->node()->value()), key)) {
+                            return curr->node();
+                        }
                     }
+                    curr = curr->template next_hash<I>();
                 }
-                prev = curr;
-                curr = curr->template next_hash<I>();
             }
         }
-        hints.m_bucket = &bucket;
+        reserve_one();
+        hints.m_bucket = &m_buckets.chain(hash);
         hints.m_hash = hash;
         return nullptr;
     }
 
+    /* Grow to at least bucket_count buckets. */
+    void grow_to(size_t bucket_count)
+    {
+        if (m_buckets.empty()) {
+            if (bucket_count) {
+                m_buckets.init(bucket_count);
+            }
+        } else if (bucket_count > m_buckets.size()) {
+            m_buckets.rehash(bucket_count, *this);
+        }
+    }
+
+    /* Size the buckets so that count elements fit without a rehash. */
+    void presize(size_t count)
+    {
+        m_reserved_buckets = std::max(m_reserved_buckets, buckets_for(count));
+        grow_to(std::max(first_hashes_resize, buckets_for(count)));
+    }
+
+    void bulk_prepare(const std::vector<node_type*>& nodes, bulk_state&)
+    {
+        presize(m_parent.get_size() + nodes.size());
+    }
+
+    node_type* bulk_preinsert(const node_type* node, size_t, bulk_state&, insert_hints& hints)
+    {
+        return preinsert_node(node->value(), hints);
+    }
+
+    void bulk_insert(node_type* node, size_t, bulk_state&, const insert_hints& hints)
+    {
+        insert_node(node, hints);
+    }
+
+    void bulk_finish(const std::vector<node_type*>&, const std::vector<bool>&, bulk_state&) {}
+
     void create_premodify_cache(const node_type* node, premodify_cache& cache)
     {
         const base_type* base = node->get_base();
@@ -358,32 +692,47 @@ private:
         if (!bucket_count) {
             return;
         }
-        const size_t index = base->template hash<I>() % bucket_count;
-
-        base_type*& bucket = m_buckets.at(index);
-        base_type* cur_node = bucket;
-        base_type* prev_node = cur_node;
-        while (cur_node) {
-            if (cur_node->node() == node) {
-                if (cur_node == prev_node) {
-                    cache.m_prev = nullptr;
-                    cache.m_bucket = &bucket;
-                } else {
-                    cache.m_prev = prev_node;
-                    cache.m_bucket = nullptr;
+        size_t hash;
+        if constexpr (stores_full_hash) {
+            hash = node_hash(base);
+        } else {
+            hash = m_hasher(m_key_from_value(node->value()));
+            cache.m_hash = hash;
+        }
+        if constexpr (!doubly_linked) {
+            base_type*& bucket = m_buckets.chain(hash);
+            base_type* cur_node = bucket;
+            base_type* prev_node = cur_node;
+            while (cur_node) {
+                if (cur_node->node() == node) {
+                    if (cur_node == prev_node) {
+                        cache.m_prev = nullptr;
+                        cache.m_bucket = &bucket;
+                    } else {
+                        cache.m_prev = prev_node;
+                        cache.m_bucket = nullptr;
+                    }
+                    break;
                 }
-                break;
+                prev_node = cur_node;
+                cur_node = cur_node->template next_hash<I>();
             }
-            prev_node = cur_node;
-            cur_node = cur_node->template next_hash<I>();
         }
     }
 
     bool erase_if_modified(const node_type* node, const premodify_cache& cache)
     {
         const base_type* base = node->get_base();
-        if (m_hasher(m_key_from_value(node->value())) != base->template hash<I>()) {
-            if (cache.m_prev) {
+        size_t old_hash;
+        if constexpr (stores_full_hash) {
+            old_hash = base->template hash<I>();
+        } else {
+            old_hash = cache.m_hash;
+        }
+        if (m_hasher(m_key_from_value(node->value())) != old_hash) {
+            if constexpr (doubly_linked) {
+                unlink(base, old_hash);
+            } else if (cache.m_prev) {
                 cache.m_prev->template set_next_hashptr<I>(base->template next_hash<I>());
             } else {
                 *cache.m_bucket = base->template next_hash<I>();
@@ -393,12 +742,26 @@ private:
         return false;
     }
 
+    node_type* preinsert_modified(const node_type* node, const premodify_cache&, insert_hints& hints)
+    {
+        return preinsert_node(node->value(), hints);
+    }
+
+    /* Whether node's key still hashes to the hash it is filed under. For
+       checking modify() declarations, which can't be checked without stored
+       hashes. */
+    bool unmodified(const node_type* node) const
+    {
+        return hash_matches(node->get_base(), m_hasher(m_key_from_value(node->value())));
+    }
+
     void insert_node(node_type* node, const insert_hints& hints)
     {
         base_type* node_base = node->get_base();
-        node_base->template set_hash<I>(hints.m_hash);
-        node_base->template set_next_hashptr<I>(*hints.m_bucket);
-        *hints.m_bucket = node_base;
+        if constexpr (stores_hash) {
+            node_base->template set_hash<I>(hints.m_hash);
+        }
+        link_front(*hints.m_bucket, node_base);
     }
 
 
@@ -409,9 +772,9 @@ private:
         if (!bucket_count) {
             return nullptr;
         }
-        auto* node = m_buckets.at(hash % bucket_count);
+        auto* node = m_buckets.chain(hash);
         while (node) {
-            if (node->template hash<I>() == hash) {
+            if (hash_matches(node, hash)) {
                 if (m_pred(m_key_from_value(node->node()->value()), hash_key)) {
                     return node->node();
                 }
@@ -426,14 +789,130 @@ private:
         m_buckets.clear();
     }
 
+    /* Clear the index, passing each node to destroy. */
+    template <typename Destroy>
+    void do_clear(Destroy&& destroy)
+    {
+        m_buckets.for_each_chain([&destroy](base_type* node) {
+            while (node != nullptr) {
+                base_type* next = node->template next_hash<I>();
+                destroy(node->node());
+                node = next;
+            }
+        });
+        m_buckets.clear();
+    }
+
+    /* Lookups kept in flight by find_batch. Enough to cover memory latency
+       with the work of the others, few enough that their cache lines
+       aren't evicted before they are used. */
+    static constexpr size_t batch_lookups_in_flight = 16;
+
+    /*
+        Look up every key, calling found(pos, node) with each key's position
+        and its first match, or nullptr.
+
+        Lookups are interleaved in the style of AMAC: each one is a small
+        state machine which issues a prefetch for the next cache line it
+        needs (its bucket, then a chain node, then a node's value if its hash
+        matches) and yields to the next lookup rather than waiting. By the
+        time a lookup comes round again its line has usually arrived, so up
+        to batch_lookups_in_flight misses overlap instead of being paid one
+        after another.
+    */
+    template <typename Found>
+    void do_find_batch(std::span<const key_type> keys, Found&& found) const
+    {
+        enum class stage { bucket, chain, value, done };
+        struct lookup {
+            size_t m_pos{0};
+            size_t m_hash{0};
+            const base_type* m_node{nullptr};
+            stage m_stage{stage::done};
+        };
+
+        if (m_buckets.empty()) {
+            for (size_t pos = 0; pos < keys.size(); pos++) {
+                found(pos, nullptr);
+            }
+            return;
+        }
+
+        std::array<lookup, batch_lookups_in_flight> lookups;
+        size_t next_pos = 0;
+        size_t active = 0;
+        const auto start = [&](lookup& l) {
+            if (next_pos == keys.size()) {
+                l.m_stage = stage::done;
+                return;
+            }
+            l.m_pos = next_pos++;
+            l.m_hash = m_hasher(keys[l.m_pos]);
+            l.m_stage = stage::bucket;
+            TMI_PREFETCH(&m_buckets.chain(l.m_hash));
+            active++;
+        };
+        const auto finish = [&](lookup& l, const base_type* node) {
+            found(l.m_pos, node ? node->node() : nullptr);
+            active--;
+            start(l);
+        };
+        for (lookup& l : lookups) {
+            start(l);
+        }
+        while (active) {
+            for (lookup& l : lookups) {
+                switch (l.m_stage) {
+                case stage::bucket:
+                    l.m_node = m_buckets.chain(l.m_hash);
+                    if (l.m_node == nullptr) {
+                        finish(l, nullptr);
+                    } else {
+                        TMI_PREFETCH(l.m_node);
+                        l.m_stage = stage::chain;
+                    }
+                    break;
+                case stage::chain:
+                    if (hash_matches(l.m_node, l.m_hash)) {
+                        TMI_PREFETCH(&l.m_node->node()->value());
+                        l.m_stage = stage::value;
+                        break;
+                    }
+                    l.m_node = l.m_node->template next_hash<I>();
+                    if (l.m_node == nullptr) {
+                        finish(l, nullptr);
+                    } else {
+                        TMI_PREFETCH(l.m_node);
+                    }
+                    break;
+                case stage::value:
+                    if (m_pred(m_key_from_value(l.m_node->node()->value()), keys[l.m_pos])) {
+                        finish(l, l.m_node);
+                        break;
+                    }
+                    l.m_node = l.m_node->template next_hash<I>();
+                    if (l.m_node == nullptr) {
+                        finish(l, nullptr);
+                    } else {
+                        TMI_PREFETCH(l.m_node);
+                        l.m_stage = stage::chain;
+                    }
+                    break;
+                case stage::done:
+                    break;
+                }
+            }
+        }
+    }
+
 public:
 
     class iterator
     {
         const node_type* m_node{};
-        const hash_buckets* m_buckets{nullptr};
+        const tmi_hasher* m_index{nullptr};
 
-        iterator(const node_type* node, const hash_buckets* buckets) : m_node(node), m_buckets(buckets) {}
+        iterator(const node_type* node, const tmi_hasher* index) : m_node(node), m_index(index) {}
         friend class tmi_hasher;
     public:
 
@@ -448,18 +927,7 @@ public:
         const T* operator->() const { return &m_node->value(); }
         iterator& operator++()
         {
-            const base_type* next = m_node->get_base()->template next_hash<I>();
-            if (!next) {
-                const size_t bucket_size = m_buckets->size();
-                size_t bucket = m_node->get_base()->template hash<I>() % bucket_size;
-                bucket++;
-                for (; bucket < bucket_size; ++bucket) {
-                    next = m_buckets->at(bucket);
-                    if (next) {
-                        break;
-                    }
-                }
-            }
+            const base_type* next = m_index->m_buckets.next(m_node->get_base(), *m_index);
             if (next == nullptr) {
                 m_node = nullptr;
             } else {
@@ -469,7 +937,7 @@ public:
         }
         iterator operator++(int)
         {
-            iterator copy(m_node, m_buckets);
+            iterator copy(m_node, m_index);
             ++(*this);
             return copy;
         }
@@ -481,22 +949,20 @@ public:
 
     iterator begin()
     {
-        for (const auto& bucket : m_buckets) {
-            if (bucket) {
-                return make_iterator(bucket->node());
-            }
+        const base_type* first = m_buckets.first();
+        if (first == nullptr) {
+            return end();
         }
-        return end();
+        return make_iterator(first->node());
     }
 
     const_iterator begin() const
     {
-        for (const auto& bucket : m_buckets) {
-            if (bucket) {
-                return make_iterator(bucket->node());
-            }
+        const base_type* first = m_buckets.first();
+        if (first == nullptr) {
+            return end();
         }
-        return end();
+        return make_iterator(first->node());
     }
 
     iterator end()
@@ -528,6 +994,56 @@ public:
         return std::make_pair(make_iterator(node), success);
     }
 
+    /* Emplace an element constructed from args, which must have key as its
+       key in this index, unless this index already holds an equal key.
+       Nothing is allocated or constructed in that case. */
+    template <typename... Args>
+    std::pair<iterator,bool> try_emplace(const key_type& key, Args&&... args) requires (hashed_unique())
+    {
+        const iterator it = find(key);
+        if (it != end()) {
+            return std::make_pair(it, false);
+        }
+        return emplace(std::forward<Args>(args)...);
+    }
+
+    /* The value is checked against every index before a node is allocated
+       for it, so rejecting a duplicate costs no allocation. */
+    std::pair<iterator,bool> insert(const T& value)
+    {
+        auto [node, success] = m_parent.do_insert_value(value);
+        return std::make_pair(make_iterator(node), success);
+    }
+
+    std::pair<iterator,bool> insert(T&& value)
+    {
+        auto [node, success] = m_parent.do_insert_value(std::move(value));
+        return std::make_pair(make_iterator(node), success);
+    }
+
+    /* Insert a range of elements, skipping any which conflict with an
+       existing or earlier element. The buckets are sized for the whole
+       range up front, see multi_index_container::do_insert_range. */
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        m_parent.do_insert_range(first, last);
+    }
+
+    /* Replace the contents with a range of elements. */
+    template <typename InputIt>
+    void assign(InputIt first, InputIt last)
+    {
+        m_parent.do_clear();
+        m_parent.do_insert_range(first, last);
+    }
+
+    template <typename Range>
+    void assign(const Range& range)
+    {
+        assign(std::begin(range), std::end(range));
+    }
+
     template <typename Callable>
     bool modify(iterator it, Callable&& func)
     {
@@ -536,6 +1052,24 @@ public:
         return m_parent.do_modify(node, std::forward<Callable>(func));
     }
 
+    /* As above, declaring that func only changes the keys of the listed
+       indices, by number or by tag. The other indices skip all of their
+       modify() work. For augmented indices, a change to the aggregated
+       value counts as a key change. Debug builds assert the declaration. */
+    template <int Modified, int... MoreModified, typename Callable>
+    bool modify(iterator it, Callable&& func)
+    {
+        node_type* node = const_cast<node_type*>(it.m_node);
+        if (!node) return false;
+        return m_parent.template do_modify<std::integer_sequence<int, Modified, MoreModified...>>(node, std::forward<Callable>(func));
+    }
+
+    template <typename Tag, typename... MoreTags, typename Callable>
+    bool modify(iterator it, Callable&& func)
+    {
+        return modify<static_cast<int>(Parent::template index_v<Tag>), static_cast<int>(Parent::template index_v<MoreTags>)...>(it, std::forward<Callable>(func));
+    }
+
     template <typename CompatibleKey>
     iterator find(const CompatibleKey& key) const
     {
@@ -544,9 +1078,9 @@ public:
         if (!bucket_count) {
             return end();
         }
-        auto* node = m_buckets.at(hash % bucket_count);
+        auto* node = m_buckets.chain(hash);
         while (node) {
-            if (node->template hash<I>() == hash) {
+            if (hash_matches(node, hash)) {
                 if (m_pred(m_key_from_value(node->node()->value()), key)) {
                     return make_iterator(node->node());
                 }
@@ -556,6 +1090,27 @@ public:
         return end();
     }
 
+    /* Look up many keys at once, storing an iterator to the first match of
+       keys[i] (or end()) in out[i]. Much faster than calling find() for each
+       key on tables which don't fit in cache, as the lookups' cache misses
+       overlap. See do_find_batch. */
+    void find_batch(std::span<const key_type> keys, std::span<iterator> out) const
+    {
+        assert(out.size() >= keys.size());
+        do_find_batch(keys, [&](size_t pos, const node_type* node) {
+            out[pos] = make_iterator(node);
+        });
+    }
+
+    /* As find_batch, storing whether keys[i] is present in out[i]. */
+    void contains_batch(std::span<const key_type> keys, std::span<bool> out) const
+    {
+        assert(out.size() >= keys.size());
+        do_find_batch(keys, [&](size_t pos, const node_type* node) {
+            out[pos] = node != nullptr;
+        });
+    }
+
     iterator erase(iterator it)
     {
         node_type* node = const_cast<node_type*>(it++.m_node);
@@ -572,9 +1127,9 @@ public:
         if (!bucket_count) {
             return 0;
         }
-        auto* node = m_buckets.at(hash % bucket_count);
+        auto* node = m_buckets.chain(hash);
         while (node) {
-            if (node->template hash<I>() == hash) {
+            if (hash_matches(node, hash)) {
                 if (m_pred(m_key_from_value(node->node()->value()), key)) {
                     ret++;
                     if constexpr (hashed_unique()) break;
@@ -590,6 +1145,74 @@ public:
         m_parent.do_clear();
     }
 
+    size_type bucket_count() const
+    {
+        return m_buckets.bucket_count();
+    }
+
+    float load_factor() const
+    {
+        const size_t bucket_count = m_buckets.size();
+        return bucket_count ? static_cast<float>(m_parent.get_size()) / static_cast<float>(bucket_count) : 0;
+    }
+
+    float max_load_factor() const
+    {
+        return m_max_load_factor;
+    }
+
+    /* The load factor at which the table doubles, 0.8 by default. It takes
+       effect on the next insert. */
+    void max_load_factor(float ml)
+    {
+        assert(ml > 0);
+        m_max_load_factor = ml;
+    }
+
+    float min_load_factor() const
+    {
+        return m_min_load_factor;
+    }
+
+    /* When above zero, an insert which finds the load factor below ml first
+       shrinks the table to fit the current elements. This returns memory
+       after a mass erase. Erasing never rehashes, so erase(it) remains safe
+       while iterating. It must be less than half the maximum load factor, so
+       that a table never shrinks right after growing. 0 (the default) never
+       shrinks. */
+    void min_load_factor(float ml)
+    {
+        assert(ml >= 0 && ml < m_max_load_factor / 2);
+        m_min_load_factor = ml;
+    }
+
+    /* Rehash to at least count buckets, or fewer if that's enough for the
+       current elements. rehash(0) shrinks the table to fit, releasing it
+       entirely when empty. A minimum load factor won't shrink the table
+       below count buckets. */
+    void rehash(size_type count)
+    {
+        m_reserved_buckets = count ? std::bit_ceil(count) : 0;
+        m_buckets.rehash(std::max(count, buckets_for(m_parent.get_size())), *this);
+    }
+
+    /* Make room for count elements without a rehash. Never shrinks, and
+       neither will a minimum load factor below this size. */
+    void reserve(size_type count)
+    {
+        m_reserved_buckets = buckets_for(count);
+        grow_to(buckets_for(count));
+    }
+
+    /* When enabled, growing the table allocates the larger bucket array and
+       then moves a few of the old buckets across on each following insert,
+       rather than rehashing every element at once. Lookups check both arrays
+       until the move is done. Disabling finishes any move in progress. */
+    void incremental_rehash(bool enable)
+    {
+        m_buckets.set_incremental(enable, *this);
+    }
+
     size_t size() const
     {
         return m_parent.get_size();
@@ -606,6 +1229,8 @@ public:
         if(!node) {
             return {end(), false, {}};
         }
+        // The node must have come from this container's allocator.
+        assert(*handle.m_alloc == m_parent.m_alloc);
         node_type* conflict = m_parent.do_insert(node);
         if (conflict) {
             return {make_iterator(conflict), false, std::move(handle)};
@@ -632,7 +1257,7 @@ private:
 
     iterator make_iterator(const node_type* node) const
     {
-        return iterator(node, &m_buckets);
+        return iterator(node, this);
     }
 };
 
@@ -18,10 +18,28 @@
 #endif
 
 namespace tmi {
+
+/* How a chained hashed index keeps each element's hash, given after its
+   key equality predicate. By default the whole hash is stored, so that
+   lookups only compare keys whose hashes match and rehashing never calls
+   the hasher. hash32_cache stores the low 32 bits, which is enough to find
+   an element's bucket and still filters out most mismatches; the 32-bit
+   hashes of a node's indices are packed together. no_hash_cache stores
+   nothing and rehashes the key whenever its hash is needed, which pays off
+   for keys which are cheap to hash and compare. */
+struct full_hash_cache{};
+struct hash32_cache{};
+struct no_hash_cache{};
+
 namespace detail {
 
 struct hashed_type{};
+struct hashed_linked_type : hashed_type{};
+struct flat_hashed_type{};
 struct ordered_type{};
+struct btree_type{};
+struct ranked_type{};
+struct augmented_type{};
 struct tag_type{};
 
 struct tag_dummy : tag_type
@@ -30,7 +48,7 @@ struct tag_dummy : tag_type
     using type = std::tuple<empty>;
 };
 
-template < typename Arg1, typename Arg2, typename Arg3, typename Arg4>
+template < typename Arg1, typename Arg2, typename Arg3, typename Arg4, typename Arg5>
 struct hashed_args
 {
     static constexpr bool using_tags = std::is_base_of_v<tag_type, Arg1>;
@@ -39,12 +57,15 @@ struct hashed_args
     static_assert(!std::is_same_v<key_from_value_type, void>);
     using hasher_arg = std::conditional_t<using_tags, Arg3, Arg2>;
     using pred_arg = std::conditional_t<using_tags, Arg4, Arg3>;
+    using cache_arg = std::conditional_t<using_tags, Arg5, Arg4>;
 
     using default_hasher = std::hash<typename key_from_value_type::result_type>;
     using default_pred = std::equal_to<typename key_from_value_type::result_type>;
 
     using hasher_type = std::conditional_t<std::is_same_v<hasher_arg, void>, default_hasher, hasher_arg>;
     using pred_type = std::conditional_t<std::is_same_v<pred_arg, void>, default_pred, pred_arg>;
+    using hash_cache = std::conditional_t<std::is_same_v<cache_arg, void>, full_hash_cache, cache_arg>;
+    static_assert(std::is_same_v<hash_cache, full_hash_cache> || std::is_same_v<hash_cache, hash32_cache> || std::is_same_v<hash_cache, no_hash_cache>);
     using tags = typename tags_arg::type;
 };
 
@@ -63,6 +84,17 @@ struct ordered_args
     using tags = typename tags_arg::type;
 };
 
+/* Same as ordered_args, with the aggregate inserted after the key extractor:
+   [tag,] key_from_value, aggregate[, comparator] */
+template<typename Arg1, typename Arg2, typename Arg3, typename Arg4>
+struct augmented_args : ordered_args<Arg1,
+                                     std::conditional_t<std::is_base_of_v<tag_type, Arg1>, Arg2, Arg3>,
+                                     std::conditional_t<std::is_base_of_v<tag_type, Arg1>, Arg4, void>>
+{
+    using aggregate_type = std::conditional_t<std::is_base_of_v<tag_type, Arg1>, Arg3, Arg2>;
+    static_assert(!std::is_same_v<aggregate_type, void>);
+};
+
 } // namespace detail
 
 template<typename... Tags>
@@ -75,17 +107,41 @@ template <typename Value>
 struct identity
 {
     using result_type = Value;
-    TMI_CPP23_STATIC constexpr const Value& operator()(const Value& val) { return val; }
+    TMI_CPP23_STATIC constexpr const Value& operator()(const Value& val) TMI_CONST_IF_NOT_CPP23_STATIC { return val; }
+};
+
+template < typename Arg1, typename Arg2=void, typename Arg3=void, typename Arg4=void, typename Arg5=void>
+struct hashed_unique : detail::hashed_type, public detail::hashed_args<Arg1, Arg2, Arg3, Arg4, Arg5>
+{
+    static constexpr bool is_hashed_unique() { return true; }
+};
+
+template < typename Arg1, typename Arg2=void, typename Arg3=void, typename Arg4=void, typename Arg5=void>
+struct hashed_non_unique : detail::hashed_type, public detail::hashed_args<Arg1, Arg2, Arg3, Arg4, Arg5>
+{
+    static constexpr bool is_hashed_unique() { return false; }
 };
 
-template < typename Arg1, typename Arg2=void, typename Arg3=void, typename Arg4=void>
-struct hashed_unique : detail::hashed_type, public detail::hashed_args<Arg1, Arg2, Arg3, Arg4>
+template < typename Arg1, typename Arg2=void, typename Arg3=void, typename Arg4=void, typename Arg5=void>
+struct hashed_linked_unique : detail::hashed_linked_type, public detail::hashed_args<Arg1, Arg2, Arg3, Arg4, Arg5>
 {
     static constexpr bool is_hashed_unique() { return true; }
 };
 
-template < typename Arg1, typename Arg2=void, typename Arg3=void, typename Arg4=void>
-struct hashed_non_unique : detail::hashed_type, public detail::hashed_args<Arg1, Arg2, Arg3, Arg4>
+template < typename Arg1, typename Arg2=void, typename Arg3=void, typename Arg4=void, typename Arg5=void>
+struct hashed_linked_non_unique : detail::hashed_linked_type, public detail::hashed_args<Arg1, Arg2, Arg3, Arg4, Arg5>
+{
+    static constexpr bool is_hashed_unique() { return false; }
+};
+
+template < typename Arg1, typename Arg2=void, typename Arg3=void, typename Arg4=void, typename Arg5=void>
+struct hashed_flat_unique : detail::flat_hashed_type, public detail::hashed_args<Arg1, Arg2, Arg3, Arg4, Arg5>
+{
+    static constexpr bool is_hashed_unique() { return true; }
+};
+
+template < typename Arg1, typename Arg2=void, typename Arg3=void, typename Arg4=void, typename Arg5=void>
+struct hashed_flat_non_unique : detail::flat_hashed_type, public detail::hashed_args<Arg1, Arg2, Arg3, Arg4, Arg5>
 {
     static constexpr bool is_hashed_unique() { return false; }
 };
@@ -102,10 +158,79 @@ struct ordered_non_unique : detail::ordered_type, public detail::ordered_args<Ar
     static constexpr bool is_ordered_unique() { return false; }
 };
 
+template<typename Arg1, typename Arg2 = void, typename Arg3 = void>
+struct ranked_unique : detail::ranked_type, public detail::ordered_args<Arg1, Arg2, Arg3>
+{
+    static constexpr bool is_ordered_unique() { return true; }
+};
+
+template<typename Arg1, typename Arg2 = void, typename Arg3 = void>
+struct ranked_non_unique : detail::ranked_type, public detail::ordered_args<Arg1, Arg2, Arg3>
+{
+    static constexpr bool is_ordered_unique() { return false; }
+};
+
+template<typename Arg1, typename Arg2 = void, typename Arg3 = void>
+struct ordered_btree_unique : detail::btree_type, public detail::ordered_args<Arg1, Arg2, Arg3>
+{
+    static constexpr bool is_ordered_unique() { return true; }
+};
+
+template<typename Arg1, typename Arg2 = void, typename Arg3 = void>
+struct ordered_btree_non_unique : detail::btree_type, public detail::ordered_args<Arg1, Arg2, Arg3>
+{
+    static constexpr bool is_ordered_unique() { return false; }
+};
+
+template<typename Arg1, typename Arg2, typename Arg3 = void, typename Arg4 = void>
+struct augmented_unique : detail::augmented_type, public detail::augmented_args<Arg1, Arg2, Arg3, Arg4>
+{
+    static constexpr bool is_ordered_unique() { return true; }
+};
+
+template<typename Arg1, typename Arg2, typename Arg3 = void, typename Arg4 = void>
+struct augmented_non_unique : detail::augmented_type, public detail::augmented_args<Arg1, Arg2, Arg3, Arg4>
+{
+    static constexpr bool is_ordered_unique() { return false; }
+};
+
 template<typename... Indices>
 struct indexed_by
 {
    using index_types = std::tuple<Indices...>;
+   static constexpr bool insertion_list = true;
+   static constexpr bool compact_links = false;
+   static constexpr bool split_values = false;
+};
+
+/* Same as indexed_by, but the container keeps no list of its elements in
+   insertion order. Each node is two pointers smaller, and inserting or
+   erasing an element no longer stores to its neighbours. Clearing and
+   copying walk the first index instead. */
+template<typename... Indices>
+struct indexed_by_unlisted : indexed_by<Indices...>
+{
+   static constexpr bool insertion_list = false;
+};
+
+/* Same as indexed_by, but nodes live in an arena of aligned chunks owned by
+   the container, and refer to each other with 32-bit links into it rather
+   than pointers. Each tree and chain link, and each subtree size, takes
+   half the space. The container can hold about 2^31 elements. */
+template<typename... Indices>
+struct indexed_by_compact : indexed_by<Indices...>
+{
+   static constexpr bool compact_links = true;
+};
+
+/* Same as indexed_by, but each element's value is allocated apart from its
+   node, which keeps the index links and a pointer to the value. Nodes stay
+   small however large the value is, so walking an index reads fewer cache
+   lines, at the cost of a second allocation per element. */
+template<typename... Indices>
+struct indexed_by_split : indexed_by<Indices...>
+{
+   static constexpr bool split_values = true;
 };
 
 } // namespace tmi
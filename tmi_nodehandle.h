@@ -5,7 +5,9 @@
 #ifndef TMI_NODEHANDLE_H_
 #define TMI_NODEHANDLE_H_
 
+#include "tmi_arena.h"
 #include "tmi_fwd.h" // IWYU pragma: keep
+#include "tminode.h"
 
 #include <memory>
 #include <optional>
@@ -18,7 +20,7 @@ class node_handle
 {
     using node_type = Node;
     using allocator_type = Allocator;
-    using node_allocator_type = typename std::allocator_traits<allocator_type>::template rebind_alloc<node_type>;
+    using node_allocator_type = node_allocator_t<allocator_type, node_type>;
     using value_type = typename Node::value_type;
     std::optional<node_allocator_type> m_alloc{};
     node_type* m_node = nullptr;
@@ -32,13 +34,19 @@ class node_handle
     template <typename, typename, typename, typename, typename, int>
     friend class tmi::tmi_hasher;
 
+    template <typename, typename, typename, typename, typename, int>
+    friend class tmi::tmi_btree;
+
+    template <typename, typename, typename, typename, typename, int>
+    friend class tmi::tmi_flat_hasher;
+
     constexpr node_handle(const node_allocator_type& alloc, node_type* node) noexcept : m_alloc(alloc), m_node(node){}
 
     void destroy()
     {
         if (m_node) {
-            std::allocator_traits<node_allocator_type>::destroy(*m_alloc, m_node);
-            std::allocator_traits<node_allocator_type>::deallocate(*m_alloc, m_node, 1);
+            value_allocator_t<allocator_type, node_type> value_alloc{allocator_type(*m_alloc)};
+            destroy_node(*m_alloc, value_alloc, m_node);
             m_node = nullptr;
         }
     }
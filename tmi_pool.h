@@ -0,0 +1,283 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TMI_POOL_H_
+#define TMI_POOL_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tmi {
+
+struct node_pool_stats
+{
+    // Bytes per block, after rounding up to the alignment.
+    size_t block_size{0};
+    size_t slab_count{0};
+    size_t slab_bytes{0};
+    // Blocks the slabs hold, and how many of them are allocated.
+    size_t capacity{0};
+    size_t in_use{0};
+};
+
+namespace detail {
+
+/*
+    Fixed-size blocks carved from slabs.
+
+    Blocks are handed out from the newest slab in address order, and freed
+    blocks are kept on a singly linked list threaded through their first
+    word. The list is LIFO, so the block reused next is the one freed last,
+    whose cache lines are the most likely to still be warm. Slabs start small
+    and double, up to about a megabyte, and are only returned when the pool
+    is destroyed.
+*/
+class node_pool
+{
+    struct free_block
+    {
+        free_block* m_next;
+    };
+
+    static constexpr size_t min_slab_blocks = 16;
+    static constexpr size_t max_slab_bytes = size_t{1} << 20;
+
+    size_t m_block_size;
+    size_t m_align;
+    size_t m_next_slab_blocks;
+    free_block* m_free{nullptr};
+    std::byte* m_bump{nullptr};
+    std::byte* m_bump_end{nullptr};
+    std::vector<std::pair<void*, size_t>> m_slabs;
+    size_t m_capacity{0};
+    size_t m_in_use{0};
+
+    void add_slab(size_t blocks)
+    {
+        /* Whatever is left of the current slab goes on the free list, so
+           that a new slab can always be carved from the start. */
+        while (m_bump != m_bump_end) {
+            push_free(m_bump);
+            m_bump += m_block_size;
+        }
+        const size_t bytes = blocks * m_block_size;
+        m_slabs.reserve(m_slabs.size() + 1);
+        void* slab = m_align > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? ::operator new(bytes, std::align_val_t{m_align}) : ::operator new(bytes);
+        m_slabs.emplace_back(slab, bytes);
+        m_bump = static_cast<std::byte*>(slab);
+        m_bump_end = m_bump + bytes;
+        m_capacity += blocks;
+    }
+
+    void push_free(void* ptr) noexcept
+    {
+        free_block* block = ::new (ptr) free_block{m_free};
+        m_free = block;
+    }
+
+    // Every block must be able to hold a free_block.
+    static constexpr size_t block_align(size_t align) noexcept
+    {
+        return std::max(align, alignof(free_block));
+    }
+
+    static constexpr size_t block_size(size_t size, size_t align) noexcept
+    {
+        return (std::max(size, sizeof(free_block)) + block_align(align) - 1) / block_align(align) * block_align(align);
+    }
+
+public:
+    node_pool(size_t size, size_t align)
+        : m_block_size(block_size(size, align)),
+          m_align(block_align(align)),
+          m_next_slab_blocks(std::max(min_slab_blocks, size_t{4096} / m_block_size))
+    {
+    }
+
+    node_pool(const node_pool&) = delete;
+    node_pool& operator=(const node_pool&) = delete;
+
+    ~node_pool()
+    {
+        assert(m_in_use == 0);
+        for (const auto& [slab, bytes] : m_slabs) {
+            if (m_align > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+                ::operator delete(slab, bytes, std::align_val_t{m_align});
+            } else {
+                ::operator delete(slab, bytes);
+            }
+        }
+    }
+
+    bool matches(size_t size, size_t align) const noexcept
+    {
+        return block_size(size, align) == m_block_size && block_align(align) == m_align;
+    }
+
+    void* allocate()
+    {
+        void* ret;
+        if (m_free != nullptr) {
+            ret = m_free;
+            m_free = m_free->m_next;
+        } else {
+            if (m_bump == m_bump_end) {
+                add_slab(m_next_slab_blocks);
+                m_next_slab_blocks = std::min(m_next_slab_blocks * 2, std::max(min_slab_blocks, max_slab_bytes / m_block_size));
+            }
+            ret = m_bump;
+            m_bump += m_block_size;
+        }
+        m_in_use++;
+        return ret;
+    }
+
+    void deallocate(void* ptr) noexcept
+    {
+        assert(m_in_use > 0);
+        push_free(ptr);
+        m_in_use--;
+    }
+
+    /* Make sure count more blocks can be allocated without a new slab, by
+       adding one slab for whatever is missing. */
+    void reserve(size_t count)
+    {
+        const size_t available = m_capacity - m_in_use;
+        if (count > available) {
+            add_slab(count - available);
+        }
+    }
+
+    node_pool_stats stats() const noexcept
+    {
+        node_pool_stats ret;
+        ret.block_size = m_block_size;
+        ret.slab_count = m_slabs.size();
+        for (const auto& slab : m_slabs) {
+            ret.slab_bytes += slab.second;
+        }
+        ret.capacity = m_capacity;
+        ret.in_use = m_in_use;
+        return ret;
+    }
+};
+
+/* The pools shared by an allocator and all of its copies and rebinds, one
+   per block size. A container typically needs one for its nodes and, for
+   B+tree indices, one per page type. */
+class node_pool_set
+{
+    std::vector<std::unique_ptr<node_pool>> m_pools;
+
+public:
+    node_pool& get(size_t size, size_t align)
+    {
+        for (const auto& pool : m_pools) {
+            if (pool->matches(size, align)) {
+                return *pool;
+            }
+        }
+        return *m_pools.emplace_back(std::make_unique<node_pool>(size, align));
+    }
+};
+
+} // namespace detail
+
+/*
+    An allocator which carves single objects from slabs and recycles them.
+
+    Intended as the Allocator of a multi_index_container, which rebinds it to
+    node_allocator_type and allocates its nodes one at a time. Those come
+    from a pool of node_size() blocks, as do the pages of B+tree indices from
+    pools of their own. Arrays, such as hash buckets, go to the global
+    allocator as usual.
+
+    Copies and rebinds share their pools, and compare equal. A copied
+    container starts with fresh pools. Pools are not thread-safe.
+*/
+template <typename T>
+class node_pool_allocator
+{
+    template <typename>
+    friend class node_pool_allocator;
+
+    std::shared_ptr<detail::node_pool_set> m_pools;
+    mutable detail::node_pool* m_pool{nullptr};
+
+    detail::node_pool& pool() const
+    {
+        if (m_pool == nullptr) {
+            m_pool = &m_pools->get(sizeof(T), alignof(T));
+        }
+        return *m_pool;
+    }
+
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    node_pool_allocator() : m_pools(std::make_shared<detail::node_pool_set>()) {}
+
+    /* No move constructor: a moved-from allocator must still be usable, and
+       equal to the one it was moved into. */
+    node_pool_allocator(const node_pool_allocator&) noexcept = default;
+    node_pool_allocator& operator=(const node_pool_allocator&) noexcept = default;
+
+    template <typename U>
+    node_pool_allocator(const node_pool_allocator<U>& rhs) noexcept : m_pools(rhs.m_pools) {}
+
+    node_pool_allocator select_on_container_copy_construction() const
+    {
+        return node_pool_allocator();
+    }
+
+    [[nodiscard]] T* allocate(size_t count)
+    {
+        if (count != 1) {
+            return std::allocator<T>().allocate(count);
+        }
+        return static_cast<T*>(pool().allocate());
+    }
+
+    void deallocate(T* ptr, size_t count) noexcept
+    {
+        if (count != 1) {
+            std::allocator<T>().deallocate(ptr, count);
+            return;
+        }
+        pool().deallocate(ptr);
+    }
+
+    /* Make sure count more objects of this type can be allocated without
+       growing the pool. */
+    void reserve(size_t count)
+    {
+        pool().reserve(count);
+    }
+
+    node_pool_stats stats() const
+    {
+        return pool().stats();
+    }
+
+    template <typename U>
+    bool operator==(const node_pool_allocator<U>& rhs) const noexcept
+    {
+        return m_pools == rhs.m_pools;
+    }
+};
+
+} // namespace tmi
+
+#endif // TMI_POOL_H_
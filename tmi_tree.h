@@ -0,0 +1,520 @@
+// Copyright (c) 2024 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TMI_TREE_H_
+#define TMI_TREE_H_
+
+#include <cassert>
+#include <cstddef>
+#include <utility>
+
+namespace tmi {
+namespace detail {
+
+/*
+    Weak AVL (WAVL) tree algorithms, as described by Haeupler, Sen and
+    Tarjan in "Rank-Balanced Trees".
+
+    Every node has an integer rank. The rank difference between a node and
+    each of its children is 1 or 2, missing children have rank -1, and
+    leaves have rank 0. Insertion-only trees are AVL trees; deletions keep
+    the height within 2 log(n) and need at most two rotations.
+
+    Only the parity of each rank is stored, in the spare bit of the parent
+    pointer. Rank differences of 1 and 2 are told apart by comparing
+    parities. The rebalancing loops below only ever need to distinguish
+    differences which are known to be in {0, 1}, {1, 2} or {2, 3}, so the
+    parity is sufficient.
+
+    The root's parent is nullptr. Functions which may change the root take
+    it by reference.
+
+    Augment lets nodes carry data about their subtree. Augment::update(x)
+    recomputes x's data from x and its children. It is called bottom-up for
+    every node whose subtree changed.
+*/
+struct wavl_no_augment
+{
+    static constexpr bool enabled = false;
+    template <typename Base>
+    static void update(Base*) {}
+};
+
+template <int I>
+struct wavl_subtree_size
+{
+    static constexpr bool enabled = true;
+    template <typename Base>
+    static void update(Base* x)
+    {
+        size_t size = 1;
+        if (x->template left<I>() != nullptr)
+            size += x->template left<I>()->template subtree_size<I>();
+        if (x->template right<I>() != nullptr)
+            size += x->template right<I>()->template subtree_size<I>();
+        x->template set_subtree_size<I>(size);
+    }
+};
+
+/* Aggregate is a stateless monoid over elements: operator()(value) maps an
+   element to a result_type, and combine(a, b) joins the results of adjacent
+   ranges, in order. Each node holds the combined result of its subtree. */
+template <int I, typename Aggregate>
+struct wavl_aggregate
+{
+    static constexpr bool enabled = true;
+    template <typename Base>
+    static void update(Base* x)
+    {
+        const Aggregate agg{};
+        typename Aggregate::result_type result = agg(x->node()->value());
+        if (x->template left<I>() != nullptr)
+            result = agg.combine(x->template left<I>()->template aggregate<I>(), result);
+        if (x->template right<I>() != nullptr)
+            result = agg.combine(result, x->template right<I>()->template aggregate<I>());
+        x->template set_aggregate<I>(std::move(result));
+    }
+};
+
+template <typename Base, int I, typename Augment = wavl_no_augment>
+struct wavl_tree
+{
+    static Base* min(Base* x)
+    {
+        while (x->template left<I>() != nullptr)
+            x = x->template left<I>();
+        return x;
+    }
+
+    static Base* max(Base* x)
+    {
+        while (x->template right<I>() != nullptr)
+            x = x->template right<I>();
+        return x;
+    }
+
+    static const Base* min(const Base* x) { return min(const_cast<Base*>(x)); }
+    static const Base* max(const Base* x) { return max(const_cast<Base*>(x)); }
+
+    // Returns nullptr when x is the last node.
+    static Base* next(Base* x)
+    {
+        if (x->template right<I>() != nullptr)
+            return min(x->template right<I>());
+        Base* parent = x->template parent<I>();
+        while (parent != nullptr && x == parent->template right<I>()) {
+            x = parent;
+            parent = parent->template parent<I>();
+        }
+        return parent;
+    }
+
+    // Returns nullptr when x is the first node.
+    static Base* prev(Base* x)
+    {
+        if (x->template left<I>() != nullptr)
+            return max(x->template left<I>());
+        Base* parent = x->template parent<I>();
+        while (parent != nullptr && x == parent->template left<I>()) {
+            x = parent;
+            parent = parent->template parent<I>();
+        }
+        return parent;
+    }
+
+    static const Base* next(const Base* x) { return next(const_cast<Base*>(x)); }
+    static const Base* prev(const Base* x) { return prev(const_cast<Base*>(x)); }
+
+    // Link x into the empty child slot of parent and rebalance. A null
+    // parent means the tree is empty and x becomes the root.
+    static void insert(Base*& root, Base* parent, bool left, Base* x)
+    {
+        x->template set_left<I>(nullptr);
+        x->template set_right<I>(nullptr);
+        x->template set_parent<I>(parent);
+        x->template set_rank_parity<I>(false);
+        if (parent == nullptr) {
+            assert(root == nullptr);
+            root = x;
+        } else if (left) {
+            assert(parent->template left<I>() == nullptr);
+            parent->template set_left<I>(x);
+        } else {
+            assert(parent->template right<I>() == nullptr);
+            parent->template set_right<I>(x);
+        }
+        // x may carry augmented data from a previous position, even as root.
+        update_path(x);
+        if (parent != nullptr)
+            rebalance_after_insert(root, x);
+    }
+
+    // Unlink z and rebalance. z's links are left dangling.
+    static void remove(Base*& root, Base* z)
+    {
+        // y is the node which is physically unlinked: z itself if it has at
+        // most one child, otherwise its successor, which then takes z's place.
+        Base* y = (z->template left<I>() == nullptr || z->template right<I>() == nullptr) ? z : min(z->template right<I>());
+        Base* x = y->template left<I>() != nullptr ? y->template left<I>() : y->template right<I>();
+        Base* parent = y->template parent<I>();
+        bool hole_left = false;
+
+        if (x != nullptr)
+            x->template set_parent<I>(parent);
+        if (parent == nullptr) {
+            root = x;
+        } else if (y == parent->template left<I>()) {
+            parent->template set_left<I>(x);
+            hole_left = true;
+        } else {
+            parent->template set_right<I>(x);
+        }
+
+        if (y != z) {
+            Base* z_parent = z->template parent<I>();
+            y->template set_left<I>(z->template left<I>());
+            if (y->template left<I>() != nullptr)
+                y->template left<I>()->template set_parent<I>(y);
+            y->template set_right<I>(z->template right<I>());
+            if (y->template right<I>() != nullptr)
+                y->template right<I>()->template set_parent<I>(y);
+            y->template set_parent<I>(z_parent);
+            y->template set_rank_parity<I>(z->template rank_parity<I>());
+            if (z_parent == nullptr)
+                root = y;
+            else if (z == z_parent->template left<I>())
+                z_parent->template set_left<I>(y);
+            else
+                z_parent->template set_right<I>(y);
+            if (parent == z)
+                parent = y;
+        }
+
+        if (parent != nullptr) {
+            update_path(parent);
+            rebalance_after_remove(root, parent, hole_left);
+        }
+    }
+
+    // Replace the tree with a balanced one made of n nodes, which are chained
+    // in reverse order through their left links starting at tail. Subtree
+    // sizes differ by at most one, so ranks are just heights. O(n).
+    static void build(Base*& root, Base* tail, size_t n)
+    {
+        int rank;
+        root = build_subtree(tail, n, rank);
+        if (root != nullptr)
+            root->template set_parent<I>(nullptr);
+        assert(tail == nullptr);
+    }
+
+    // Unlink the nodes from first up to, but not including, last (nullptr
+    // for the end of the tree). They are returned as a tree of their own,
+    // whose links are valid but whose augmented data is not. The tree is
+    // split at both ends of the range and the outer parts joined again, which
+    // takes O(log n) however long the range is.
+    static Base* remove_range(Base*& root, Base* first, Base* last)
+    {
+        assert(first != nullptr && first != last);
+        Base* before;
+        Base* after;
+        Base* inside;
+        int before_rank, after_rank, inside_rank, rank;
+        if (last != nullptr) {
+            split(last, before, before_rank, after, after_rank);
+        } else {
+            before = root;
+            before_rank = rank_of(root);
+            after = nullptr;
+            after_rank = -1;
+        }
+        split(first, before, before_rank, inside, inside_rank);
+        root = last != nullptr ? join(before, before_rank, last, after, after_rank, rank) : before;
+        if (root != nullptr)
+            root->template set_parent<I>(nullptr);
+        return join(nullptr, -1, first, inside, inside_rank, rank);
+    }
+
+    // Refresh the augmented data of x and all of its ancestors, e.g. after
+    // x's value has changed without affecting its position.
+    static void update_path(Base* x)
+    {
+        if constexpr (Augment::enabled) {
+            for (; x != nullptr; x = x->template parent<I>())
+                Augment::update(x);
+        }
+    }
+
+private:
+    // Missing children have rank -1, which is odd.
+    static bool parity(const Base* x)
+    {
+        return x == nullptr || x->template rank_parity<I>();
+    }
+
+    // Promotion and demotion by one both just flip the parity.
+    static void flip(Base* x)
+    {
+        x->template set_rank_parity<I>(!x->template rank_parity<I>());
+    }
+
+    // The rank difference between x and its (possibly missing) child.
+    static int rank_diff(const Base* x, const Base* child)
+    {
+        return x->template rank_parity<I>() == parity(child) ? 2 : 1;
+    }
+
+    // A node with a missing child has rank 0 or 1, so ranks can be found by
+    // walking down to one. O(log n).
+    static int rank_of(const Base* x)
+    {
+        if (x == nullptr)
+            return -1;
+        int rank = 0;
+        for (; x->template left<I>() != nullptr; x = x->template left<I>())
+            rank += rank_diff(x, x->template left<I>());
+        return rank + x->template rank_parity<I>();
+    }
+
+    /* Join the trees left and right, of the given ranks, with x between
+       them, and return the new root and its rank. Every node in left must
+       precede every node in right. x is linked at the edge of the taller
+       tree, where its rank fits, and the insertion fixup takes it from
+       there. O(1 + |left_rank - right_rank|). */
+    static Base* join(Base* left, int left_rank, Base* x, Base* right, int right_rank, int& rank)
+    {
+        if (left != nullptr)
+            left->template set_parent<I>(nullptr);
+        if (right != nullptr)
+            right->template set_parent<I>(nullptr);
+        // Walk down the inner edge of the taller tree to the first node c
+        // whose rank is at most one more than the other tree's. x takes its
+        // place, with c and the other tree as children.
+        const bool taller_left = left_rank >= right_rank;
+        Base* root = taller_left ? left : right;
+        const int root_rank = taller_left ? left_rank : right_rank;
+        const int other_rank = taller_left ? right_rank : left_rank;
+        Base* parent = nullptr;
+        Base* c = root;
+        int c_rank = root_rank;
+        while (c_rank > other_rank + 1) {
+            parent = c;
+            c = taller_left ? c->template right<I>() : c->template left<I>();
+            c_rank -= rank_diff(parent, c);
+        }
+        x->template set_left<I>(taller_left ? c : left);
+        x->template set_right<I>(taller_left ? right : c);
+        if (x->template left<I>() != nullptr)
+            x->template left<I>()->template set_parent<I>(x);
+        if (x->template right<I>() != nullptr)
+            x->template right<I>()->template set_parent<I>(x);
+        x->template set_parent<I>(parent);
+        x->template set_rank_parity<I>((c_rank + 1) & 1);
+        if (parent == nullptr) {
+            if constexpr (Augment::enabled)
+                Augment::update(x);
+            rank = c_rank + 1;
+            return x;
+        }
+        if (taller_left)
+            parent->template set_right<I>(x);
+        else
+            parent->template set_left<I>(x);
+        /* c's rank difference was 1 or 2, so x's is 0 or 1. When it is 0,
+           c's rank is other_rank + 1: x is a 1,2 node as after an insertion,
+           and the rank difference of 1 to c is on the inner side. */
+        update_path(x);
+        rebalance_after_insert(root, x);
+        // Rebalancing leaves the rank of the root unchanged or promotes it.
+        rank = root_rank + (root->template rank_parity<I>() != static_cast<bool>(root_rank & 1));
+        return root;
+    }
+
+    /* Cut x out of its tree and split the rest into the nodes before x and
+       the nodes after it. Walking up from x, each ancestor is joined with
+       its other subtree onto one side. The costs of the joins telescope to
+       O(log n). */
+    static void split(Base* x, Base*& left, int& left_rank, Base*& right, int& right_rank)
+    {
+        const int x_rank = rank_of(x);
+        left = x->template left<I>();
+        left_rank = x_rank - rank_diff(x, left);
+        if (left != nullptr)
+            left->template set_parent<I>(nullptr);
+        right = x->template right<I>();
+        right_rank = x_rank - rank_diff(x, right);
+        if (right != nullptr)
+            right->template set_parent<I>(nullptr);
+        // Ranks are derived from parities on the way up, so each is read
+        // before the join which may change it.
+        Base* child = x;
+        Base* curr = x->template parent<I>();
+        int curr_rank = curr != nullptr ? x_rank + rank_diff(curr, x) : -1;
+        while (curr != nullptr) {
+            Base* up = curr->template parent<I>();
+            const int up_rank = up != nullptr ? curr_rank + rank_diff(up, curr) : -1;
+            if (child == curr->template left<I>()) {
+                Base* other = curr->template right<I>();
+                right = join(right, right_rank, curr, other, curr_rank - rank_diff(curr, other), right_rank);
+            } else {
+                Base* other = curr->template left<I>();
+                left = join(other, curr_rank - rank_diff(curr, other), curr, left, left_rank, left_rank);
+            }
+            child = curr;
+            curr = up;
+            curr_rank = up_rank;
+        }
+    }
+
+    // Consumes n nodes from tail, highest first. The root's parent is left
+    // for the caller to set.
+    static Base* build_subtree(Base*& tail, size_t n, int& rank)
+    {
+        if (n == 0) {
+            rank = -1;
+            return nullptr;
+        }
+        int right_rank, left_rank;
+        Base* right = build_subtree(tail, n / 2, right_rank);
+        Base* x = tail;
+        tail = x->template left<I>();
+        Base* left = build_subtree(tail, n - 1 - n / 2, left_rank);
+        x->template set_left<I>(left);
+        x->template set_right<I>(right);
+        if (left != nullptr)
+            left->template set_parent<I>(x);
+        if (right != nullptr)
+            right->template set_parent<I>(x);
+        rank = (left_rank > right_rank ? left_rank : right_rank) + 1;
+        x->template set_rank_parity<I>(rank & 1);
+        if constexpr (Augment::enabled)
+            Augment::update(x);
+        return x;
+    }
+
+    // Rotate x above its parent.
+    static void rotate_up(Base*& root, Base* x)
+    {
+        Base* parent = x->template parent<I>();
+        Base* grandparent = parent->template parent<I>();
+        if (x == parent->template left<I>()) {
+            Base* inner = x->template right<I>();
+            parent->template set_left<I>(inner);
+            if (inner != nullptr)
+                inner->template set_parent<I>(parent);
+            x->template set_right<I>(parent);
+        } else {
+            Base* inner = x->template left<I>();
+            parent->template set_right<I>(inner);
+            if (inner != nullptr)
+                inner->template set_parent<I>(parent);
+            x->template set_left<I>(parent);
+        }
+        parent->template set_parent<I>(x);
+        x->template set_parent<I>(grandparent);
+        if (grandparent == nullptr)
+            root = x;
+        else if (parent == grandparent->template left<I>())
+            grandparent->template set_left<I>(x);
+        else
+            grandparent->template set_right<I>(x);
+        if constexpr (Augment::enabled) {
+            Augment::update(parent);
+            Augment::update(x);
+        }
+    }
+
+    // x has just been inserted as a rank 0 leaf or promoted, so its rank
+    // difference is either 0 (a violation) or 1.
+    static void rebalance_after_insert(Base*& root, Base* x)
+    {
+        Base* parent = x->template parent<I>();
+        while (parent != nullptr) {
+            if (parity(x) != parity(parent))
+                return;
+            const bool x_left = x == parent->template left<I>();
+            Base* sibling = x_left ? parent->template right<I>() : parent->template left<I>();
+            if (parity(sibling) != parity(parent)) {
+                // Sibling is a 1-child. Promote the parent and continue upwards.
+                flip(parent);
+                x = parent;
+                parent = parent->template parent<I>();
+                continue;
+            }
+            // Sibling is a 2-child. x has been promoted, so one of its
+            // children is a 1-child and the other a 2-child.
+            Base* outer = x_left ? x->template left<I>() : x->template right<I>();
+            if (parity(outer) != parity(x)) {
+                rotate_up(root, x);
+                flip(parent);
+            } else {
+                Base* inner = x_left ? x->template right<I>() : x->template left<I>();
+                rotate_up(root, inner);
+                rotate_up(root, inner);
+                flip(inner);
+                flip(x);
+                flip(parent);
+            }
+            return;
+        }
+    }
+
+    // The child of parent on the given side (possibly null) has just had its
+    // rank difference increased by one, so it is now either 2 or 3.
+    static void rebalance_after_remove(Base*& root, Base* parent, bool hole_left)
+    {
+        while (true) {
+            Base* x = hole_left ? parent->template left<I>() : parent->template right<I>();
+            Base* sibling = hole_left ? parent->template right<I>() : parent->template left<I>();
+            if (x == nullptr && sibling == nullptr) {
+                // parent is now a leaf, which must have rank 0.
+                if (!parity(parent))
+                    return;
+                flip(parent);
+            } else if (parity(x) == parity(parent)) {
+                // x is a 2-child.
+                return;
+            } else if (parity(sibling) == parity(parent)) {
+                // x is a 3-child and its sibling a 2-child: demote the parent.
+                flip(parent);
+            } else {
+                // x is a 3-child and its sibling a 1-child. sibling has rank
+                // at least 1, so it is not a leaf.
+                Base* outer = hole_left ? sibling->template right<I>() : sibling->template left<I>();
+                Base* inner = hole_left ? sibling->template left<I>() : sibling->template right<I>();
+                const bool outer_is_2 = parity(outer) == parity(sibling);
+                const bool inner_is_2 = parity(inner) == parity(sibling);
+                if (outer_is_2 && inner_is_2) {
+                    flip(parent);
+                    flip(sibling);
+                } else if (!outer_is_2) {
+                    rotate_up(root, sibling);
+                    flip(sibling);
+                    flip(parent);
+                    if (parent->template left<I>() == nullptr && parent->template right<I>() == nullptr)
+                        flip(parent);
+                    return;
+                } else {
+                    // inner is promoted twice, parent demoted twice, and
+                    // sibling demoted once.
+                    rotate_up(root, inner);
+                    rotate_up(root, inner);
+                    flip(sibling);
+                    return;
+                }
+            }
+            // parent was demoted, increasing its own rank difference.
+            Base* grandparent = parent->template parent<I>();
+            if (grandparent == nullptr)
+                return;
+            hole_left = parent == grandparent->template left<I>();
+            parent = grandparent;
+        }
+    }
+};
+
+} // namespace detail
+} // namespace tmi
+
+#endif // TMI_TREE_H_
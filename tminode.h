@@ -3,6 +3,11 @@
 
 #include "tminode_base.h"
 
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
 namespace tmi {
 
 template<typename T>
@@ -11,76 +16,110 @@ concept inheritable = !std::is_pointer_v<T> && !std::is_reference_v<T>;
 template <class T>
 concept not_inheritable = !inheritable<T>;
 
+template <typename T, typename Indices>
+concept split_value = inheritable<T> && Indices::split_values;
+
 template <typename T, typename Indices>
 class tminode;
 
+namespace detail {
+
+/* A node's neighbours in the container's insertion-order list, if it keeps
+   one. With compact links they are arena_links rather than pointers. */
+template <typename Node, typename Indices, bool Listed = Indices::insertion_list>
+struct insertion_links
+{
+    using link_type = std::conditional_t<Indices::compact_links, uint32_t, Node*>;
+
+    link_type m_prev{};
+    link_type m_next{};
+
+    static link_type make_link(Node* node) noexcept
+    {
+        if constexpr (Indices::compact_links) {
+            return arena_links<Node>::encode(node);
+        } else {
+            return node;
+        }
+    }
+
+    Node* follow(link_type link) const noexcept
+    {
+        if constexpr (Indices::compact_links) {
+            return arena_links<Node>::decode(this, link);
+        } else {
+            return link;
+        }
+    }
+};
+
+template <typename Node, typename Indices>
+struct insertion_links<Node, Indices, false>
+{
+};
+
+} // namespace detail
+
+/* Nodes derive from their tminode_base, which lets the index algorithms get
+   back from a base to its node with a static_cast. T comes first so that a
+   T& can be cast to its node as well; see node_cast. */
 template <inheritable T, typename Indices>
-class tminode<T, Indices> final : private T
+class tminode<T, Indices> final : private T, public tminode_base<T, Indices>
 {
 public:
     using base_type = tminode_base<T, Indices>;
     using value_type = T;
+    using indices_type = Indices;
 private:
-    base_type m_base{};
-    tminode* m_prev{nullptr};
-    tminode* m_next{nullptr};
+    [[no_unique_address]] detail::insertion_links<tminode, Indices> m_links{};
 
 
 public:
     void reset()
     {
-        m_base = {};
+        *get_base() = {};
     }
 
-    tminode(const tminode& rhs) : T(static_cast<const T&>(rhs)), m_base(rhs.m_base)
-    {
-        m_base.m_node = this;
-    }
+    tminode(const tminode& rhs) : T(static_cast<const T&>(rhs)), base_type(*rhs.get_base()) {}
 
-    explicit tminode(const T& elem) : T(elem)
-    {
-        m_base.m_node = this;
-    }
+    explicit tminode(const T& elem) : T(elem) {}
 
     template <typename... Args>
-    tminode(std::in_place_t, Args&&... args) : T(std::forward<Args>(args)...)
-    {
-        m_base.m_node = this;
-    }
+    tminode(std::in_place_t, Args&&... args) : T(std::forward<Args>(args)...) {}
 
     const T& value() const { return static_cast<const T&>(*this); }
     T& value() { return static_cast<T&>(*this); }
 
     base_type* get_base()
     {
-        return &m_base;
+        return this;
     }
 
     const base_type* get_base() const
     {
-        return &m_base;
+        return this;
     }
 
-    tminode* next() const { return m_next; }
-    tminode* prev() const { return m_prev; }
+    tminode* next() const requires (Indices::insertion_list) { return m_links.follow(m_links.m_next); }
+    tminode* prev() const requires (Indices::insertion_list) { return m_links.follow(m_links.m_prev); }
 
-    void link(tminode* prev)
+    void link(tminode* prev) requires (Indices::insertion_list)
     {
         if (prev) {
-            prev->m_next = this;
+            prev->m_links.m_next = m_links.make_link(this);
         }
-        m_prev = prev;
+        m_links.m_prev = m_links.make_link(prev);
     }
 
 
-    void unlink()
+    void unlink() requires (Indices::insertion_list)
     {
-        if (m_prev)
-            m_prev->m_next = m_next;
-        if (m_next)
-            m_next->m_prev = m_prev;
-        m_prev = nullptr;
-        m_next = nullptr;
+        if (tminode* prev_node = prev())
+            prev_node->m_links.m_next = m_links.m_next;
+        if (tminode* next_node = next())
+            next_node->m_links.m_prev = m_links.m_prev;
+        m_links.m_prev = {};
+        m_links.m_next = {};
     }
     static constexpr const tminode& node_cast(const T& elem)
     {
@@ -88,77 +127,241 @@ public:
     }
 };
 
+namespace detail {
+
+/* Holds a pointer value as the first base of its node. Being standard-layout,
+   it shares its address with m_data, which is what node_cast relies on. */
+template <typename T>
+struct node_value
+{
+    T m_data{nullptr};
+};
+
+} // namespace detail
+
 template <not_inheritable T, typename Indices>
-class tminode<T, Indices>
+class tminode<T, Indices> final : private detail::node_value<T>, public tminode_base<T, Indices>
 {
 public:
     using base_type = tminode_base<T, Indices>;
     using value_type = T;
+    using indices_type = Indices;
 private:
-    value_type m_data{nullptr};
-    tminode* m_prev{nullptr};
-    tminode* m_next{nullptr};
-    base_type m_base{};
+    using holder_type = detail::node_value<T>;
+    [[no_unique_address]] detail::insertion_links<tminode, Indices> m_links{};
 
 
 public:
     void reset()
     {
-        m_base = {};
+        *get_base() = {};
+    }
+
+    tminode(const tminode& rhs) : holder_type{rhs.value()}, base_type(*rhs.get_base()) {}
+
+    explicit tminode(const T& elem) : holder_type{elem} {}
+
+    tminode(std::in_place_t, const T& elem) : holder_type{elem} {}
+
+    const T& value() const { return holder_type::m_data; }
+    T& value() { return holder_type::m_data; }
+
+    base_type* get_base()
+    {
+        return this;
+    }
+
+    const base_type* get_base() const
+    {
+        return this;
+    }
+
+    tminode* next() const requires (Indices::insertion_list) { return m_links.follow(m_links.m_next); }
+    tminode* prev() const requires (Indices::insertion_list) { return m_links.follow(m_links.m_prev); }
+
+    void link(tminode* prev) requires (Indices::insertion_list)
+    {
+        if (prev) {
+            prev->m_links.m_next = m_links.make_link(this);
+        }
+        m_links.m_prev = m_links.make_link(prev);
+    }
+    void unlink() requires (Indices::insertion_list)
+    {
+        if (tminode* prev_node = prev())
+            prev_node->m_links.m_next = m_links.m_next;
+        if (tminode* next_node = next())
+            next_node->m_links.m_prev = m_links.m_prev;
+        m_links.m_prev = {};
+        m_links.m_next = {};
+    }
+    static constexpr const tminode& node_cast(const T& elem)
+    {
+        return static_cast<const tminode&>(reinterpret_cast<const holder_type&>(elem));
     }
+};
+
+namespace detail {
+
+/* The value of a split node, allocated on its own and pointing back to its
+   node so that a T& can still be cast to it. */
+template <typename T, typename Node>
+struct value_block final : T
+{
+    Node* m_node{nullptr};
+
+    template <typename... Args>
+    explicit value_block(std::in_place_t, Args&&... args) : T(std::forward<Args>(args)...) {}
+};
+
+} // namespace detail
+
+/* A node which keeps only the index links and a pointer to its value, which
+   lives in a block of its own. Walking an index touches link blocks alone
+   until a value is compared. */
+template <typename T, typename Indices> requires split_value<T, Indices>
+class tminode<T, Indices> final : public tminode_base<T, Indices>
+{
+public:
+    using base_type = tminode_base<T, Indices>;
+    using value_type = T;
+    using indices_type = Indices;
+    using value_block_type = detail::value_block<T, tminode>;
+private:
+    value_block_type* m_value;
+    [[no_unique_address]] detail::insertion_links<tminode, Indices> m_links{};
+
 
-    tminode(const tminode& rhs) : m_data(rhs.m_data), m_base(rhs.m_base)
+public:
+    void reset()
     {
-        m_base.m_node = this;
+        *get_base() = {};
     }
 
-    explicit tminode(const T& elem) : m_data(elem)
+    explicit tminode(value_block_type* value) : m_value(value)
     {
-        m_base.m_node = this;
+        m_value->m_node = this;
     }
 
-    tminode(std::in_place_t, const T& elem) : m_data(elem)
+    tminode(const tminode& rhs, value_block_type* value) : base_type(*rhs.get_base()), m_value(value)
     {
-        m_base.m_node = this;
+        m_value->m_node = this;
     }
 
-    const T& value() const { return m_data; }
-    T& value() { return m_data; }
+    const T& value() const { return *m_value; }
+    T& value() { return *m_value; }
+
+    value_block_type* get_value_block() const
+    {
+        return m_value;
+    }
 
     base_type* get_base()
     {
-        return &m_base;
+        return this;
     }
 
     const base_type* get_base() const
     {
-        return &m_base;
+        return this;
     }
 
-    tminode* next() const { return m_next; }
-    tminode* prev() const { return m_prev; }
+    tminode* next() const requires (Indices::insertion_list) { return m_links.follow(m_links.m_next); }
+    tminode* prev() const requires (Indices::insertion_list) { return m_links.follow(m_links.m_prev); }
 
-    void link(tminode* prev)
+    void link(tminode* prev) requires (Indices::insertion_list)
     {
         if (prev) {
-            prev->m_next = this;
+            prev->m_links.m_next = m_links.make_link(this);
         }
-        m_prev = prev;
+        m_links.m_prev = m_links.make_link(prev);
     }
-    void unlink()
+    void unlink() requires (Indices::insertion_list)
     {
-        if (m_prev)
-            m_prev->m_next = m_next;
-        if (m_next)
-            m_next->m_prev = m_prev;
-        m_prev = nullptr;
-        m_next = nullptr;
+        if (tminode* prev_node = prev())
+            prev_node->m_links.m_next = m_links.m_next;
+        if (tminode* next_node = next())
+            next_node->m_links.m_prev = m_links.m_prev;
+        m_links.m_prev = {};
+        m_links.m_next = {};
     }
-    static constexpr const tminode& node_cast(const T& elem)
+    static const tminode& node_cast(const T& elem)
     {
-        return reinterpret_cast<const tminode&>(elem);
+        return *static_cast<const value_block_type&>(elem).m_node;
     }
 };
 
+namespace detail {
+
+/* Split nodes allocate their values with Allocator rebound to the value
+   block. Other nodes have no use for a second allocator, and get this
+   placeholder instead. */
+struct no_value_allocator
+{
+    template <typename Allocator>
+    explicit no_value_allocator(const Allocator&) noexcept {}
+};
+
+template <typename Allocator, typename Node>
+struct value_allocator_helper
+{
+    using type = no_value_allocator;
+};
+
+template <typename Allocator, typename Node> requires (Node::indices_type::split_values)
+struct value_allocator_helper<Allocator, Node>
+{
+    using type = typename std::allocator_traits<Allocator>::template rebind_alloc<typename Node::value_block_type>;
+};
+
+template <typename Allocator, typename Node>
+using value_allocator_t = typename value_allocator_helper<Allocator, Node>::type;
+
+/* Allocate and construct a node, and for split nodes its value block, with
+   the value constructed from args. */
+template <typename Node, typename NodeAllocator, typename ValueAllocator, typename... Args>
+Node* create_node(NodeAllocator& alloc, ValueAllocator& value_alloc, std::in_place_t, Args&&... args)
+{
+    Node* node = alloc.allocate(1);
+    if constexpr (Node::indices_type::split_values) {
+        using value_traits = std::allocator_traits<ValueAllocator>;
+        auto* value = value_traits::allocate(value_alloc, 1);
+        value_traits::construct(value_alloc, value, std::in_place_t{}, std::forward<Args>(args)...);
+        return ::new (static_cast<void*>(node)) Node(value);
+    } else {
+        return std::uninitialized_construct_using_allocator<Node>(node, alloc, std::in_place_t{}, std::forward<Args>(args)...);
+    }
+}
+
+// A copy of rhs, links included.
+template <typename Node, typename NodeAllocator, typename ValueAllocator>
+Node* create_node(NodeAllocator& alloc, ValueAllocator& value_alloc, const Node& rhs)
+{
+    Node* node = alloc.allocate(1);
+    if constexpr (Node::indices_type::split_values) {
+        using value_traits = std::allocator_traits<ValueAllocator>;
+        auto* value = value_traits::allocate(value_alloc, 1);
+        value_traits::construct(value_alloc, value, std::in_place_t{}, rhs.value());
+        return ::new (static_cast<void*>(node)) Node(rhs, value);
+    } else {
+        return std::uninitialized_construct_using_allocator<Node>(node, alloc, rhs);
+    }
+}
+
+template <typename Node, typename NodeAllocator, typename ValueAllocator>
+void destroy_node(NodeAllocator& alloc, ValueAllocator& value_alloc, Node* node)
+{
+    if constexpr (Node::indices_type::split_values) {
+        using value_traits = std::allocator_traits<ValueAllocator>;
+        auto* value = node->get_value_block();
+        value_traits::destroy(value_alloc, value);
+        value_traits::deallocate(value_alloc, value, 1);
+    }
+    std::allocator_traits<NodeAllocator>::destroy(alloc, node);
+    std::allocator_traits<NodeAllocator>::deallocate(alloc, node, 1);
+}
+
+} // namespace detail
+
 } // namespace tmi
 #endif // TMINODE_H
@@ -1,6 +1,7 @@
 #ifndef TMINODE_BASE_H
 #define TMINODE_BASE_H
 
+#include "tmi_arena.h"
 #include "tmi_index.h"
 
 #include <array>
@@ -12,44 +13,112 @@
 #include <utility>
 
 namespace tmi {
+namespace detail {
+struct btree_page;
+} // namespace detail
 
 template <typename T, typename Indices>
 class tminode;
 
 template <typename T, typename Indices>
 class tminode_base {
-    struct rb {
-        tminode_base* m_left{nullptr};
-        tminode_base* m_right{nullptr};
-        tminode_base* m_parent{nullptr};
+    using node_type = tminode<T, Indices>;
+
+    /* With indexed_by_compact, links are 32-bit references into the
+       container's node arena (see arena_links) and subtree sizes are 32
+       bits as well. */
+    static constexpr bool compact = Indices::compact_links;
+    using link_type = std::conditional_t<compact, uint32_t, tminode_base*>;
+    using size_type = std::conditional_t<compact, uint32_t, size_t>;
+
+    struct tree {
+        link_type m_left{};
+        link_type m_right{};
+        link_type m_parent{};
+    };
+    struct ranked_tree {
+        link_type m_left{};
+        link_type m_right{};
+        link_type m_parent{};
+        size_type m_size{0};
+    };
+    template <typename Aggregate>
+    struct augmented_tree {
+        link_type m_left{};
+        link_type m_right{};
+        link_type m_parent{};
+        typename Aggregate::result_type m_aggregate{};
     };
     struct hash {
-        tminode_base* m_nexthash{nullptr};
+        link_type m_nexthash{};
         size_t m_hash{0};
     };
+    struct linked_hash {
+        link_type m_nexthash{};
+        link_type m_prevhash{};
+        size_t m_hash{0};
+    };
+    /* Chain links alone, for hashed indices which keep 32-bit hashes in
+       m_hash32 or no hashes at all. */
+    struct hash_link {
+        link_type m_nexthash{};
+    };
+    struct linked_hash_link {
+        link_type m_nexthash{};
+        link_type m_prevhash{};
+    };
+    struct btree {
+        detail::btree_page* m_leaf{nullptr};
+    };
+    struct flat_hash {
+        size_t m_hash{0};
+        size_t m_slot{0};
+    };
 
-    /* Pointer back to self. This is a hack which enables the tminode_base
-       structure to be instantiated as required by the red-black-tree
-       implementation. See note towards the top of manysortfind.h for
-       more tminode_base.
+    static link_type make_link(tminode_base* target) noexcept
+    {
+        if constexpr (compact) {
+            return detail::arena_links<node_type>::encode(static_cast<node_type*>(target));
+        } else {
+            return target;
+        }
+    }
 
-       libc++ uses inheritance to create a base class which contains only
-       pointer/color tminode_base. That doesn't work here as we require T to be the
-       first member to enable casting T* to node*. See note in
-       manysortfind::iterator_to.
+    tminode_base* follow(link_type link) const noexcept
+    {
+        if constexpr (compact) {
+            return static_cast<tminode_base*>(detail::arena_links<node_type>::decode(this, link));
+        } else {
+            return link;
+        }
+    }
 
-       Ideally this will be removed once the libc++ red-black-tree
-       functions have been replaced.
+    using index_types = typename Indices::index_types;
 
-    */
-    tminode<T, Indices>* m_node{nullptr};
+    template <typename IndexType>
+    struct index_data_helper { using type = tree; };
+    template <typename IndexType> requires std::is_base_of_v<detail::hashed_type, IndexType>
+    struct index_data_helper<IndexType>
+    {
+        static constexpr bool full = std::is_same_v<typename IndexType::hash_cache, full_hash_cache>;
+        using type = std::conditional_t<std::is_base_of_v<detail::hashed_linked_type, IndexType>,
+                                        std::conditional_t<full, linked_hash, linked_hash_link>,
+                                        std::conditional_t<full, hash, hash_link>>;
+    };
+    template <typename IndexType> requires std::is_base_of_v<detail::btree_type, IndexType>
+    struct index_data_helper<IndexType> { using type = btree; };
+    template <typename IndexType> requires std::is_base_of_v<detail::flat_hashed_type, IndexType>
+    struct index_data_helper<IndexType> { using type = flat_hash; };
+    template <typename IndexType> requires std::is_base_of_v<detail::ranked_type, IndexType>
+    struct index_data_helper<IndexType> { using type = ranked_tree; };
+    template <typename IndexType> requires std::is_base_of_v<detail::augmented_type, IndexType>
+    struct index_data_helper<IndexType> { using type = augmented_tree<typename IndexType::aggregate_type>; };
 
-    using index_types = typename Indices::index_types;
     template <int I>
     struct base_index_type_helper
     {
         using index_type = std::tuple_element_t<I, index_types>;
-        using data_type = std::conditional_t<std::is_base_of_v<detail::hashed_type, index_type>, hash, rb>;
+        using data_type = typename index_data_helper<index_type>::type;
     };
 
     template <typename>
@@ -61,105 +130,215 @@ class tminode_base {
     static constexpr size_t num_indices = std::tuple_size<index_types>();
     using data_types_tuple = typename base_index_helper<std::make_index_sequence<num_indices>>::data_types;
 
+    template <size_t I>
+    static constexpr bool hash32_cached()
+    {
+        using index_type = std::tuple_element_t<I, index_types>;
+        if constexpr (std::is_base_of_v<detail::hashed_type, index_type>) {
+            return std::is_same_v<typename index_type::hash_cache, hash32_cache>;
+        } else {
+            return false;
+        }
+    }
+
+    /* Where index I's hash is in m_hash32: the number of indices before it
+       which also keep 32-bit hashes. */
+    template <size_t I>
+    static constexpr size_t hash32_slot()
+    {
+        return []<size_t... ints>(std::index_sequence<ints...>) {
+            return (size_t{0} + ... + size_t{hash32_cached<ints>()});
+        }(std::make_index_sequence<I>());
+    }
+
     data_types_tuple m_data;
 
-public:
-    friend class tminode<T, Indices>;
-    enum Color : bool {
-        RED = false,
-        BLACK = true
-    };
+    /* The 32-bit hashes of all indices which keep them, side by side so that
+       two of them share a word. */
+    [[no_unique_address]] std::array<uint32_t, hash32_slot<num_indices>()> m_hash32{};
 
+public:
     template <int I>
     void set_right(tminode_base* rhs)
     {
-        std::get<I>(m_data).m_right = rhs;
+        std::get<I>(m_data).m_right = make_link(rhs);
     }
 
     template <int I>
     void set_left(tminode_base* rhs)
     {
-        std::get<I>(m_data).m_left = rhs;
+        std::get<I>(m_data).m_left = make_link(rhs);
     }
 
 
     /* The following functions use Boost's pointer compression trick to
-       encode the red/black bit in the parent pointer. It makes the
+       encode the tree's rank parity bit in the parent pointer. It makes the
        assumption that no sane compiler will ever allow this pointer to
-       be set to an odd memory address. */
+       be set to an odd memory address. Compact links are shifted up to
+       make room for it instead. */
 
     template <int I>
     tminode_base* parent() const
     {
-        static constexpr uintptr_t mask = std::numeric_limits<uintptr_t>::max() - 1;
-        auto addr = reinterpret_cast<uintptr_t>(std::get<I>(m_data).m_parent) & mask;
-        return reinterpret_cast<tminode_base*>(addr);
+        if constexpr (compact) {
+            return follow(std::get<I>(m_data).m_parent >> 1);
+        } else {
+            static constexpr uintptr_t mask = std::numeric_limits<uintptr_t>::max() - 1;
+            auto addr = reinterpret_cast<uintptr_t>(std::get<I>(m_data).m_parent) & mask;
+            return reinterpret_cast<tminode_base*>(addr);
+        }
     }
 
     template <int I>
     void set_parent(tminode_base* rhs)
     {
-        static constexpr uintptr_t mask = 1;
-        auto prev = reinterpret_cast<uintptr_t>(std::get<I>(m_data).m_parent) & mask;
-        auto newaddr = reinterpret_cast<uintptr_t>(rhs) | prev;
-        std::get<I>(m_data).m_parent = reinterpret_cast<tminode_base*>(newaddr);
+        if constexpr (compact) {
+            auto& parent = std::get<I>(m_data).m_parent;
+            parent = (make_link(rhs) << 1) | (parent & 1);
+        } else {
+            static constexpr uintptr_t mask = 1;
+            auto prev = reinterpret_cast<uintptr_t>(std::get<I>(m_data).m_parent) & mask;
+            auto newaddr = reinterpret_cast<uintptr_t>(rhs) | prev;
+            std::get<I>(m_data).m_parent = reinterpret_cast<tminode_base*>(newaddr);
+        }
+    }
+
+    template <int I>
+    bool rank_parity() const
+    {
+        if constexpr (compact) {
+            return (std::get<I>(m_data).m_parent & 1) != 0;
+        } else {
+            static constexpr uintptr_t mask = 1;
+            return (reinterpret_cast<uintptr_t>(std::get<I>(m_data).m_parent) & mask) != 0;
+        }
+    }
+
+    template <int I>
+    void set_rank_parity(bool rhs)
+    {
+        if constexpr (compact) {
+            auto& parent = std::get<I>(m_data).m_parent;
+            parent = (parent & ~uint32_t{1}) | static_cast<uint32_t>(rhs);
+        } else {
+            static constexpr uintptr_t mask = std::numeric_limits<uintptr_t>::max() - 1;
+            auto addr = reinterpret_cast<uintptr_t>(std::get<I>(m_data).m_parent) & mask;
+            std::get<I>(m_data).m_parent = reinterpret_cast<tminode_base*>(addr | static_cast<uintptr_t>(rhs));
+        }
     }
 
     template <int I>
-    Color color() const
+    size_t subtree_size() const
     {
-        static constexpr uintptr_t mask = 1;
-        return (reinterpret_cast<uintptr_t>(std::get<I>(m_data).m_parent) & mask) == 0 ? Color::RED : Color::BLACK;
+        return std::get<I>(m_data).m_size;
     }
 
     template <int I>
-    void set_color(Color rhs)
+    void set_subtree_size(size_t size)
     {
-        static constexpr uintptr_t mask = std::numeric_limits<uintptr_t>::max() - 1;
-        auto addr = reinterpret_cast<uintptr_t>(std::get<I>(m_data).m_parent) & mask;
-        std::get<I>(m_data).m_parent = reinterpret_cast<tminode_base*>(addr | static_cast<uintptr_t>(rhs));
+        std::get<I>(m_data).m_size = static_cast<size_type>(size);
+    }
+
+    template <int I>
+    const auto& aggregate() const
+    {
+        return std::get<I>(m_data).m_aggregate;
+    }
+
+    template <int I, typename Result>
+    void set_aggregate(Result&& result)
+    {
+        std::get<I>(m_data).m_aggregate = std::forward<Result>(result);
     }
 
     template <int I>
     tminode_base* left() const
     {
-        return std::get<I>(m_data).m_left;
+        return follow(std::get<I>(m_data).m_left);
     }
 
     template <int I>
     tminode_base* right() const
     {
-        return std::get<I>(m_data).m_right;
+        return follow(std::get<I>(m_data).m_right);
     }
 
 
+    /* The node this is the base of. Nodes derive from tminode_base, so this
+       is a downcast by an offset known at compile-time rather than a load,
+       and the tree and hash algorithms can work with tminode_base pointers
+       alone. */
     tminode<T, Indices>* node() const
     {
-        return m_node;
+        return static_cast<tminode<T, Indices>*>(const_cast<tminode_base*>(this));
     }
 
     template <int I>
     tminode_base* next_hash() const
     {
-        return std::get<I>(m_data).m_nexthash;
+        return follow(std::get<I>(m_data).m_nexthash);
+    }
+
+    template <int I>
+    tminode_base* prev_hash() const
+    {
+        return follow(std::get<I>(m_data).m_prevhash);
+    }
+
+    template <int I>
+    void set_prev_hashptr(tminode_base* rhs)
+    {
+        std::get<I>(m_data).m_prevhash = make_link(rhs);
     }
 
     template <int I>
     size_t hash() const
     {
-        return std::get<I>(m_data).m_hash;
+        if constexpr (hash32_cached<I>()) {
+            return m_hash32[hash32_slot<I>()];
+        } else {
+            return std::get<I>(m_data).m_hash;
+        }
     }
 
     template <int I>
     void set_hash(size_t hash)
     {
-        std::get<I>(m_data).m_hash = hash;
+        if constexpr (hash32_cached<I>()) {
+            m_hash32[hash32_slot<I>()] = static_cast<uint32_t>(hash);
+        } else {
+            std::get<I>(m_data).m_hash = hash;
+        }
     }
 
     template <int I>
     void set_next_hashptr(tminode_base* rhs)
     {
-        std::get<I>(m_data).m_nexthash = rhs;
+        std::get<I>(m_data).m_nexthash = make_link(rhs);
+    }
+
+    template <int I>
+    size_t flat_slot() const
+    {
+        return std::get<I>(m_data).m_slot;
+    }
+
+    template <int I>
+    void set_flat_slot(size_t slot)
+    {
+        std::get<I>(m_data).m_slot = slot;
+    }
+
+    template <int I>
+    detail::btree_page* btree_leaf() const
+    {
+        return std::get<I>(m_data).m_leaf;
+    }
+
+    template <int I>
+    void set_btree_leaf(detail::btree_page* leaf)
+    {
+        std::get<I>(m_data).m_leaf = leaf;
     }
 };
 